@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "balance.h"
+
+// position of (x, y) along the Hilbert curve filling an n x n grid, n a power of 2
+static long hilbert_index( int n, int x, int y ){
+	long d = 0;
+	for(int s = n / 2; s > 0; s /= 2){
+		int rx = (x & s) > 0;
+		int ry = (y & s) > 0;
+		d += (long) s * s * ((3 * rx) ^ ry);
+		// rotate the quadrant so the curve stays continuous
+		if(ry == 0){
+			if(rx == 1){
+				x = s - 1 - x;
+				y = s - 1 - y;
+			}
+			int swap = x;
+			x = y;
+			y = swap;
+		}
+	}
+	return d;
+}
+
+static long *sort_keys;
+
+static int by_key( const void *a, const void *b ){
+	long ka = sort_keys[*(const int *) a], kb = sort_keys[*(const int *) b];
+	return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+// distinct owners of the tiles within padding of each tile
+static void build_halos( struct tile_owners *own, double padding ){
+	int tiles = own->per_side * own->per_side;
+	int reach = (int) ceil(padding / own->tile_size);
+	int *seen = (int *) malloc(own->n_proc * sizeof(int));
+	for(int r = 0; r < own->n_proc; r++){
+		seen[r] = -1;
+	}
+
+	int space = tiles * 4, used = 0;
+	own->halo = (int *) realloc(own->halo, space * sizeof(int));
+	for(int k = 0; k < tiles; k++){
+		own->halo_start[k] = used;
+		int row = k / own->per_side, col = k % own->per_side;
+		for(int r = MAX(row - reach, 0); r <= MIN(row + reach, own->per_side - 1); r++){
+			for(int c = MAX(col - reach, 0); c <= MIN(col + reach, own->per_side - 1); c++){
+				int owner = own->owner[r * own->per_side + c];
+				if(seen[owner] == k){
+					continue;
+				}
+				seen[owner] = k;
+				if(used == space){
+					space *= 2;
+					own->halo = (int *) realloc(own->halo, space * sizeof(int));
+				}
+				own->halo[used++] = owner;
+			}
+		}
+	}
+	own->halo_start[tiles] = used;
+	free(seen);
+}
+
+void owners_init( struct tile_owners *own, int per_side, int n_proc, struct subdivision *areas, double padding ){
+	memset(own, 0, sizeof(struct tile_owners));
+	// a power-of-two number of tiles per subdivision side, so the curve
+	// covers each subdivision in one piece
+	int sqrt_proc = (int) round(sqrt(n_proc));
+	int per_area = 1;
+	while(per_area * sqrt_proc < per_side){
+		per_area *= 2;
+	}
+	own->per_side = per_area * sqrt_proc;
+	own->tile_size = 1.0 / own->per_side;
+	own->n_proc = n_proc;
+
+	int tiles = own->per_side * own->per_side;
+	own->owner = (int *) malloc(tiles * sizeof(int));
+	own->load = (int *) calloc(tiles, sizeof(int));
+	own->halo_start = (int *) malloc((tiles + 1) * sizeof(int));
+	own->curve = (int *) malloc(tiles * sizeof(int));
+	own->run_rank = (int *) malloc(n_proc * sizeof(int));
+	own->rank_load = (long *) calloc(n_proc, sizeof(long));
+	for(int k = 0; k < tiles; k++){
+		double x = (k % own->per_side + 0.5) * own->tile_size, y = (k / own->per_side + 0.5) * own->tile_size;
+		own->owner[k] = rank_for_location(x, y, n_proc, areas);
+	}
+
+	// tiles in curve order
+	sort_keys = (long *) malloc(tiles * sizeof(long));
+	for(int k = 0; k < tiles; k++){
+		own->curve[k] = k;
+		sort_keys[k] = hilbert_index(own->per_side, k % own->per_side, k / own->per_side);
+	}
+	qsort(own->curve, tiles, sizeof(int), by_key);
+	free(sort_keys);
+	sort_keys = NULL;
+
+	// the i-th equal run of the curve is one whole subdivision; it stays
+	// with that subdivision's rank
+	for(int i = 0; i < n_proc; i++){
+		own->run_rank[i] = own->owner[own->curve[(long) i * tiles / n_proc]];
+	}
+	build_halos(own, padding);
+}
+
+void owners_free( struct tile_owners *own ){
+	free(own->owner);
+	free(own->load);
+	free(own->halo_start);
+	free(own->halo);
+	free(own->curve);
+	free(own->run_rank);
+	free(own->rank_load);
+	memset(own, 0, sizeof(struct tile_owners));
+}
+
+int owners_balance( struct tile_owners *own, double tolerance, double padding ){
+	int tiles = own->per_side * own->per_side;
+	int n_proc = own->n_proc;
+	long total = 0, busiest = 0;
+	memset(own->rank_load, 0, n_proc * sizeof(long));
+	for(int k = 0; k < tiles; k++){
+		own->rank_load[own->owner[k]] += own->load[k];
+		total += own->load[k];
+	}
+	for(int r = 0; r < n_proc; r++){
+		busiest = MAX(busiest, own->rank_load[r]);
+	}
+	if(total == 0 || busiest <= tolerance * total / n_proc){
+		return 0;
+	}
+
+	// cut the curve into runs of equal load; a tile goes to the run holding
+	// the middle of its load, so empty tiles join the run they fall in
+	int moved = 0;
+	long before = 0;
+	memset(own->rank_load, 0, n_proc * sizeof(long));
+	for(int i = 0; i < tiles; i++){
+		int k = own->curve[i];
+		int run = (int) (((double) before + 0.5 * own->load[k]) * n_proc / total);
+		int owner = own->run_rank[MIN(run, n_proc - 1)];
+		moved += owner != own->owner[k];
+		own->owner[k] = owner;
+		own->rank_load[owner] += own->load[k];
+		before += own->load[k];
+	}
+
+	if(moved > 0){
+		build_halos(own, padding);
+	}
+	return moved;
+}
+
+int place_subdivisions( int per_side, const int *node_of, int *cell_rank ){
+	int n_proc = per_side * per_side;
+	int nodes = 0;
+	for(int r = 0; r < n_proc; r++){
+		nodes += node_of[r] == r;
+		cell_rank[r] = r;
+	}
+	if(nodes <= 1){
+		return nodes;
+	}
+
+	// ranks by node, then by rank
+	sort_keys = (long *) malloc(n_proc * sizeof(long));
+	int *ranks = (int *) malloc(n_proc * sizeof(int));
+	for(int r = 0; r < n_proc; r++){
+		ranks[r] = r;
+		sort_keys[r] = (long) node_of[r] * n_proc + r;
+	}
+	qsort(ranks, n_proc, sizeof(int), by_key);
+
+	// cells in curve order
+	int *curve = (int *) malloc(n_proc * sizeof(int));
+	for(int k = 0; k < n_proc; k++){
+		curve[k] = k;
+		sort_keys[k] = hilbert_index(per_side, k % per_side, k / per_side);
+	}
+	qsort(curve, n_proc, sizeof(int), by_key);
+	for(int i = 0; i < n_proc; i++){
+		cell_rank[curve[i]] = ranks[i];
+	}
+	free(sort_keys);
+	sort_keys = NULL;
+	free(ranks);
+	free(curve);
+	return nodes;
+}
@@ -0,0 +1,65 @@
+#ifndef BALANCE_H__
+#define BALANCE_H__
+
+#include "common.h"
+
+//
+//  ownership of the map by tiles, moved between ranks to balance load
+//
+//  The unit square is cut into many more tiles than ranks. Each tile has
+//  one owning rank; to begin with that is the rank whose subdivision holds
+//  its centre, which is the plain rectangular layout. The tiles are strung
+//  along a Hilbert curve, on which every subdivision is one run of equal
+//  length; owners_balance re-cuts the curve into runs of equal load, so a
+//  crowded subdivision is shared out a tile at a time among the ranks
+//  after it on the curve, and a rank's tiles stay close together.
+//
+
+struct tile_owners{
+	int per_side;
+	double tile_size;
+	// rank owning each tile
+	int *owner;
+	// agents per tile over all ranks, filled in by the caller before balancing
+	int *load;
+	// ranks that may need the agents of tile k as ghosts, its own owner
+	// included: halo[halo_start[k]] .. halo[halo_start[k+1]-1]
+	int *halo_start;
+	int *halo;
+	// all tiles in curve order, and the rank that owns each run of it
+	int *curve;
+	int *run_rank;
+	int n_proc;
+	long *rank_load;
+};
+
+// per_side is rounded up to a power of two per subdivision side
+void owners_init( struct tile_owners *own, int per_side, int n_proc, struct subdivision *areas, double padding );
+
+void owners_free( struct tile_owners *own );
+
+inline int owner_tile( struct tile_owners *own, double x, double y ){
+	int col = (int) (x / own->tile_size);
+	int row = (int) (y / own->tile_size);
+	col = col < 0 ? 0 : (col >= own->per_side ? own->per_side - 1 : col);
+	row = row < 0 ? 0 : (row >= own->per_side ? own->per_side - 1 : row);
+	return row * own->per_side + col;
+}
+
+inline int owner_for_location( struct tile_owners *own, double x, double y ){
+	return own->owner[owner_tile(own, x, y)];
+}
+
+// Re-cuts the curve if some rank carries more than tolerance times the mean
+// load; every rank must call it with the same loads. Rebuilds the halos and
+// returns the number of tiles that changed owner.
+int owners_balance( struct tile_owners *own, double tolerance, double padding );
+
+// The rank for each cell of the per_side x per_side subdivision grid, row
+// major. Ranks in node order take consecutive stretches of a Hilbert curve
+// over the grid, so each node gets a compact block and most neighbouring
+// subdivisions share a node. Row major if every rank is on one node.
+// Returns the number of nodes.
+int place_subdivisions( int per_side, const int *node_of, int *cell_rank );
+
+#endif
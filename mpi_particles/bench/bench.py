@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+Runs the scenario catalog (scenarios.cfg) with the simulator's --profile
+output and reports steps/s, agent updates/s and memory high-water per
+scenario, then compares them against a stored baseline.
+
+Wall-clock numbers only mean something on the machine that recorded them,
+so the baseline holds one set of results per host. A host without one
+gets its numbers reported but not checked; record them there with
+--update-baseline. A scenario regresses when it is slower or larger than
+its baseline by more than the tolerance.
+
+	python3 bench/bench.py [options]        (from mpi_particles/)
+	options:
+		--np <cores>            : cores per run, power of 4 (default 4)
+		--max-agents <n>        : skip scenarios with more agents (default 1000)
+		--only <name>           : run only this scenario (repeatable)
+		--run <path>            : simulator binary (default ./run)
+		--baseline <file>       : baseline to compare against (default bench/baseline.json)
+		--host <name>           : baseline entry to compare against and update (default this host's name)
+		--update-baseline       : store these results as this host's baseline instead of comparing
+		--tolerance <fraction>  : allowed slowdown / memory growth (default 0.15)
+		--output <file>         : machine-readable results (default bench_results.json)
+
+Extra mpirun flags can be given in $MPIRUN_FLAGS. Exits 1 if any scenario
+regressed past the tolerance, 0 if the host has no baseline.
+"""
+
+import json, os, platform, shlex, subprocess, sys, tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def option(name, default):
+	if name in sys.argv:
+		return sys.argv[sys.argv.index(name) + 1]
+	return default
+
+
+def read_catalog(path):
+	scenarios = []
+	with open(path) as f:
+		for line in f:
+			line = line.split("#")[0].split()
+			if not line:
+				continue
+			name, map_file, agents, steps, seed = line
+			scenarios.append({"name": name, "map": map_file, "agents": int(agents), "steps": int(steps), "seed": int(seed)})
+	return scenarios
+
+
+def run_scenario(scenario, np, binary):
+	profile = tempfile.NamedTemporaryFile(suffix=".json", delete=False).name
+	cmd = ["mpirun"] + shlex.split(os.environ.get("MPIRUN_FLAGS", "")) + ["-np", str(np), binary,
+		"-c", os.path.join(HERE, scenario["map"]), "-r", str(scenario["agents"]), "-o", "none",
+		"-t", str(scenario["steps"]), "--seed", str(scenario["seed"]), "--profile", profile]
+	result = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+	if result.returncode != 0:
+		sys.stderr.write(result.stderr)
+		raise SystemExit("%s failed: %s" % (scenario["name"], " ".join(cmd)))
+	with open(profile) as f:
+		data = json.load(f)
+	os.unlink(profile)
+	return {
+		"steps_per_second": data["steps_per_second"],
+		"agent_updates_per_second": data["agent_updates_per_second"],
+		"max_rss_kb": data["per_rank"]["max_rss_kb"]["max"],
+		"simulation_time": data["simulation_time"],
+	}
+
+
+def compare(name, result, baseline, tolerance):
+	""" returns a list of regression messages """
+	if name not in baseline:
+		return []
+	base = baseline[name]
+	problems = []
+	for key in ("steps_per_second", "agent_updates_per_second"):
+		if result[key] < (1.0 - tolerance) * base[key]:
+			problems.append("%s %s %.4g < baseline %.4g" % (name, key, result[key], base[key]))
+	if result["max_rss_kb"] > (1.0 + tolerance) * base["max_rss_kb"]:
+		problems.append("%s max_rss_kb %.0f > baseline %.0f" % (name, result["max_rss_kb"], base["max_rss_kb"]))
+	return problems
+
+
+def main():
+	if "--help" in sys.argv or "-h" in sys.argv:
+		print(__doc__)
+		return 0
+
+	np = int(option("--np", 4))
+	max_agents = int(option("--max-agents", 1000))
+	binary = option("--run", "./run")
+	baseline_file = option("--baseline", os.path.join(HERE, "baseline.json"))
+	tolerance = float(option("--tolerance", 0.15))
+	output = option("--output", "bench_results.json")
+	host = option("--host", platform.node())
+	only = [sys.argv[i + 1] for i, arg in enumerate(sys.argv) if arg == "--only"]
+
+	hosts = {}
+	if os.path.exists(baseline_file):
+		with open(baseline_file) as f:
+			hosts = json.load(f).get("hosts", {})
+	baseline = hosts.get(host, {}).get("scenarios", {})
+	if not baseline and "--update-baseline" not in sys.argv:
+		print("no baseline for host %s in %s (hosts: %s); reporting without checking" % (
+			host, baseline_file, ", ".join(sorted(hosts)) or "none"))
+
+	results = {}
+	problems = []
+	print("%-24s %12s %16s %12s %s" % ("scenario", "steps/s", "agent updates/s", "max rss KB", "vs baseline"))
+	for scenario in read_catalog(os.path.join(HERE, "scenarios.cfg")):
+		if scenario["agents"] > max_agents or (only and scenario["name"] not in only):
+			continue
+		key = "%s@%d" % (scenario["name"], np)
+		result = run_scenario(scenario, np, binary)
+		results[key] = result
+
+		found = compare(key, result, baseline, tolerance)
+		problems += found
+		status = "no baseline" if key not in baseline else ("REGRESSED" if found else "ok (%+.1f%%)" % (
+			100.0 * (result["steps_per_second"] / baseline[key]["steps_per_second"] - 1.0)))
+		print("%-24s %12.4g %16.4g %12.0f %s" % (key, result["steps_per_second"], result["agent_updates_per_second"], result["max_rss_kb"], status))
+		sys.stdout.flush()
+
+	with open(output, "w") as f:
+		json.dump({"host": host, "np": np, "tolerance": tolerance, "scenarios": results}, f, indent=2, sort_keys=True)
+
+	if "--update-baseline" in sys.argv:
+		baseline.update(results)
+		hosts[host] = {"scenarios": baseline}
+		with open(baseline_file, "w") as f:
+			json.dump({"hosts": hosts}, f, indent=2, sort_keys=True)
+		print("updated %s for host %s" % (baseline_file, host))
+		return 0
+
+	for problem in problems:
+		print("regression: " + problem)
+	return 1 if problems else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
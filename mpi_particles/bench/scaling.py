@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""
+Strong- and weak-scaling sweeps of the simulator. Generates a map with
+./mapgen (or uses --map), runs every core count with the simulator's
+--profile output and prints one scaling table with parallel efficiency.
+
+	python3 bench/scaling.py [options]      (from mpi_particles/)
+	options:
+		--mode <strong|weak>    : strong keeps the total agents fixed, weak keeps agents per core fixed (default strong)
+		--np <list>             : core counts, powers of 4 (default 1,4,16)
+		--agents <list>         : total agents (strong) or agents per core (weak) (default 10000)
+		--steps <n>             : steps per run (default 100)
+		--seed <n>              : seed for the agents and the map (default 1)
+		--map <file>            : map to run on instead of generating one
+		--kind <name>           : generated map: office, corridors or obstacles (default office)
+		--size <cells>          : generated map width and height (default 256)
+		--run <path>            : simulator binary (default ./run)
+		--mapgen <path>         : map generator binary (default ./mapgen)
+		--output <file>         : machine-readable results (default scaling_results.json)
+
+Extra mpirun flags can be given in $MPIRUN_FLAGS. Efficiency is relative to
+the smallest core count run for the same agent setting: strong is
+t_base * np_base / (t * np), weak is t_base / t.
+"""
+
+import json, os, shlex, subprocess, sys, tempfile
+
+# phases that are communication or waiting rather than agent work
+COMM_PHASES = ("gather", "balance", "exchange", "barrier")
+
+
+def option(name, default):
+	if name in sys.argv:
+		return sys.argv[sys.argv.index(name) + 1]
+	return default
+
+
+def int_list(text):
+	return [int(value) for value in text.split(",") if value]
+
+
+def generate_map(mapgen, kind, size, seed):
+	path = tempfile.NamedTemporaryFile(suffix=".map", delete=False).name
+	cmd = [mapgen, "--kind", kind, "--width", str(size), "--seed", str(seed), "--binary", "-o", path]
+	result = subprocess.run(cmd, stderr=subprocess.PIPE, universal_newlines=True)
+	if result.returncode != 0:
+		sys.stderr.write(result.stderr)
+		raise SystemExit("map generation failed: %s" % " ".join(cmd))
+	return path
+
+
+def run_config(binary, map_file, np, agents, steps, seed):
+	profile = tempfile.NamedTemporaryFile(suffix=".json", delete=False).name
+	cmd = ["mpirun"] + shlex.split(os.environ.get("MPIRUN_FLAGS", "")) + ["-np", str(np), binary,
+		"-c", map_file, "-r", str(agents), "-o", "none", "-t", str(steps), "--seed", str(seed), "--profile", profile]
+	result = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+	if result.returncode != 0:
+		sys.stderr.write(result.stderr)
+		raise SystemExit("run failed: %s" % " ".join(cmd))
+	with open(profile) as f:
+		data = json.load(f)
+	os.unlink(profile)
+	return data
+
+
+def main():
+	if "--help" in sys.argv or "-h" in sys.argv:
+		print(__doc__)
+		return 0
+
+	mode = option("--mode", "strong")
+	if mode not in ("strong", "weak"):
+		raise SystemExit("--mode is strong or weak")
+	nps = sorted(int_list(option("--np", "1,4,16")))
+	agent_settings = int_list(option("--agents", "10000"))
+	steps = int(option("--steps", 100))
+	seed = int(option("--seed", 1))
+	binary = option("--run", "./run")
+	output = option("--output", "scaling_results.json")
+
+	map_file = option("--map", None)
+	generated = None
+	if map_file is None:
+		generated = map_file = generate_map(option("--mapgen", "./mapgen"), option("--kind", "office"), int(option("--size", 256)), seed)
+
+	rows = []
+	print("%s scaling on %s, %d steps" % (mode, option("--map", "generated %s map" % option("--kind", "office")), steps))
+	print("%6s %10s %12s %12s %16s %10s %10s %10s" % ("np", "agents", "agents/core", "time s", "agent updates/s", "comm %", "imbalance", "efficiency"))
+	try:
+		for setting in agent_settings:
+			base = None
+			for np in nps:
+				agents = setting if mode == "strong" else setting * np
+				data = run_config(binary, map_file, np, agents, steps, seed)
+				time = data["simulation_time"]
+				loop = data["per_rank"]["loop_time"]["mean"]
+				comm = sum(data["phases"][phase]["mean"] for phase in COMM_PHASES)
+				if base is None:
+					base = (np, time)
+				if mode == "strong":
+					efficiency = base[1] * base[0] / (time * np)
+				else:
+					efficiency = base[1] / time
+				row = {
+					"np": np,
+					"agents": agents,
+					"agents_per_core": agents / float(np),
+					"simulation_time": time,
+					"steps_per_second": data["steps_per_second"],
+					"agent_updates_per_second": data["agent_updates_per_second"],
+					"comm_fraction": comm / loop if loop > 0 else 0.0,
+					"loop_imbalance": data["per_rank"]["loop_time"]["imbalance"],
+					"efficiency": efficiency,
+					"profile": data,
+				}
+				rows.append(row)
+				print("%6d %10d %12.0f %12.4g %16.4g %10.1f %10.3f %10.3f" % (np, agents, row["agents_per_core"], time,
+					row["agent_updates_per_second"], 100.0 * row["comm_fraction"], row["loop_imbalance"], efficiency))
+				sys.stdout.flush()
+	finally:
+		if generated:
+			os.unlink(generated)
+
+	with open(output, "w") as f:
+		json.dump({"mode": mode, "steps": steps, "seed": seed, "map": option("--map", None), "kind": option("--kind", "office"),
+			"size": int(option("--size", 256)), "runs": rows}, f, indent=2, sort_keys=True)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""
+Checks that --shm loses no agents. Node ranks hand each other ghosts and
+migrating agents through shared outboxes, and a race there only shows
+once ranks drift apart, so one clean run proves little. Runs the scenario
+once with messages, then --runs times with --shm, and compares every
+frame with the message run's: a lost agent leaves a stale slot, so a
+frame counts the agents whose position differs from the message run's.
+
+	python3 bench/shm_check.py [options]    (from mpi_particles/)
+	options:
+		--np <cores>            : cores per run, power of 4 (default 4)
+		--runs <n>              : --shm runs to compare (default 8)
+		--map <file>            : map (default map_box.cfg)
+		--agents <n>            : random agents (default 2000)
+		--steps <n>             : steps per run (default 60)
+		--seed <n>              : seed (default 5)
+		--run <path>            : simulator binary (default ./run)
+
+Extra mpirun flags can be given in $MPIRUN_FLAGS, extra simulator flags
+(--halo-steps, --balance, ...) in $RUN_FLAGS. Exits 1 if any --shm
+run differs from the message run.
+"""
+
+import collections, os, shlex, subprocess, sys, tempfile
+
+
+def option(name, default):
+	if name in sys.argv:
+		return sys.argv[sys.argv.index(name) + 1]
+	return default
+
+
+def run_frames(binary, np, args, shm):
+	out = tempfile.NamedTemporaryFile(suffix=".txt", delete=False).name
+	cmd = ["mpirun"] + shlex.split(os.environ.get("MPIRUN_FLAGS", "")) + ["-np", str(np), binary] + args + ["-o", out]
+	if shm:
+		cmd.append("--shm")
+	result = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+	if result.returncode != 0:
+		sys.stderr.write(result.stderr)
+		raise SystemExit("run failed: %s" % " ".join(cmd))
+	with open(out) as f:
+		lines = f.readlines()
+	os.unlink(out)
+	n = int(lines[0].split()[1])
+	points = [line.split()[1:3] for line in lines if line.startswith("p ")]
+	return [collections.Counter(map(tuple, points[i:i + n])) for i in range(0, len(points), n)]
+
+
+def main():
+	if "--help" in sys.argv or "-h" in sys.argv:
+		print(__doc__)
+		return 0
+
+	np = int(option("--np", 4))
+	runs = int(option("--runs", 8))
+	binary = option("--run", "./run")
+	args = ["-c", option("--map", "map_box.cfg"), "-r", option("--agents", "2000"), "-t", option("--steps", "60"),
+		"--seed", option("--seed", "5")] + shlex.split(os.environ.get("RUN_FLAGS", ""))
+
+	reference = run_frames(binary, np, args, False)
+	agents = sum(reference[0].values()) if reference else 0
+	print("messages: %d frames of %d agents" % (len(reference), agents))
+	failed = 0
+	for r in range(runs):
+		frames = run_frames(binary, np, args, True)
+		off = [sum((a - b).values()) for a, b in zip(reference, frames)]
+		differing = sum(o > 0 for o in off) + abs(len(reference) - len(frames))
+		print("--shm run %d: %d frames, %d differ, at most %d agents off in one" % (r + 1, len(frames), differing, max(off + [0])))
+		sys.stdout.flush()
+		failed += differing > 0
+	print("%d of %d --shm runs differ" % (failed, runs))
+	return 1 if failed else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,172 @@
+#include <mpi.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "common.h"
+#include "transport.h"
+#include "checkpoint.h"
+
+// a file every rank of the transport has open
+struct shared_file{
+	MPI_File fh;
+	int fd;
+};
+
+static bool file_open( struct transport *t, const char *path, bool write, struct shared_file *f ){
+	int ok = 1;
+	if(t->comm != MPI_COMM_NULL){
+		if(write){
+			if(t->rank == 0){
+				MPI_File_delete(path, MPI_INFO_NULL);
+			}
+			MPI_Barrier(t->comm);
+		}
+		int mode = write ? MPI_MODE_CREATE | MPI_MODE_WRONLY : MPI_MODE_RDONLY;
+		ok = MPI_File_open(t->comm, path, mode, MPI_INFO_NULL, &f->fh) == MPI_SUCCESS;
+	}else{
+		// rank 0 starts the file empty before anyone writes to it
+		if(write && t->rank == 0){
+			int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if(fd >= 0){
+				close(fd);
+			}
+		}
+		transport_barrier(t);
+		f->fd = open(path, write ? O_WRONLY : O_RDONLY);
+		ok = f->fd >= 0;
+		transport_reduce(t, &ok, &ok, 1, TRANSPORT_INT, TRANSPORT_MIN, TRANSPORT_ALL);
+	}
+	return ok;
+}
+
+// count records of elem_size bytes at offset; collective, count may be 0
+static void file_io( struct transport *t, struct shared_file *f, bool write, long offset, void *buf, long count, int elem_size ){
+	if(t->comm != MPI_COMM_NULL){
+		MPI_Datatype record;
+		MPI_Type_contiguous(elem_size, MPI_BYTE, &record);
+		MPI_Type_commit(&record);
+		if(write){
+			MPI_File_write_at_all(f->fh, offset, buf, (int) count, record, MPI_STATUS_IGNORE);
+		}else{
+			MPI_File_read_at_all(f->fh, offset, buf, (int) count, record, MPI_STATUS_IGNORE);
+		}
+		MPI_Type_free(&record);
+		return;
+	}
+	long bytes = count * elem_size, done = 0;
+	while(done < bytes){
+		ssize_t moved = write ? pwrite(f->fd, (char *) buf + done, bytes - done, offset + done)
+			: pread(f->fd, (char *) buf + done, bytes - done, offset + done);
+		if(moved <= 0){
+			fprintf(stderr, "%s checkpoint %s failed on rank %i\n", MPI_PREPEND, write ? "write" : "read", t->rank);
+			break;
+		}
+		done += moved;
+	}
+}
+
+static void file_close( struct transport *t, struct shared_file *f ){
+	if(t->comm != MPI_COMM_NULL){
+		MPI_File_close(&f->fh);
+	}else{
+		close(f->fd);
+		transport_barrier(t);
+	}
+}
+
+// where this rank's records of a section start, and how many all ranks have
+static long section_offset( struct transport *t, int count, long *total ){
+	int *counts = (int *) malloc(t->n_proc * sizeof(int));
+	transport_gather(t, &count, sizeof(int), counts, 0);
+	transport_bcast(t, counts, t->n_proc * sizeof(int), 0);
+	long before = 0;
+	*total = 0;
+	for(int r = 0; r < t->n_proc; r++){
+		before += r < t->rank ? counts[r] : 0;
+		*total += counts[r];
+	}
+	free(counts);
+	return before;
+}
+
+uint64_t checkpoint_map_hash( struct map *map_cfg ){
+	// FNV-1a over the cells
+	uint64_t hash = 14695981039346656037ULL;
+	long cells = (long) map_cfg->width * map_cfg->height;
+	for(long i = 0; i < cells; i++){
+		hash = (hash ^ map_cfg->data[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+double checkpoint_write( struct transport *t, const char *path, struct checkpoint_header *header,
+		const particle_t *local, int local_count, const struct arrival *arrivals, int arrivals_count,
+		const struct minimum_particle *parked, int parked_count ){
+	double began = read_timer();
+	memcpy(header->magic, CHECKPOINT_MAGIC, 8);
+	header->agent_bytes = sizeof(particle_t);
+	header->n_proc = t->n_proc;
+	long agents_before = section_offset(t, local_count, &header->agents);
+	long arrivals_before = section_offset(t, arrivals_count, &header->arrivals);
+	header->parked = t->rank == 0 ? parked_count : 0;
+	transport_bcast(t, &header->parked, sizeof(long), 0);
+
+	char temp[strlen(path) + 5];
+	sprintf(temp, "%s.tmp", path);
+	struct shared_file f;
+	if(!file_open(t, temp, true, &f)){
+		if(t->rank == 0){
+			fprintf(stderr, "%s can't write checkpoint %s\n", MPI_PREPEND, temp);
+		}
+		return read_timer() - began;
+	}
+	long at = sizeof(struct checkpoint_header);
+	file_io(t, &f, true, 0, header, t->rank == 0, sizeof(struct checkpoint_header));
+	file_io(t, &f, true, at + agents_before * sizeof(particle_t), (void *) local, local_count, sizeof(particle_t));
+	at += header->agents * sizeof(particle_t);
+	file_io(t, &f, true, at + arrivals_before * sizeof(struct arrival), (void *) arrivals, arrivals_count, sizeof(struct arrival));
+	at += header->arrivals * sizeof(struct arrival);
+	file_io(t, &f, true, at, (void *) parked, t->rank == 0 ? header->parked : 0, sizeof(struct minimum_particle));
+	file_close(t, &f);
+
+	if(t->rank == 0 && rename(temp, path) != 0){
+		fprintf(stderr, "%s can't move checkpoint into %s\n", MPI_PREPEND, path);
+	}
+	transport_barrier(t);
+	return read_timer() - began;
+}
+
+bool checkpoint_read_header( struct transport *t, const char *path, struct checkpoint_header *header ){
+	struct shared_file f;
+	if(!file_open(t, path, false, &f)){
+		return false;
+	}
+	memset(header, 0, sizeof(struct checkpoint_header));
+	file_io(t, &f, false, 0, header, 1, sizeof(struct checkpoint_header));
+	file_close(t, &f);
+	return memcmp(header->magic, CHECKPOINT_MAGIC, 8) == 0 && header->agent_bytes == (int) sizeof(particle_t);
+}
+
+int checkpoint_read( struct transport *t, const char *path, struct checkpoint_header *header,
+		particle_t *agents, struct arrival **arrivals, int *arrivals_count, struct minimum_particle *parked ){
+	struct shared_file f;
+	if(!file_open(t, path, false, &f)){
+		return 0;
+	}
+	long first;
+	long at = sizeof(struct checkpoint_header);
+	int count = (int) checkpoint_share(header->agents, t->rank, t->n_proc, &first);
+	file_io(t, &f, false, at + first * sizeof(particle_t), agents, count, sizeof(particle_t));
+	at += header->agents * sizeof(particle_t);
+
+	*arrivals_count = (int) checkpoint_share(header->arrivals, t->rank, t->n_proc, &first);
+	*arrivals = (struct arrival *) malloc(MAX(*arrivals_count, 1) * sizeof(struct arrival));
+	file_io(t, &f, false, at + first * sizeof(struct arrival), *arrivals, *arrivals_count, sizeof(struct arrival));
+	at += header->arrivals * sizeof(struct arrival);
+
+	file_io(t, &f, false, at, parked, t->rank == 0 ? header->parked : 0, sizeof(struct minimum_particle));
+	file_close(t, &f);
+	return count;
+}
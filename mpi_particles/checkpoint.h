@@ -0,0 +1,66 @@
+#ifndef CHECKPOINT_H__
+#define CHECKPOINT_H__
+
+#include <stdint.h>
+#include "common.h"
+#include "transport.h"
+
+//
+//  checkpoints of a whole run (--checkpoint, --restart)
+//
+//  One binary file: rank 0's header, then the agents every rank owns, then
+//  every rank's arrival records, then the positions rank 0 draws arrived
+//  agents at; each rank's part comes after those of the ranks before it.
+//  MPI ranks write and read it with collective MPI-IO, thread ranks with
+//  pwrite and pread. Agents draw all their random numbers when they are
+//  created, from streams keyed on (seed, id), so the seed is all the RNG
+//  state there is. A restart may run on any number of ranks: each reads an
+//  equal share of the agents and hands them on to their owners.
+//
+
+#define CHECKPOINT_MAGIC "UPSOCKP1"
+
+struct checkpoint_header{
+	char magic[8];
+	int agent_bytes;
+	// ranks that wrote it
+	int n_proc;
+	int num_particles;
+	int special_agents_count;
+	int steps_done;
+	int arrived_total;
+	uint64_t seed;
+	unsigned int map_width;
+	unsigned int map_height;
+	uint64_t map_hash;
+	// records of each section, over all ranks
+	long agents;
+	long arrivals;
+	long parked;
+};
+
+uint64_t checkpoint_map_hash( struct map *map_cfg );
+
+// Writes path by way of a temporary file renamed into place, so a run
+// killed while writing keeps its last checkpoint. Collective; the section
+// counts of the header are filled in here. Returns this rank's seconds.
+double checkpoint_write( struct transport *t, const char *path, struct checkpoint_header *header,
+	const particle_t *local, int local_count, const struct arrival *arrivals, int arrivals_count,
+	const struct minimum_particle *parked, int parked_count );
+
+// Every rank reads the header; false if there is no checkpoint at path.
+bool checkpoint_read_header( struct transport *t, const char *path, struct checkpoint_header *header );
+
+// the share of count records that rank reads on restart
+inline long checkpoint_share( long count, int rank, int n_proc, long *first ){
+	*first = count * rank / n_proc;
+	return count * (rank + 1) / n_proc - *first;
+}
+
+// Reads this rank's share of the agents into agents and of the arrivals
+// into a new *arrivals, and on rank 0 all parked positions. Collective;
+// returns the number of agents read.
+int checkpoint_read( struct transport *t, const char *path, struct checkpoint_header *header,
+	particle_t *agents, struct arrival **arrivals, int *arrivals_count, struct minimum_particle *parked );
+
+#endif
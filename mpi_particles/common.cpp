@@ -8,6 +8,7 @@
 #include <sys/time.h>
 #include <cmath>
 #include "common.h"
+#include "rng.h"
 
 
 double size;
@@ -23,25 +24,29 @@ double width;
 #define cutoff  0.01
 #define min_r   (cutoff/100)
 #define dt      0.0005 // 0.0005
+#define vmax    2.0    // speed cap per axis, so nobody moves more than vmax*dt a step
 #define precision 2 // Precision to how close the coordinates should be to goal
 
 #define RANDOM_COLOR false
 
+const double interaction_cutoff = cutoff;
+const double max_step_distance = vmax * dt;
+
 //
 //  timer
 //
 double read_timer( )
 {
     static bool initialized = false;
-    static struct timeval start;
-    struct timeval end;
+    static struct timespec start;
+    struct timespec end;
     if( !initialized )
     {
-        gettimeofday( &start, NULL );
+        clock_gettime( CLOCK_MONOTONIC, &start );
         initialized = true;
     }
-    gettimeofday( &end, NULL );
-    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    return (end.tv_sec - start.tv_sec) + 1.0e-9 * (end.tv_nsec - start.tv_nsec);
 }
 
 //
@@ -76,6 +81,188 @@ bool is_valid_location(double x, double y, struct map *map_cfg){
 	return map_cfg->data[cell] != 0;
 }
 
+//
+//  walkable cell index
+//
+
+// overlap of cell [lo, lo + 1/highest_dim) with [min, max)
+static double cell_overlap(unsigned int lo, unsigned int highest_dim, double min, double max){
+	double from = MAX((double) lo / highest_dim, min);
+	double to = MIN((double) (lo + 1) / highest_dim, max);
+	return to > from ? to - from : 0.0;
+}
+
+// marks the 4-connected walkable cells reachable from start
+static void flood_component(unsigned int start, struct map *map_cfg, unsigned char *mark){
+	unsigned int cells = map_cfg->height * map_cfg->width;
+	unsigned int *stack = (unsigned int *) malloc(cells * sizeof(unsigned int));
+	unsigned int top = 0;
+
+	mark[start] = 1;
+	stack[top++] = start;
+	while(top > 0){
+		unsigned int cell = stack[--top];
+		unsigned int row = cell / map_cfg->width;
+		unsigned int col = cell % map_cfg->width;
+		unsigned int next[4];
+		int n_next = 0;
+
+		if(col > 0) next[n_next++] = cell - 1;
+		if(col + 1 < map_cfg->width) next[n_next++] = cell + 1;
+		if(row > 0) next[n_next++] = cell - map_cfg->width;
+		if(row + 1 < map_cfg->height) next[n_next++] = cell + map_cfg->width;
+
+		for(int i = 0; i < n_next; i++){
+			if(!mark[next[i]] && map_cfg->data[next[i]] != 0){
+				mark[next[i]] = 1;
+				stack[top++] = next[i];
+			}
+		}
+	}
+	free(stack);
+}
+
+// Collects the walkable cells inside region (whole map if NULL). If
+// component_x is not negative, only cells connected to the walkable cell
+// at (component_x, component_y) are kept. Returns the number of cells.
+int build_walkable_index( struct walkable_index *index, struct map *map_cfg, struct subdivision *region, double component_x, double component_y ){
+	unsigned int highest_dim = MAX(map_cfg->height, map_cfg->width);
+	unsigned int cells = map_cfg->height * map_cfg->width;
+
+	memset(index, 0, sizeof(struct walkable_index));
+	if(region){
+		index->region = *region;
+	}else{
+		index->region.max_x = index->region.max_y = size;
+	}
+	if(cells == 0){
+		return 0;
+	}
+
+	unsigned char *component = NULL;
+	if(component_x >= 0){
+		if(!is_valid_location(component_x, component_y, map_cfg)){
+			fprintf(stderr, "%s spawn component point (%lf,%lf) is not walkable\n", MPI_PREPEND, component_x, component_y);
+			return 0;
+		}
+		component = (unsigned char *) calloc(cells, sizeof(unsigned char));
+		flood_component(cell_for_pos(component_x, component_y, map_cfg), map_cfg, component);
+	}
+
+	index->cells = (unsigned int *) malloc(cells * sizeof(unsigned int));
+	index->cumulative_area = (double *) malloc(cells * sizeof(double));
+
+	double full_area = 1.0 / ((double) highest_dim * highest_dim);
+	bool partial = false;
+	for(unsigned int cell = 0; cell < cells; cell++){
+		if(map_cfg->data[cell] == 0 || (component && !component[cell])){
+			continue;
+		}
+		double area = cell_overlap(cell % map_cfg->width, highest_dim, index->region.min_x, index->region.max_x)
+		            * cell_overlap(cell / map_cfg->width, highest_dim, index->region.min_y, index->region.max_y);
+		if(area <= 0.0){
+			continue;
+		}
+		partial |= area < full_area;
+		index->total_area += area;
+		index->cells[index->count] = cell;
+		index->cumulative_area[index->count] = index->total_area;
+		index->count++;
+	}
+
+	if(!partial){
+		free(index->cumulative_area);
+		index->cumulative_area = NULL;
+	}
+	if(component){
+		free(component);
+	}
+	return index->count;
+}
+
+void free_walkable_index( struct walkable_index *index ){
+	free(index->cells);
+	free(index->cumulative_area);
+	memset(index, 0, sizeof(struct walkable_index));
+}
+
+void build_walkable_sum( struct walkable_sum *walkable, struct map *map_cfg ){
+	unsigned int width = map_cfg->width, height = map_cfg->height;
+	walkable->width = width;
+	walkable->height = height;
+	walkable->highest_dim = MAX(MAX(height, width), 1);
+	walkable->sum = (unsigned int *) calloc((size_t) (width + 1) * (height + 1), sizeof(unsigned int));
+	for(unsigned int row = 0; row < height; row++){
+		for(unsigned int col = 0; col < width; col++){
+			walkable->sum[(row + 1) * (width + 1) + col + 1] = (map_cfg->data[row * width + col] != 0)
+				+ walkable->sum[row * (width + 1) + col + 1] + walkable->sum[(row + 1) * (width + 1) + col]
+				- walkable->sum[row * (width + 1) + col];
+		}
+	}
+}
+
+void free_walkable_sum( struct walkable_sum *walkable ){
+	free(walkable->sum);
+	memset(walkable, 0, sizeof(struct walkable_sum));
+}
+
+// walkable cells touching the rectangle (map coords, 0 to 1)
+unsigned int walkable_in_rect( struct walkable_sum *walkable, double min_x, double min_y, double max_x, double max_y ){
+	int dim = walkable->highest_dim;
+	int col0 = MAX((int) floor(min_x * dim), 0), row0 = MAX((int) floor(min_y * dim), 0);
+	int col1 = MIN((int) floor(max_x * dim), (int) walkable->width - 1), row1 = MIN((int) floor(max_y * dim), (int) walkable->height - 1);
+	if(col0 > col1 || row0 > row1){
+		return 0;
+	}
+	unsigned int stride = walkable->width + 1;
+	return walkable->sum[(row1 + 1) * stride + col1 + 1] - walkable->sum[row0 * stride + col1 + 1]
+		- walkable->sum[(row1 + 1) * stride + col0] + walkable->sum[row0 * stride + col0];
+}
+
+// Maps three uniform [0,1) numbers to a point distributed uniformly over the
+// walkable area of the index: one pick of a cell, one position inside it.
+void sample_walkable( struct walkable_index *index, struct map *map_cfg, double u_cell, double u_x, double u_y, double *x, double *y ){
+	unsigned int highest_dim = MAX(map_cfg->height, map_cfg->width);
+	unsigned int pick;
+
+	if(index->cumulative_area){
+		// first cell whose running total passes the drawn area
+		double target = u_cell * index->total_area;
+		unsigned int lo = 0, hi = index->count - 1;
+		while(lo < hi){
+			unsigned int mid = (lo + hi) / 2;
+			if(index->cumulative_area[mid] <= target){
+				lo = mid + 1;
+			}else{
+				hi = mid;
+			}
+		}
+		pick = lo;
+	}else{
+		pick = MIN((unsigned int) (u_cell * index->count), index->count - 1);
+	}
+
+	unsigned int cell = index->cells[pick];
+	unsigned int col = cell % map_cfg->width;
+	unsigned int row = cell / map_cfg->width;
+
+	double min_x = MAX((double) col / highest_dim, index->region.min_x);
+	double max_x = MIN((double) (col + 1) / highest_dim, index->region.max_x);
+	double min_y = MAX((double) row / highest_dim, index->region.min_y);
+	double max_y = MIN((double) (row + 1) / highest_dim, index->region.max_y);
+
+	*x = min_x + u_x * (max_x - min_x);
+	*y = min_y + u_y * (max_y - min_y);
+
+	// rounding can land exactly on the far edge, which belongs to the next cell
+	while(*x > min_x && (unsigned int) floor(*x * highest_dim) != col){
+		*x = nextafter(*x, min_x);
+	}
+	while(*y > min_y && (unsigned int) floor(*y * highest_dim) != row){
+		*y = nextafter(*y, min_y);
+	}
+}
+
 // Checks to see if you are movning toward goal
 double is_valid_direction_y(double vy, double y, double goal_y)
 {
@@ -157,65 +344,50 @@ int rank_for_location(double x, double y, int n_proc, struct subdivision *areas)
 //
 //  Initialize the particle positions and velocities
 //
-void init_particles( int n, int sn, double agents[][4], particle_t *p, struct map *map_cfg ){
-	unsigned int highest_dim = MAX(map_cfg->height, map_cfg->width);
-    srand48( time( NULL ) );
-	
-	int sx = (int)ceil(sqrt((double)n));
-    int sy = (n+sx-1)/sx;
-
-    int z = 0;
-    
-    int *shuffle = (int*)malloc( n * sizeof(int) );
-    for( int i = 0; i < n; i++ )
-        shuffle[i] = i;
+//  Every agent draws from its own counter-based streams keyed on (seed, id),
+//  so any rank can initialize any agent and get the same result.
+//
+void init_particles( int n, int sn, double agents[][4], particle_t *p, struct map *map_cfg, struct walkable_index *spawn, uint64_t seed ){
+	double draws[3];
 	
 	for( int i = 0; i < n; i++ ){
-        //
-        //  make sure particles are not spatially sorted
-        //
-        int j = lrand48()%(n-i);
-        int k = shuffle[j];
-        shuffle[j] = shuffle[n-i-1];
-        
-        // compute x/y until they lie inside the walkable area
-		bool is_random = false;
-		do{
-			is_random = false;
-			if ( i < sn) {
-				// only do up to sn number of agents, else random start and goal
-				
-				//printf("Values: (%lf,%lf,%lf,%lf)\n", agents[z][0], agents[z][1], 
-				//	     agents[z][2], agents[z][3]);
-				p[i].x = agents[z][0]; //size*(1.+(k%sx))/(1+sx);
-				p[i].y = agents[z][1]; //size*(1.+(k/sx))/(1+sy);
-	            p[i].goal_x = agents[z][2];
-	            p[i].goal_y = agents[z][3];
-	            z +=1;
-
-	            if (!is_valid_location(p[i].x, p[i].y, map_cfg)) {
-	            	fprintf(stderr,"Error agent location is not valid for agent %i: (%lf,%lf)\n", i, p[i].x,p[i].y);
-	            	exit(0);
-	            }
-
-	            if(!is_valid_location(p[i].goal_x, p[i].goal_y, map_cfg)) {
-	            	fprintf(stderr,"Error agent goal location is not valid for agent %i: (%lf,%lf)\n", i, p[i].x,p[i].y);
-	            	exit(0);
-	            }
-
-	       } else {
-	        	p[i].x = drand48() * size; //size*(1.+(k%sx))/(1+sx);
-				p[i].y = drand48() * size; //size*(1.+(k/sx))/(1+sy);
-	            p[i].goal_x = -1; //drand48() * size;
-	            p[i].goal_y = -1; //drand48() * size;
-				is_random = true;
-	        }
-		}while(!is_valid_location(p[i].x, p[i].y, map_cfg) || (!is_random && !is_valid_location(p[i].goal_x, p[i].goal_y, map_cfg)));
+		p[i].id = i;
+		p[i].path_length = 0.0;
+		p[i].rule_breaker = 0;
+		p[i].closest = -1;
+		p[i].progress_step = 0;
 		
-        //
-        //  assign random velocities within a bound
-		p[i].vx = (drand48() * 2.0);
-		p[i].vy = (drand48() * 2.0);
+		bool is_random = i >= sn;
+		if ( !is_random ) {
+			// only do up to sn number of agents, else random start and goal
+			p[i].x = agents[i][0];
+			p[i].y = agents[i][1];
+			p[i].goal_x = agents[i][2];
+			p[i].goal_y = agents[i][3];
+
+			if (!is_valid_location(p[i].x, p[i].y, map_cfg)) {
+				fprintf(stderr,"Error agent location is not valid for agent %i: (%lf,%lf)\n", i, p[i].x,p[i].y);
+				exit(0);
+			}
+
+			if(!is_valid_location(p[i].goal_x, p[i].goal_y, map_cfg)) {
+				fprintf(stderr,"Error agent goal location is not valid for agent %i: (%lf,%lf)\n", i, p[i].x,p[i].y);
+				exit(0);
+			}
+
+		} else {
+			// one draw over the walkable area, no retries
+			rng_uniforms(seed, i, RNG_SPAWN, draws, 3);
+			sample_walkable(spawn, map_cfg, draws[0], draws[1], draws[2], &p[i].x, &p[i].y);
+			p[i].goal_x = -1; //drand48() * size;
+			p[i].goal_y = -1; //drand48() * size;
+		}
+		
+		//
+		//  assign random velocities within a bound
+		rng_uniforms(seed, i, RNG_VELOCITY, draws, 2);
+		p[i].vx = (draws[0] * 2.0);
+		p[i].vy = (draws[1] * 2.0);
 		if(is_random){
 			// shift so it's randomly over -1 to 1
 			p[i].vx -= 1.0;
@@ -234,20 +406,20 @@ void init_particles( int n, int sn, double agents[][4], particle_t *p, struct ma
 		}
 		
 		// set color:
-		p[i].color_r = RANDOM_COLOR ? drand48() : 0.0;
-		p[i].color_g = RANDOM_COLOR ? drand48() : 0.0;
-		p[i].color_b = RANDOM_COLOR ? drand48() : 0.0;
-		//p[i].goal = 3;
+		rng_uniforms(seed, i, RNG_COLOR, draws, 3);
+		p[i].color_r = RANDOM_COLOR ? draws[0] : 0.0;
+		p[i].color_g = RANDOM_COLOR ? draws[1] : 0.0;
+		p[i].color_b = RANDOM_COLOR ? draws[2] : 0.0;
 		
 		//fprintf(stderr, "%s particle %d at %lf %lf, vel (%lf,%lf)\n", MPI_PREPEND, i, p[i].x, p[i].y, p[i].vx, p[i].vy );fflush(stderr);
     }
-    free( shuffle );
 }
 
 //
 //  interact two particles
 //
-void apply_force( particle_t &particle, particle_t &neighbor )
+// acceleration of particle due to neighbor, false if they are too far apart
+static inline bool pair_force( const particle_t &particle, const particle_t &neighbor, double *fx, double *fy )
 {
 	// Add .1 percent to avoid dealing with collisions
 	// So everyone just rushes pass each other
@@ -255,7 +427,7 @@ void apply_force( particle_t &particle, particle_t &neighbor )
     double dy = (neighbor.y - particle.y) + (sign(neighbor.y - particle.y) *.1);
     double r2 = dx * dx + dy * dy;
     if( r2 > cutoff*cutoff )
-        return;
+        return false;
     r2 = MAX( r2, min_r*min_r );
     double r = sqrt( r2 );
 
@@ -265,11 +437,34 @@ void apply_force( particle_t &particle, particle_t &neighbor )
     double coef = ( 1 - cutoff / r ) / r2 / mass;
 	
 	double max_speedup = 1000.0;
-    particle.ax += sign(coef * dx) * MIN(max_speedup, fabs(coef*dx));
-    particle.ay += sign(coef * dy) * MIN(max_speedup, fabs(coef*dy));
-	
-	neighbor.ax -= sign(coef * dx) * MIN(max_speedup, fabs(coef*dx));
-	neighbor.ay -= sign(coef * dy) * MIN(max_speedup, fabs(coef*dy));
+    *fx = sign(coef * dx) * MIN(max_speedup, fabs(coef*dx));
+    *fy = sign(coef * dy) * MIN(max_speedup, fabs(coef*dy));
+	return true;
+}
+
+void apply_force( particle_t &particle, particle_t &neighbor )
+{
+	double fx, fy;
+	if( !pair_force( particle, neighbor, &fx, &fy ) )
+		return;
+	if( !particle.rule_breaker ){
+		particle.ax += fx;
+		particle.ay += fy;
+	}
+	if( !neighbor.rule_breaker ){
+		neighbor.ax -= fx;
+		neighbor.ay -= fy;
+	}
+}
+
+// the same force, applied to particle only, so agents can be updated in parallel
+void apply_force_from( particle_t &particle, const particle_t &neighbor )
+{
+	double fx, fy;
+	if( !particle.rule_breaker && pair_force( particle, neighbor, &fx, &fy ) ){
+		particle.ax += fx;
+		particle.ay += fy;
+	}
 }
 
 unsigned int cell_for_pos(double x, double y, struct map *map_cfg){
@@ -351,8 +546,8 @@ void move( particle_t &p, struct map *map_cfg ){
 	//printf("Goal Row: [%u] and Goal Col: [%u]\n", map_cfg->goal_row, map_cfg->goal_col);
 
 	// Consider removing these lines later. Used to avoid speed explosions.
-	p.vx = ((double) sign(p.vx)) * ((double) MIN(2.0, fabs(p.vx)));
-	p.vy = ((double) sign(p.vy)) * ((double) MIN(2.0, fabs(p.vy)));
+	p.vx = ((double) sign(p.vx)) * ((double) MIN(vmax, fabs(p.vx)));
+	p.vy = ((double) sign(p.vy)) * ((double) MIN(vmax, fabs(p.vy)));
 
 	double x_direction = is_valid_direction_x(p.vx, p.x, p.goal_x);
 	if (x_direction > 0) {
@@ -376,6 +571,10 @@ void move( particle_t &p, struct map *map_cfg ){
 		p.vy = 0.0;
 	}
 
+	// and again after the forces, so the halo width can rely on it
+	p.vx = ((double) sign(p.vx)) * ((double) MIN(vmax, fabs(p.vx)));
+	p.vy = ((double) sign(p.vy)) * ((double) MIN(vmax, fabs(p.vy)));
+
 	//printf("Velocity y: [%f] vs Veclocity x: [%f]\n", p.vy, p.vx);
 
 	//fprintf(stderr,"velocity x: %f\n",p.vx);
@@ -438,6 +637,8 @@ void move( particle_t &p, struct map *map_cfg ){
 	
 	unsigned int cell = cell_for_pos(p.x,p.y, map_cfg);
 	assert(map_cfg->data[ cell ] != 0);
+	
+	p.path_length += sqrt((p.x - orig_x) * (p.x - orig_x) + (p.y - orig_y) * (p.y - orig_y));
 }
 
 //
@@ -464,9 +665,158 @@ void save( FILE *f, int n, struct minimum_particle *p, struct map *map_cfg ){
 	fflush(f);
 }
 
+//
+//  map config
+//
+//  Text maps are "h <rows>" and "w <cols>" lines followed by one line of
+//  digits per row. The binary equivalent is MAP_BINARY_MAGIC, the height
+//  and width as native uint32 and then one byte per cell, row-major.
+//
+#define MAP_BINARY_MAGIC "MAPB"
+
+void read_binary_map(FILE *fp, struct map *map_cfg){
+	uint32_t dims[2];
+	if(fread(dims, sizeof(uint32_t), 2, fp) != 2){
+		fprintf(stderr, "%s Truncated binary map header\n", MPI_PREPEND);
+		exit(1);
+	}
+	map_cfg->height = dims[0];
+	map_cfg->width = dims[1];
+	fprintf(stderr,"%s map height: %u\n",MPI_PREPEND, map_cfg->height);
+	fprintf(stderr,"%s map width: %u\n",MPI_PREPEND, map_cfg->width);
+	
+	map_cfg->data = (unsigned short *) malloc ((size_t) map_cfg->height * map_cfg->width * sizeof(unsigned short));
+	unsigned char *row = (unsigned char *) malloc (map_cfg->width > 0 ? map_cfg->width : 1);
+	if(!map_cfg->data || !row){
+		fprintf(stderr, "%s Couldn't malloc for map config\n", MPI_PREPEND);
+		exit(1);
+	}
+	for(unsigned int r = 0; r < map_cfg->height; r++){
+		if(fread(row, 1, map_cfg->width, fp) != map_cfg->width){
+			fprintf(stderr, "%s Truncated binary map at row %u\n", MPI_PREPEND, r);
+			exit(1);
+		}
+		unsigned short *cells = &map_cfg->data[(size_t) r * map_cfg->width];
+		for(unsigned int col = 0; col < map_cfg->width; col++){
+			cells[col] = row[col];
+			if(row[col] == 3){
+				map_cfg->goal_col = col;
+				map_cfg->goal_row = r;
+			}
+		}
+	}
+	free(row);
+}
+
+void read_map(FILE *fp, struct map *map_cfg){
+	char * line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    
+    short temp_str_len = 50;
+    char first_term[temp_str_len];
+	char first_letter[temp_str_len];
+	memset(&first_letter, 0, temp_str_len);
+    
+    if(fp == NULL){
+        fprintf(stderr, "%s Error reading file.\n", MPI_PREPEND);
+        exit(1);
+    }
+	
+	char magic[4];
+	if(fread(magic, 1, 4, fp) == 4 && memcmp(magic, MAP_BINARY_MAGIC, 4) == 0){
+		read_binary_map(fp, map_cfg);
+		return;
+	}
+	rewind(fp);
+	
+	map_cfg->height = 0;
+	map_cfg->width = 0;
+	map_cfg->data = NULL;
+	unsigned int cells_read = 0;
+	unsigned int cells_rows = 0;
+	char cell;
+
+	while((read = getline(&line, &len, fp)) != -1){
+        first_term[0] = 0;
+		first_letter[0] = 0;
+		
+        sscanf(line, "%49s", first_term);
+		
+		sscanf(line, "%c", first_letter);
+		
+        if(str_equals("h",first_letter)){
+            sscanf(line, "h %u\n", &map_cfg->height);
+			fprintf(stderr,"%s map height: %u\n",MPI_PREPEND, map_cfg->height);
+			
+		}else if(str_equals("w",first_letter)){
+            sscanf(line, "w %u\n", &map_cfg->width);
+			fprintf(stderr,"%s map width: %u\n",MPI_PREPEND, map_cfg->width);
+			
+		}else{
+			
+			for(int i=0; i < map_cfg->width; i++){
+				sscanf(&line[i], "%c", &cell);
+				map_cfg->data[cells_read] = (unsigned short) (cell - '0');
+				//printf("read cell %i, %c, %u\n", i, cell, map_cfg->data[cells_read]);
+				cells_read++;
+				//fprintf(stderr,"goal: row[%u] col[%u]\n",cells_rows,i);
+				int check = (int)(cell - '0');
+				//printf("---result: %u\n", check);
+
+				if (check == (int) 3) {
+					map_cfg->goal_col = i;
+  					map_cfg->goal_row = cells_rows;
+
+  					fprintf(stderr,"goal: row[%u] col[%u]\n",cells_rows,i);
+				}
+			}
+
+			//fprintf(stderr,"cell rows: %u\n",cells_rows);
+			cells_rows++;
+		}
+
+		// should only run this once, then it mallocs.
+		if(!map_cfg->data && map_cfg->height > 0 && map_cfg->width > 0){
+			map_cfg->data = (unsigned short *) malloc (map_cfg->height * map_cfg->width * sizeof(unsigned short));
+			if(!map_cfg->data){
+				fprintf(stderr, "%s Couldn't malloc for map config\n", MPI_PREPEND);
+				exit(1);
+			}
+			memset(map_cfg->data, 0, map_cfg->height * map_cfg->width * sizeof(unsigned short));
+		}
+	}
+}
+
+void write_map(FILE *fp, struct map *map_cfg, bool binary){
+	if(binary){
+		uint32_t dims[2] = {map_cfg->height, map_cfg->width};
+		fwrite(MAP_BINARY_MAGIC, 1, 4, fp);
+		fwrite(dims, sizeof(uint32_t), 2, fp);
+	}else{
+		fprintf(fp, "w %u\nh %u\n", map_cfg->width, map_cfg->height);
+	}
+	
+	char *row = (char *) malloc (map_cfg->width + 1);
+	for(unsigned int r = 0; r < map_cfg->height; r++){
+		unsigned short *cells = &map_cfg->data[(size_t) r * map_cfg->width];
+		for(unsigned int col = 0; col < map_cfg->width; col++){
+			row[col] = binary ? (char) cells[col] : (char) ('0' + cells[col]);
+		}
+		row[map_cfg->width] = '\n';
+		fwrite(row, 1, binary ? map_cfg->width : map_cfg->width + 1, fp);
+	}
+	free(row);
+	fflush(fp);
+}
+
 //
 //  command line option processing
 //
+bool str_equals(char *a, char *b){
+    return strcmp(a, b) == 0;
+}
+
 int find_option( int argc, char **argv, const char *option )
 {
     for( int i = 1; i < argc; i++ )
@@ -1,6 +1,8 @@
 #ifndef COMMON_H__
 #define COMMON_H__
 
+#include <stdint.h>
+
 #define MPI_PREPEND "MPI)"
 #define VIZ_PREPEND "VIZ)"
 
@@ -27,6 +29,35 @@ struct map{
   unsigned int goal_row;
 };
 
+//
+// walkable cells of a map, restricted to a spawn rectangle and/or
+// the connected component around a point, for rejection-free placement
+//
+// walkable cells in any rectangle of the map in constant time
+struct walkable_sum{
+	unsigned int width;
+	unsigned int height;
+	unsigned int highest_dim;
+	// walkable cells above and left of each corner, (width+1) per row
+	unsigned int *sum;
+};
+
+struct walkable_index{
+	unsigned int count;
+	// row-major map cells that are walkable and inside the restriction
+	unsigned int *cells;
+	// running total of the walkable area, only kept when the spawn
+	// rectangle cuts through cells (NULL means every cell weighs the same)
+	double *cumulative_area;
+	double total_area;
+	struct subdivision region;
+};
+
+// distance beyond which agents do not interact
+extern const double interaction_cutoff;
+// farthest an agent moves along either axis in one step
+extern const double max_step_distance;
+
 //
 //  saving parameters
 //
@@ -50,8 +81,28 @@ typedef struct
   double color_r;
   double color_g;
   double color_b;
+  double path_length;
+  int id;
+  // pushes through others instead of being repelled (--rule-breakers)
+  int rule_breaker;
+  // closest it has come to its goal, -1 until first measured, and the
+  // step it last got a cell closer (--jam-window); a float keeps the
+  // struct, and so every ghost, 8 bytes smaller
+  float closest;
+  int progress_step;
 } particle_t;
 
+//
+// compact record of an agent retired at its goal
+//
+struct arrival{
+	int id;
+	// exit it arrived at, numbered as by build_exits
+	int exit;
+	int step;
+	double path_length;
+};
+
 struct minimum_particle{
 	double x;
 	double y;
@@ -69,10 +120,20 @@ double read_timer( );
 //  simulation routines
 //
 void set_size( int n, struct map *map_cfg);
+bool is_valid_location(double x, double y, struct map *map_cfg);
+unsigned int cell_for_pos(double x, double y, struct map *map_cfg);
+int build_walkable_index( struct walkable_index *index, struct map *map_cfg, struct subdivision *region, double component_x, double component_y );
+void free_walkable_index( struct walkable_index *index );
+void build_walkable_sum( struct walkable_sum *walkable, struct map *map_cfg );
+void free_walkable_sum( struct walkable_sum *walkable );
+unsigned int walkable_in_rect( struct walkable_sum *walkable, double min_x, double min_y, double max_x, double max_y );
+void sample_walkable( struct walkable_index *index, struct map *map_cfg, double u_cell, double u_x, double u_y, double *x, double *y );
 //void init_particles( int n, particle_t *p, struct map *map_cfg );
-void init_particles( int n, int sn, double agents[][4], particle_t *p, struct map *map_cfg );
+void init_particles( int n, int sn, double agents[][4], particle_t *p, struct map *map_cfg, struct walkable_index *spawn, uint64_t seed );
 void apply_force( particle_t &particle, particle_t &neighbor );
+void apply_force_from( particle_t &particle, const particle_t &neighbor );
 void move( particle_t &p, struct map *map_cfg );
+bool at_goal(double x, double y, double goal_x, double goal_y);
 
 //
 //  I/O routines
@@ -80,9 +141,14 @@ void move( particle_t &p, struct map *map_cfg );
 FILE *open_save( char *filename, int n );
 void save( FILE *f, int n, struct minimum_particle *p, struct map *map_cfg );
 
+void read_map( FILE *fp, struct map *map_cfg );
+// text map, or the binary equivalent read_map also accepts
+void write_map( FILE *fp, struct map *map_cfg, bool binary );
+
 //
 //  argument processing routines
 //
+bool str_equals(char *a, char *b);
 int find_option( int argc, char **argv, const char *option );
 int read_int( int argc, char **argv, const char *option, int default_value );
 char *read_string( int argc, char **argv, const char *option, char *default_value );
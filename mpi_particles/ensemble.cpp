@@ -0,0 +1,27 @@
+#include <mpi.h>
+#include "ensemble.h"
+
+void job_queue_init( struct job_queue *q, MPI_Comm comm, int jobs ){
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+	q->jobs = jobs;
+	MPI_Win_allocate(rank == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, comm, &q->taken, &q->win);
+	if(rank == 0){
+		MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, q->win);
+		*q->taken = 0;
+		MPI_Win_unlock(0, q->win);
+	}
+	MPI_Barrier(comm);
+}
+
+int job_queue_take( struct job_queue *q ){
+	int one = 1, job;
+	MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, q->win);
+	MPI_Fetch_and_op(&one, &job, MPI_INT, 0, 0, MPI_SUM, q->win);
+	MPI_Win_unlock(0, q->win);
+	return job < q->jobs ? job : -1;
+}
+
+void job_queue_free( struct job_queue *q ){
+	MPI_Win_free(&q->win);
+}
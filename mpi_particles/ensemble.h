@@ -0,0 +1,30 @@
+#ifndef ENSEMBLE_H__
+#define ENSEMBLE_H__
+
+#include <mpi.h>
+
+//
+//  a queue of jobs shared by every rank of a communicator (--jobs)
+//
+//  Rank 0 holds the number of jobs handed out so far in an MPI window.
+//  Whoever wants one adds one to it with MPI_Fetch_and_op under a shared
+//  lock, so a group that finishes early just takes the next job and nobody
+//  has to wait for the others.
+//
+
+struct job_queue{
+	MPI_Win win;
+	int *taken;
+	int jobs;
+};
+
+// collective over comm
+void job_queue_init( struct job_queue *q, MPI_Comm comm, int jobs );
+
+// the next job, -1 once all are taken; any rank may call it alone
+int job_queue_take( struct job_queue *q );
+
+// collective over comm
+void job_queue_free( struct job_queue *q );
+
+#endif
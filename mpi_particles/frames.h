@@ -0,0 +1,10 @@
+#ifndef FRAMES_H__
+#define FRAMES_H__
+
+#include <stdio.h>
+#include "Vec.hpp"
+
+// reads the header lines and the next frame of points; returns the number of points read
+int read_input(bool verbose, FILE *fp, Vec<3> **points, int *num_particles, double *radius, double *size, unsigned int *actual_size, Vec<3> **colors);
+
+#endif
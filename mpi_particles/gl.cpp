@@ -18,8 +18,7 @@
 #include "gl.h"
 #include "run.h"
 #include "common.h"
-
-#define Z_AXIS_DEPTH 1
+#include "frames.h"
 
 ///////
 // GLFW callbacks must use extern "C"
@@ -106,105 +105,6 @@ GLFWwindow *initGLFW() {
 	return win;
 }
 
-bool str_equals(char *a, char *b){
-    return strcmp(a, b) == 0;
-}
-
-void get_space_for_items(unsigned int *space_for_items, int *num_items, void **items, unsigned int item_size, unsigned int batch_size, bool verbose){
-    
-    if(*space_for_items == 0 || *space_for_items == *num_items){
-        // out of space, or zero
-        void *temp = (void *) malloc ((*num_items + batch_size) * item_size);
-		memset(temp, 0, ((*num_items + batch_size) * item_size));
-        memcpy(temp, *items, *num_items * item_size);
-		if(*items){
-        	free(*items);
-		}
-        (*items) = temp;
-        (*space_for_items) = *num_items + batch_size;
-    }
-}
-
-int read_input(bool verbose, FILE *fp, Vec<3> **points, int *num_particles, double *radius, double *size, unsigned int *actual_size, Vec<3> **colors){
-    char * line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    
-    short temp_str_len = 50;
-    char first_term[temp_str_len];
-	char first_letter[temp_str_len];
-	memset(&first_letter, 0, temp_str_len);
-    
-    if(fp == NULL){
-        fprintf(stderr, "%s Error reading file.\n", VIZ_PREPEND);
-        exit(1);
-    }
-	
-    unsigned int batch_malloc_size = *num_particles;
-	unsigned int space_for_points = *num_particles;
-	double x,y = 0;
-	
-	int num_points = 0;
-	// get space for one to start
-	unsigned int t;
-	Vec<3> t_color;
-
-	while((read = getline(&line, &len, fp)) != -1){
-        first_term[0] = 0;
-		first_letter[0] = 0;
-		
-		sscanf(line, "%s", first_term);
-		
-		sscanf(line, "%c", first_letter);
-		
-		//fprintf(stderr, "%s got line: %s\n", VIZ_PREPEND, line);
-		
-		if(str_equals("n",first_letter)){
-            sscanf(line, "n %u\n", num_particles);
-			fprintf(stderr,"%s got num particles: %u\n",VIZ_PREPEND, *num_particles);
-			batch_malloc_size = *num_particles;
-			
-			if(*colors){
-				free(*colors);
-			}
-			(*colors) = (Vec<3> *) malloc (*num_particles * sizeof(Vec<4>));
-			for(int i = 0; i < *num_particles; i++){
-				(*colors)[i] = Vec3(0,0,0);
-			}
-			
-		}else if(str_equals("r",first_letter)){
-            sscanf(line, "r %lf\n", radius);
-			fprintf(stderr,"%s radius: %lf\n", VIZ_PREPEND, *radius);
-		}else if(str_equals("s",first_letter)){
-			sscanf(line, "s %lf\n", size);
-			fprintf(stderr,"%s size: %lf\n", VIZ_PREPEND, *size);
-		}else if(str_equals("a",first_letter)){
-			sscanf(line, "a %u\n", actual_size);
-			fprintf(stderr,"%s actual_size: %u\n", VIZ_PREPEND, *actual_size);
-		}else if(str_equals("c", first_letter)){
-			sscanf(line, "c %u %f %f %f\n", &t, &t_color.x,&t_color.y,&t_color.z);
-			(*colors)[t] = Vec3(t_color.x, t_color.y, t_color.z);
-			//fprintf(stderr, "%s got color for particle %u (%f,%f,%f)\n", VIZ_PREPEND, t, (*colors)[t].x,(*colors)[t].y,(*colors)[t].z);
-		}else if(str_equals("p",first_letter)){
-			get_space_for_items(&space_for_points, &num_points, (void **) points, sizeof(Vec<3>), batch_malloc_size, verbose);
-			sscanf(line, "p %lf %lf\n", &x, &y );
-			(*points)[num_points].x = x;
-			(*points)[num_points].y = y;
-			(*points)[num_points].z = Z_AXIS_DEPTH;
-			num_points++;
-			
-			if(num_points == *num_particles){
-				break;
-			}
-		}else{
-			fprintf(stderr, "%s got unhandled line: %s\n", VIZ_PREPEND, line);
-		}
-
-	}
-
-	return num_points;
-}
-
 bool poll_input(GLFWwindow *win, AppContext *appctx){
 	glfwPollEvents();		// wait for user input
 	appctx->input.keyUpdate(appctx->geom, *win, appctx->view);
@@ -29,8 +29,6 @@ struct AppContext {
 
 int draw_data(FILE *fp, bool from_stdin, unsigned int frame_skip, struct map *map_cfg);
 
-bool str_equals(char *a, char *b);
-
 void setup_gl(GLFWwindow **win);
 
 void initialize_spheres_and_gl(GLFWwindow *win, Textures tex, AppContext *appctx, unsigned int **sphere_draw_ids, Vec<3> *points, int num_particles, double radius, Vec<3> **current_points);
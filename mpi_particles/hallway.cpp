@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "common.h"
+#include "hallway.h"
+
+// first column of the dividing wall
+static int wall_start( struct hallway *h ){
+	return (h->size - h->length) / 2;
+}
+
+void hallway_map( struct map *map_cfg, struct hallway *h ){
+	map_cfg->width = map_cfg->height = h->size;
+	map_cfg->data = (unsigned short *) malloc((size_t) h->size * h->size * sizeof(unsigned short));
+
+	// the hallway's rows, kept clear of the border
+	int first = (int) round(1 + h->door * (h->size - 2) - h->width / 2.0);
+	first = MAX(1, MIN(first, h->size - 1 - h->width));
+	int wall = wall_start(h);
+	for(int row = 0; row < h->size; row++){
+		for(int col = 0; col < h->size; col++){
+			bool border = row == 0 || col == 0 || row == h->size - 1 || col == h->size - 1;
+			bool in_wall = col >= wall && col < wall + h->length && (row < first || row >= first + h->width);
+			map_cfg->data[(size_t) row * h->size + col] = border || in_wall ? 0 : 1;
+		}
+	}
+}
+
+void hallway_exit( struct hallway *h, double agent[4] ){
+	int wall = wall_start(h);
+	agent[0] = (wall / 2 + 0.5) / h->size;
+	agent[1] = (h->size / 2 + 0.5) / h->size;
+	agent[2] = ((wall + h->length + h->size - 1) / 2 + 0.5) / h->size;
+	agent[3] = agent[1];
+}
+
+struct subdivision hallway_spawn( struct hallway *h ){
+	struct subdivision left = {1.0 / h->size, 1.0 / h->size, (double) wall_start(h) / h->size, (h->size - 1.0) / h->size};
+	return left;
+}
@@ -0,0 +1,34 @@
+#ifndef HALLWAY_H__
+#define HALLWAY_H__
+
+#include "common.h"
+
+//
+//  maps for the hallway-width optimizer (--optimize)
+//
+//  A square room split down the middle by a wall `length` cells thick,
+//  crossed by one hallway `width` cells wide whose centre lies a fraction
+//  `door` of the way down the wall. The crowd starts in the left half and
+//  the exit is in the middle of the right half, so how soon everyone is
+//  out depends on the hallway alone.
+//
+
+struct hallway{
+	// cells per side of the map
+	int size;
+	int length;
+	int width;
+	double door;
+};
+
+// allocates map_cfg->data
+void hallway_map( struct map *map_cfg, struct hallway *h );
+
+// a goal-seeking agent from the middle of the left half to the exit,
+// as a line of an agents file: x, y, goal x, goal y
+void hallway_exit( struct hallway *h, double agent[4] );
+
+// the left half, where the crowd starts
+struct subdivision hallway_spawn( struct hallway *h );
+
+#endif
@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "transport.h"
+#include "jam.h"
+
+bool jam_track( particle_t &p, int step, int window, double min_progress ){
+	if(p.goal_x < 0){
+		return false;
+	}
+	double dx = p.x - p.goal_x, dy = p.y - p.goal_y;
+	double distance = sqrt(dx * dx + dy * dy);
+	if(p.closest < 0 || distance <= p.closest - min_progress){
+		p.closest = (float) distance;
+		p.progress_step = step;
+	}
+	return step - p.progress_step >= window;
+}
+
+// a group of one rank's cells
+struct jam_group{
+	int agents;
+	int min_col, min_row, max_col, max_row;
+};
+
+// an edge cell and the group it is in, to join groups across ranks
+struct jam_edge{
+	int cell;
+	int group;
+};
+
+static int cell_order( const void *a, const void *b ){
+	int ca = ((const struct jam_cell *) a)->cell, cb = ((const struct jam_cell *) b)->cell;
+	return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+static int edge_order( const void *a, const void *b ){
+	int ca = ((const struct jam_edge *) a)->cell, cb = ((const struct jam_edge *) b)->cell;
+	return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+static int by_agents( const void *a, const void *b ){
+	return ((const struct jam_region *) b)->agents - ((const struct jam_region *) a)->agents;
+}
+
+static int find( int *parent, int i ){
+	while(parent[i] != i){
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+// the lower root wins, so a root comes before the rest of its group
+static void join( int *parent, int a, int b ){
+	a = find(parent, a);
+	b = find(parent, b);
+	if(a != b){
+		parent[MAX(a, b)] = MIN(a, b);
+	}
+}
+
+// first of the sorted cells (stride bytes apart, cell first) at cell, or -1
+static int first_at( const void *sorted, int count, size_t stride, int cell ){
+	int low = 0, high = count;
+	while(low < high){
+		int mid = (low + high) / 2;
+		if(*(const int *) ((const char *) sorted + mid * stride) < cell){
+			low = mid + 1;
+		}else{
+			high = mid;
+		}
+	}
+	return low < count && *(const int *) ((const char *) sorted + low * stride) == cell ? low : -1;
+}
+
+int jam_regions( struct transport *t, struct jam_cell *cells, int count, struct map *map_cfg, struct jam_region **regions ){
+	int width = map_cfg->width, height = map_cfg->height;
+	unsigned int highest_dim = MAX(map_cfg->height, map_cfg->width);
+	
+	// one entry per cell
+	qsort(cells, count, sizeof(struct jam_cell), cell_order);
+	int unique = 0;
+	for(int i = 0; i < count; i++){
+		if(unique > 0 && cells[unique - 1].cell == cells[i].cell){
+			cells[unique - 1].agents += cells[i].agents;
+			cells[unique - 1].edge = cells[unique - 1].edge || cells[i].edge;
+		}else{
+			cells[unique++] = cells[i];
+		}
+	}
+	count = unique;
+	
+	// our own groups
+	int *parent = (int *) malloc(MAX(count, 1) * sizeof(int));
+	for(int i = 0; i < count; i++){
+		parent[i] = i;
+	}
+	for(int i = 0; i < count; i++){
+		int row = cells[i].cell / width, col = cells[i].cell % width;
+		for(int r = MAX(row - 1, 0); r <= MIN(row + 1, height - 1); r++){
+			for(int c = MAX(col - 1, 0); c <= MIN(col + 1, width - 1); c++){
+				int j = first_at(cells, count, sizeof(struct jam_cell), r * width + c);
+				if(j >= 0){
+					join(parent, i, j);
+				}
+			}
+		}
+	}
+	int groups = 0, edge_count = 0;
+	for(int i = 0; i < count; i++){
+		int root = find(parent, i);
+		cells[i].group = root == i ? groups++ : cells[root].group;
+		edge_count += cells[i].edge;
+	}
+	free(parent);
+	
+	struct jam_group *mine = (struct jam_group *) malloc(MAX(groups, 1) * sizeof(struct jam_group));
+	for(int g = 0; g < groups; g++){
+		struct jam_group empty = {0, width, height, -1, -1};
+		mine[g] = empty;
+	}
+	struct jam_edge *edges = (struct jam_edge *) malloc(MAX(edge_count, 1) * sizeof(struct jam_edge));
+	edge_count = 0;
+	for(int i = 0; i < count; i++){
+		struct jam_group *g = &mine[cells[i].group];
+		int row = cells[i].cell / width, col = cells[i].cell % width;
+		g->agents += cells[i].agents;
+		g->min_col = MIN(g->min_col, col);
+		g->min_row = MIN(g->min_row, row);
+		g->max_col = MAX(g->max_col, col);
+		g->max_row = MAX(g->max_row, row);
+		if(cells[i].edge){
+			edges[edge_count].cell = cells[i].cell;
+			edges[edge_count++].group = cells[i].group;
+		}
+	}
+	
+	// every rank's groups and edge cells to rank 0
+	int rank = t->rank, n_proc = t->n_proc;
+	int sizes[2] = {groups, edge_count};
+	int *all_sizes = NULL, *counts = NULL, *offsets = NULL;
+	int total_groups = 0, total_edges = 0;
+	if(rank == 0){
+		all_sizes = (int *) malloc(2 * n_proc * sizeof(int));
+		counts = (int *) malloc(4 * n_proc * sizeof(int));
+		offsets = counts + 2 * n_proc;
+	}
+	transport_gather(t, sizes, 2 * sizeof(int), all_sizes, 0);
+	if(rank == 0){
+		for(int r = 0; r < n_proc; r++){
+			counts[r] = all_sizes[2 * r];
+			counts[n_proc + r] = all_sizes[2 * r + 1];
+			offsets[r] = total_groups;
+			offsets[n_proc + r] = total_edges;
+			total_groups += counts[r];
+			total_edges += counts[n_proc + r];
+		}
+	}
+	struct jam_group *all_groups = rank == 0 ? (struct jam_group *) malloc(MAX(total_groups, 1) * sizeof(struct jam_group)) : NULL;
+	struct jam_edge *all_edges = rank == 0 ? (struct jam_edge *) malloc(MAX(total_edges, 1) * sizeof(struct jam_edge)) : NULL;
+	transport_gatherv(t, mine, groups, sizeof(struct jam_group), all_groups, counts, offsets, 0);
+	transport_gatherv(t, edges, edge_count, sizeof(struct jam_edge), all_edges, rank == 0 ? counts + n_proc : NULL, rank == 0 ? offsets + n_proc : NULL, 0);
+	free(mine);
+	free(edges);
+	if(rank > 0){
+		*regions = NULL;
+		return 0;
+	}
+	
+	// join groups whose edge cells touch, or share a cell
+	for(int r = 0; r < n_proc; r++){
+		for(int e = offsets[n_proc + r]; e < offsets[n_proc + r] + counts[n_proc + r]; e++){
+			all_edges[e].group += offsets[r];
+		}
+	}
+	qsort(all_edges, total_edges, sizeof(struct jam_edge), edge_order);
+	parent = (int *) malloc(MAX(total_groups, 1) * sizeof(int));
+	for(int g = 0; g < total_groups; g++){
+		parent[g] = g;
+	}
+	for(int e = 0; e < total_edges; e++){
+		int row = all_edges[e].cell / width, col = all_edges[e].cell % width;
+		for(int r = MAX(row - 1, 0); r <= MIN(row + 1, height - 1); r++){
+			for(int c = MAX(col - 1, 0); c <= MIN(col + 1, width - 1); c++){
+				int at = first_at(all_edges, total_edges, sizeof(struct jam_edge), r * width + c);
+				for(; at >= 0 && at < total_edges && all_edges[at].cell == r * width + c; at++){
+					join(parent, all_edges[e].group, all_edges[at].group);
+				}
+			}
+		}
+	}
+	
+	int found = 0;
+	int *region_of = (int *) malloc(MAX(total_groups, 1) * sizeof(int));
+	*regions = (struct jam_region *) malloc(MAX(total_groups, 1) * sizeof(struct jam_region));
+	for(int g = 0; g < total_groups; g++){
+		int root = find(parent, g);
+		struct jam_group *a = &all_groups[g];
+		double min_x = (double) a->min_col / highest_dim, min_y = (double) a->min_row / highest_dim;
+		double max_x = (a->max_col + 1.0) / highest_dim, max_y = (a->max_row + 1.0) / highest_dim;
+		if(root == g){
+			region_of[g] = found;
+			struct jam_region region = {a->agents, min_x, min_y, max_x, max_y};
+			(*regions)[found++] = region;
+		}else{
+			struct jam_region *region = &(*regions)[region_of[root]];
+			region_of[g] = region_of[root];
+			region->agents += a->agents;
+			region->min_x = MIN(region->min_x, min_x);
+			region->min_y = MIN(region->min_y, min_y);
+			region->max_x = MAX(region->max_x, max_x);
+			region->max_y = MAX(region->max_y, max_y);
+		}
+	}
+	qsort(*regions, found, sizeof(struct jam_region), by_agents);
+	free(region_of);
+	free(parent);
+	free(all_groups);
+	free(all_edges);
+	free(all_sizes);
+	free(counts);
+	return found;
+}
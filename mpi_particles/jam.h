@@ -0,0 +1,48 @@
+#ifndef JAM_H__
+#define JAM_H__
+
+#include "common.h"
+
+struct transport;
+
+//
+//  jam detection (--jam-window)
+//
+//  Each goal seeker carries the closest it has come to its goal and the
+//  step it last got at least a cell closer; one that hasn't for a whole
+//  window has stalled. A run whose walking goal seekers have all stalled
+//  is jammed, since none of them will ever arrive. Its stuck regions are
+//  the 8-connected groups of map cells holding stalled agents: each rank
+//  groups its own cells, and rank 0 joins the groups of different ranks
+//  through their cells that border another rank's ground, so only a
+//  summary per group and those edge cells travel.
+//
+
+// Updates p's progress at step; whether it has gone window steps without
+// any. Agents without a goal never stall.
+bool jam_track( particle_t &p, int step, int window, double min_progress );
+
+// a map cell holding stalled agents
+struct jam_cell{
+	int cell;
+	int agents;
+	// part of the cell or of a neighbour is another rank's ground
+	bool edge;
+	int group;
+};
+
+struct jam_region{
+	int agents;
+	// bounding box of its cells
+	double min_x;
+	double min_y;
+	double max_x;
+	double max_y;
+};
+
+// Collective. cells, one or more per map cell in any order, are merged
+// and grouped in place. Rank 0 gets the regions, most agents first, in
+// *regions (to be freed) and returns their number; other ranks get 0.
+int jam_regions( struct transport *t, struct jam_cell *cells, int count, struct map *map_cfg, struct jam_region **regions );
+
+#endif
@@ -0,0 +1,166 @@
+//
+// Procedural map generator
+//
+// Writes office floors, corridor grids, random obstacle fields or the
+// rooms --optimize compares of any size, as a text map or the binary equivalent (both read by -c). Every map
+// has a solid border; the same seed gives the same map.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "rng.h"
+#include "hallway.h"
+
+void usage(){
+	printf( "Example run: ./mapgen --kind office --width 2048 --height 2048 --binary -o office.map\n\n");
+	printf( "Options:\n" );
+	printf( "-h                        : this text\n" );
+	printf( "--kind <office|corridors|obstacles|hallway> : layout (default office)\n" );
+	printf( "--width <int>             : columns (default 256)\n" );
+	printf( "--height <int>            : rows (default the width)\n" );
+	printf( "--room <int>              : office: room size in cells (default 10)\n" );
+	printf( "--corridor <int>          : office, corridors, hallway: corridor width in cells (default 3)\n" );
+	printf( "--spacing <int>           : corridors: distance between corridors in cells (default 16)\n" );
+	printf( "--density <fraction>      : obstacles: fraction of the floor covered (default 0.3)\n" );
+	printf( "--obstacle <int>          : obstacles: obstacle size in cells (default 2)\n" );
+	printf( "--length <int>            : hallway: thickness of the dividing wall in cells (default 4)\n" );
+	printf( "--door <fraction>         : hallway: centre of the hallway along the wall (default 0.5)\n" );
+	printf( "--seed <int>              : seed for the obstacles, default is the time.\n" );
+	printf( "--binary                  : write the binary map format instead of text\n" );
+	printf( "-o <filename>             : output file (default stdout)\n" );
+}
+
+//
+//  Rows of offices, each with a door on both long walls, between
+//  full-width corridors.
+//
+void office_floor( struct map *map_cfg, int room, int corridor ){
+	int period_x = room + 1;
+	int period_y = room + 2 + corridor;
+	int door = MAX(room / 4, 1);
+	for(unsigned int row = 0; row < map_cfg->height; row++){
+		int y = row % period_y;
+		for(unsigned int col = 0; col < map_cfg->width; col++){
+			int x = col % period_x;
+			bool walkable;
+			if(y > room + 1){
+				walkable = true;
+			}else if(y == 0 || y == room + 1){
+				walkable = x >= (room - door) / 2 && x < (room - door) / 2 + door;
+			}else{
+				walkable = x != room;
+			}
+			map_cfg->data[(size_t) row * map_cfg->width + col] = walkable ? 1 : 0;
+		}
+	}
+}
+
+//
+//  Corridors every `spacing` cells in both directions around solid blocks.
+//
+void corridor_grid( struct map *map_cfg, int spacing, int corridor ){
+	for(unsigned int row = 0; row < map_cfg->height; row++){
+		for(unsigned int col = 0; col < map_cfg->width; col++){
+			// first corridors run just inside the border
+			bool walkable = (int) ((row + spacing - 1) % spacing) < corridor || (int) ((col + spacing - 1) % spacing) < corridor;
+			map_cfg->data[(size_t) row * map_cfg->width + col] = walkable ? 1 : 0;
+		}
+	}
+}
+
+//
+//  Open floor with square obstacles, each obstacle-sized block is solid
+//  with probability `density`.
+//
+void obstacle_field( struct map *map_cfg, double density, int obstacle, uint64_t seed ){
+	unsigned int blocks_x = (map_cfg->width + obstacle - 1) / obstacle;
+	double draw;
+	for(unsigned int row = 0; row < map_cfg->height; row++){
+		for(unsigned int col = 0; col < map_cfg->width; col++){
+			uint32_t block = (row / obstacle) * blocks_x + col / obstacle;
+			rng_uniforms(seed, block, RNG_SYNTHETIC, &draw, 1);
+			map_cfg->data[(size_t) row * map_cfg->width + col] = draw < density ? 0 : 1;
+		}
+	}
+}
+
+int main( int argc, char **argv ){
+	if( find_option( argc, argv, "-h" ) >= 0 ){
+		usage();
+		return 0;
+	}
+
+	char *kind = read_string( argc, argv, "--kind", (char *) "office" );
+	struct map map_cfg;
+	memset(&map_cfg, 0, sizeof(struct map));
+	map_cfg.width = read_int( argc, argv, "--width", 256 );
+	map_cfg.height = read_int( argc, argv, "--height", map_cfg.width );
+	int room = read_int( argc, argv, "--room", 10 );
+	int corridor = read_int( argc, argv, "--corridor", 3 );
+	int spacing = read_int( argc, argv, "--spacing", 16 );
+	double density = find_option( argc, argv, "--density" ) >= 0 ? read_double( argc, argv, "--density", 0 ) : 0.3;
+	int obstacle = read_int( argc, argv, "--obstacle", 2 );
+	int length = read_int( argc, argv, "--length", 4 );
+	double door = find_option( argc, argv, "--door" ) >= 0 ? read_double( argc, argv, "--door", 0 ) : 0.5;
+	bool binary = find_option( argc, argv, "--binary" ) >= 0;
+	char *savename = read_string( argc, argv, "-o", NULL );
+
+	if(map_cfg.width < 3 || map_cfg.height < 3 || room < 1 || corridor < 1 || spacing <= corridor || obstacle < 1 || length < 1){
+		usage();
+		return 1;
+	}
+
+	map_cfg.data = (unsigned short *) malloc((size_t) map_cfg.width * map_cfg.height * sizeof(unsigned short));
+	if(!map_cfg.data){
+		fprintf(stderr, "Couldn't malloc a %ux%u map\n", map_cfg.width, map_cfg.height);
+		return 1;
+	}
+
+	if(str_equals(kind, (char *) "office")){
+		office_floor(&map_cfg, room, corridor);
+	}else if(str_equals(kind, (char *) "corridors")){
+		corridor_grid(&map_cfg, spacing, corridor);
+	}else if(str_equals(kind, (char *) "hallway")){
+		free(map_cfg.data);
+		struct hallway h = {(int) map_cfg.width, length, corridor, door};
+		hallway_map(&map_cfg, &h);
+	}else if(str_equals(kind, (char *) "obstacles")){
+		uint64_t seed = read_seed( argc, argv );
+		fprintf(stderr, "seed: %llu\n", (unsigned long long) seed);
+		obstacle_field(&map_cfg, density, obstacle, seed);
+	}else{
+		fprintf(stderr, "Unknown --kind %s\n", kind);
+		usage();
+		return 1;
+	}
+
+	// solid border so agents never leave the map
+	for(unsigned int col = 0; col < map_cfg.width; col++){
+		map_cfg.data[col] = 0;
+		map_cfg.data[(size_t) (map_cfg.height - 1) * map_cfg.width + col] = 0;
+	}
+	for(unsigned int row = 0; row < map_cfg.height; row++){
+		map_cfg.data[(size_t) row * map_cfg.width] = 0;
+		map_cfg.data[(size_t) row * map_cfg.width + map_cfg.width - 1] = 0;
+	}
+
+	size_t walkable = 0;
+	for(size_t cell = 0; cell < (size_t) map_cfg.width * map_cfg.height; cell++){
+		walkable += map_cfg.data[cell] != 0;
+	}
+	fprintf(stderr, "%s map %ux%u, %.1f%% walkable\n", kind, map_cfg.width, map_cfg.height, 100.0 * walkable / ((double) map_cfg.width * map_cfg.height));
+
+	FILE *f = savename ? fopen(savename, binary ? "wb" : "w") : stdout;
+	if(!f){
+		fprintf(stderr, "Couldn't open %s\n", savename);
+		return 1;
+	}
+	write_map(f, &map_cfg, binary);
+	if(savename){
+		fclose(f);
+	}
+	free(map_cfg.data);
+	return 0;
+}
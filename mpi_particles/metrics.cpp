@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "metrics.h"
+#include "transport.h"
+
+int build_exits( int sn, double agents[][4], struct map *map_cfg, double exits[][2] ){
+	int n_exits = 0;
+	for(int i = 0; i < sn; i++){
+		if(exit_for_goal(exits, n_exits, agents[i][2], agents[i][3], map_cfg) == n_exits){
+			exits[n_exits][0] = agents[i][2];
+			exits[n_exits][1] = agents[i][3];
+			n_exits++;
+		}
+	}
+	return n_exits;
+}
+
+int exit_for_goal( double exits[][2], int n_exits, double goal_x, double goal_y, struct map *map_cfg ){
+	unsigned int cell = cell_for_pos(goal_x, goal_y, map_cfg);
+	int e = 0;
+	while(e < n_exits && cell_for_pos(exits[e][0], exits[e][1], map_cfg) != cell){
+		e++;
+	}
+	return e;
+}
+
+// nearest-rank percentile of a histogram, as the bin index
+static int histogram_percentile(long *bins, int n_bins, long total, double p){
+	long rank = (long) ceil(p * total);
+	long seen = 0;
+	if(rank < 1){
+		rank = 1;
+	}
+	for(int b = 0; b < n_bins; b++){
+		seen += bins[b];
+		if(seen >= rank){
+			return b;
+		}
+	}
+	return n_bins - 1;
+}
+
+// coarse histogram for the report: METRICS_REPORT_BINS equal bins over [0, max]
+static void write_histogram(FILE *f, long *bins, int n_bins, double bin_width, double max){
+	long coarse[METRICS_REPORT_BINS];
+	double coarse_width = max > 0 ? max / METRICS_REPORT_BINS : 1.0;
+	memset(coarse, 0, sizeof(coarse));
+	for(int b = 0; b < n_bins; b++){
+		int c = (int) (b * bin_width / coarse_width);
+		coarse[MIN(c, METRICS_REPORT_BINS - 1)] += bins[b];
+	}
+	fprintf(f, "{\"bin_width\": %g, \"counts\": [", coarse_width);
+	for(int c = 0; c < METRICS_REPORT_BINS; c++){
+		fprintf(f, "%s%ld", c ? ", " : "", coarse[c]);
+	}
+	fprintf(f, "]}");
+}
+
+void report_metrics( const char *filename, struct arrival *arrivals, int arrivals_count, int n_exits, struct metrics_run *run, struct transport *t ){
+	int rank = t->rank;
+
+	// arrival steps: one bin per step unless the run is very long
+	int step_width = (run->steps + METRICS_MAX_STEP_BINS - 1) / METRICS_MAX_STEP_BINS;
+	if(step_width < 1){
+		step_width = 1;
+	}
+	int step_bins = run->steps / step_width + 1;
+
+	// path lengths: bin over [0, longest path of any rank]
+	double local_length_max = 0.0, length_max = 0.0;
+	for(int i = 0; i < arrivals_count; i++){
+		local_length_max = MAX(local_length_max, arrivals[i].path_length);
+	}
+	transport_reduce(t, &local_length_max, &length_max, 1, TRANSPORT_DOUBLE, TRANSPORT_MAX, TRANSPORT_ALL);
+	double length_width = length_max > 0 ? length_max / METRICS_LENGTH_BINS : 1.0;
+
+	long *step_hist = (long *) calloc(step_bins, sizeof(long));
+	long *length_hist = (long *) calloc(METRICS_LENGTH_BINS, sizeof(long));
+	long *exit_arrivals = (long *) calloc(n_exits + 1, sizeof(long));
+	int *exit_first = (int *) malloc((n_exits + 1) * sizeof(int));
+	int *exit_last = (int *) malloc((n_exits + 1) * sizeof(int));
+	for(int e = 0; e < n_exits; e++){
+		exit_first[e] = run->steps;
+		exit_last[e] = -1;
+	}
+
+	// sum of steps, sum of lengths, then count; max step
+	double sums[3] = {0.0, 0.0, 0.0};
+	int step_max = -1;
+	for(int i = 0; i < arrivals_count; i++){
+		struct arrival *a = &arrivals[i];
+		step_hist[MIN(a->step / step_width, step_bins - 1)]++;
+		length_hist[MIN((int) (a->path_length / length_width), METRICS_LENGTH_BINS - 1)]++;
+		sums[0] += a->step;
+		sums[1] += a->path_length;
+		sums[2] += 1.0;
+		step_max = MAX(step_max, a->step);
+
+		int e = MIN(a->exit, n_exits);
+		exit_arrivals[e]++;
+		exit_first[e] = MIN(exit_first[e], a->step);
+		exit_last[e] = MAX(exit_last[e], a->step);
+	}
+
+	transport_reduce(t, step_hist, step_hist, step_bins, TRANSPORT_LONG, TRANSPORT_SUM, 0);
+	transport_reduce(t, length_hist, length_hist, METRICS_LENGTH_BINS, TRANSPORT_LONG, TRANSPORT_SUM, 0);
+	transport_reduce(t, sums, sums, 3, TRANSPORT_DOUBLE, TRANSPORT_SUM, 0);
+	transport_reduce(t, &step_max, &step_max, 1, TRANSPORT_INT, TRANSPORT_MAX, 0);
+	if(n_exits > 0){
+		transport_reduce(t, exit_arrivals, exit_arrivals, n_exits, TRANSPORT_LONG, TRANSPORT_SUM, 0);
+		transport_reduce(t, exit_first, exit_first, n_exits, TRANSPORT_INT, TRANSPORT_MIN, 0);
+		transport_reduce(t, exit_last, exit_last, n_exits, TRANSPORT_INT, TRANSPORT_MAX, 0);
+	}
+
+	if(rank == 0){
+		bool to_stdout = strcmp(filename, "stdout") == 0;
+		bool to_stderr = strcmp(filename, "stderr") == 0;
+		FILE *f = to_stdout ? stdout : (to_stderr ? stderr : fopen(filename, "w"));
+		if(!f){
+			fprintf(stderr, "%s Couldn't open metrics file %s\n", MPI_PREPEND, filename);
+		}else{
+			long arrived = (long) sums[2];
+			fprintf(f, "{\n");
+			fprintf(f, "  \"agents\": %d,\n  \"goal_seekers\": %d,\n  \"arrived\": %ld,\n", run->agents, run->goal_seekers, arrived);
+			fprintf(f, "  \"n_procs\": %d,\n  \"steps\": %d,\n  \"simulation_time\": %g,\n  \"seed\": %llu,\n", run->n_proc, run->steps, run->simulation_time, (unsigned long long) run->seed);
+			fprintf(f, "  \"jammed\": %s,\n", run->jammed ? "true" : "false");
+			if(arrived > 0){
+				fprintf(f, "  \"arrival_step\": {\"mean\": %g, \"p50\": %d, \"p95\": %d, \"max\": %d, \"histogram\": ",
+					sums[0] / arrived,
+					histogram_percentile(step_hist, step_bins, arrived, 0.50) * step_width,
+					histogram_percentile(step_hist, step_bins, arrived, 0.95) * step_width,
+					step_max);
+				write_histogram(f, step_hist, step_bins, step_width, step_max + 1);
+				fprintf(f, "},\n");
+				fprintf(f, "  \"path_length\": {\"mean\": %g, \"p50\": %g, \"p95\": %g, \"max\": %g, \"histogram\": ",
+					sums[1] / arrived,
+					(histogram_percentile(length_hist, METRICS_LENGTH_BINS, arrived, 0.50) + 0.5) * length_width,
+					(histogram_percentile(length_hist, METRICS_LENGTH_BINS, arrived, 0.95) + 0.5) * length_width,
+					length_max);
+				write_histogram(f, length_hist, METRICS_LENGTH_BINS, length_width, length_max);
+				fprintf(f, "},\n");
+			}
+			fprintf(f, "  \"exits\": [");
+			for(int e = 0; e < n_exits; e++){
+				int span = exit_last[e] >= exit_first[e] ? exit_last[e] - exit_first[e] + 1 : 0;
+				fprintf(f, "%s\n    {\"exit\": %d, \"arrived\": %ld, \"first_step\": %d, \"last_step\": %d, \"throughput_per_step\": %g}",
+					e ? "," : "", e, exit_arrivals[e], exit_arrivals[e] ? exit_first[e] : -1, exit_last[e],
+					span ? (double) exit_arrivals[e] / span : 0.0);
+			}
+			fprintf(f, "%s]\n}\n", n_exits ? "\n  " : "");
+			fflush(f);
+			if(!to_stdout && !to_stderr){
+				fclose(f);
+			}
+		}
+	}
+
+	free(step_hist);
+	free(length_hist);
+	free(exit_arrivals);
+	free(exit_first);
+	free(exit_last);
+}
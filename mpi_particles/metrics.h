@@ -0,0 +1,39 @@
+#ifndef METRICS_H__
+#define METRICS_H__
+
+#include "common.h"
+
+struct transport;
+
+//
+//  completion-time metrics, reduced across ranks and written as JSON
+//
+
+#define METRICS_MAX_STEP_BINS 65536
+#define METRICS_LENGTH_BINS 1024
+#define METRICS_REPORT_BINS 20
+
+// what the run was, for the report header
+struct metrics_run{
+	int agents;
+	int goal_seekers;
+	int n_proc;
+	int steps;
+	double simulation_time;
+	uint64_t seed;
+	// stopped early with every goal seeker left stalled (--jam-window)
+	bool jammed;
+};
+
+// Groups the goal-seeking agents by goal cell: exits gets the goal of the
+// first agent heading for each cell (sn at most). Returns their number.
+int build_exits( int sn, double agents[][4], struct map *map_cfg, double exits[][2] );
+
+// the exit whose cell holds the goal, n_exits if none does
+int exit_for_goal( double exits[][2], int n_exits, double goal_x, double goal_y, struct map *map_cfg );
+
+// Collective over the transport. Only rank 0 writes, to filename ("stdout",
+// "stderr" or a path).
+void report_metrics( const char *filename, struct arrival *arrivals, int arrivals_count, int n_exits, struct metrics_run *run, struct transport *t );
+
+#endif
@@ -0,0 +1,335 @@
+//
+// Microbenchmarks for the simulation kernels
+//
+// Times apply_force, move, rank_for_location, is_valid_location, read_map,
+// save and the visualizer's read_input one at a time over synthetic inputs,
+// without MPI. Each kernel runs one warm-up batch and then --trials timed
+// batches; ns/op is reported as mean, standard deviation and minimum over
+// the batches.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "Vec.inl"
+#include "common.h"
+#include "frames.h"
+#include "rng.h"
+
+void usage(){
+	printf( "Example run: ./microbench -n 2000 --map-size 128 --wall-density 0.3\n\n");
+	printf( "Options:\n" );
+	printf( "-h                        : this text\n" );
+	printf( "-n <int>                  : agents (default 1000)\n" );
+	printf( "--map-size <int>          : synthetic square map, cells per side (default 256)\n" );
+	printf( "--wall-density <fraction> : fraction of interior cells that are walls, the border always is (default 0.2)\n" );
+	printf( "--ranks <int>             : subdivisions searched by rank_for_location, power of 4 (default 16)\n" );
+	printf( "--probes <int>            : points per batch for rank_for_location and is_valid_location (default 1048576)\n" );
+	printf( "--move-steps <int>        : moves of every agent per batch (default 100)\n" );
+	printf( "--frames <int>            : frames per batch for save and read_input (default 10)\n" );
+	printf( "--trials <int>            : timed batches per kernel (default 10)\n" );
+	printf( "--only <kernel>           : run only this kernel\n" );
+	printf( "--seed <int>              : seed for the synthetic inputs, default is the time.\n" );
+}
+
+//
+//  synthetic inputs, built once and shared by every kernel
+//
+struct bench_input{
+	int n;
+	particle_t *particles;
+	particle_t *work;
+	struct minimum_particle *points;
+	struct map map_cfg;
+	FILE *map_file;
+	int ranks;
+	struct subdivision *areas;
+	int probes;
+	double *probe_x;
+	double *probe_y;
+	int move_steps;
+	int frames;
+	FILE *null_file;
+	FILE *frames_file;
+	long first_frame_end;
+	Vec<3> *read_points;
+	Vec<3> *read_colors;
+};
+
+// keeps the compiler from dropping kernels whose result is unused
+volatile long sink;
+
+struct kernel{
+	const char *name;
+	// what one op is
+	const char *per;
+	// untimed setup before each batch, may be NULL
+	void (*prepare)( struct bench_input *in );
+	// runs one batch, returns the number of ops
+	long (*batch)( struct bench_input *in );
+	// the kernel reports on stderr every call
+	bool chatty;
+};
+
+long bench_apply_force( struct bench_input *in ){
+	particle_t *p = in->particles;
+	for(int i = 0; i < in->n; i++){
+		for(int j = i + 1; j < in->n; j++){
+			apply_force(p[i], p[j]);
+		}
+	}
+	return (long) in->n * (in->n - 1) / 2;
+}
+
+void prepare_move( struct bench_input *in ){
+	memcpy(in->work, in->particles, in->n * sizeof(particle_t));
+	for(int i = 0; i < in->n; i++){
+		in->work[i].ax = in->work[i].ay = 0;
+	}
+}
+
+long bench_move( struct bench_input *in ){
+	for(int step = 0; step < in->move_steps; step++){
+		for(int i = 0; i < in->n; i++){
+			move(in->work[i], &in->map_cfg);
+		}
+	}
+	return (long) in->move_steps * in->n;
+}
+
+long bench_rank_for_location( struct bench_input *in ){
+	long total = 0;
+	for(int i = 0; i < in->probes; i++){
+		total += rank_for_location(in->probe_x[i], in->probe_y[i], in->ranks, in->areas);
+	}
+	sink = total;
+	return in->probes;
+}
+
+long bench_is_valid_location( struct bench_input *in ){
+	long total = 0;
+	for(int i = 0; i < in->probes; i++){
+		total += is_valid_location(in->probe_x[i], in->probe_y[i], &in->map_cfg);
+	}
+	sink = total;
+	return in->probes;
+}
+
+long bench_read_map( struct bench_input *in ){
+	struct map parsed;
+	rewind(in->map_file);
+	read_map(in->map_file, &parsed);
+	sink = parsed.data[parsed.width + 1];
+	free(parsed.data);
+	return (long) parsed.height * parsed.width;
+}
+
+long bench_save( struct bench_input *in ){
+	for(int frame = 0; frame < in->frames; frame++){
+		save(in->null_file, in->n, in->points, &in->map_cfg);
+	}
+	return (long) in->frames * in->n;
+}
+
+void prepare_read_input( struct bench_input *in ){
+	fseek(in->frames_file, in->first_frame_end, SEEK_SET);
+}
+
+long bench_read_input( struct bench_input *in ){
+	int num_particles = in->n;
+	double radius, size;
+	unsigned int actual_size;
+	long points = 0;
+	for(int frame = 0; frame < in->frames; frame++){
+		points += read_input(false, in->frames_file, &in->read_points, &num_particles, &radius, &size, &actual_size, &in->read_colors);
+	}
+	return points;
+}
+
+struct kernel kernels[] = {
+	{"apply_force", "pair", NULL, bench_apply_force, false},
+	{"move", "agent", prepare_move, bench_move, false},
+	{"rank_for_location", "query", NULL, bench_rank_for_location, false},
+	{"is_valid_location", "query", NULL, bench_is_valid_location, false},
+	{"read_map", "cell", NULL, bench_read_map, true},
+	{"save", "point", NULL, bench_save, false},
+	{"read_input", "point", prepare_read_input, bench_read_input, false},
+};
+
+// square map with a solid border and a random fraction of interior walls
+void synthetic_map( struct map *map_cfg, unsigned int cells, double wall_density, uint64_t seed ){
+	map_cfg->height = cells;
+	map_cfg->width = cells;
+	map_cfg->goal_col = 0;
+	map_cfg->goal_row = 0;
+	map_cfg->data = (unsigned short *) malloc(cells * cells * sizeof(unsigned short));
+	double draw;
+	for(unsigned int row = 0; row < cells; row++){
+		for(unsigned int col = 0; col < cells; col++){
+			unsigned int cell = row * cells + col;
+			rng_uniforms(seed, cell, RNG_SYNTHETIC, &draw, 1);
+			bool border = row == 0 || col == 0 || row == cells - 1 || col == cells - 1;
+			map_cfg->data[cell] = (border || draw < wall_density) ? 0 : 1;
+		}
+	}
+}
+
+int main( int argc, char **argv ){
+	if( find_option( argc, argv, "-h" ) >= 0 ){
+		usage();
+		return 0;
+	}
+
+	struct bench_input in;
+	memset(&in, 0, sizeof(struct bench_input));
+	in.n = read_int( argc, argv, "-n", 1000 );
+	unsigned int map_size = read_int( argc, argv, "--map-size", 256 );
+	double wall_density = read_double( argc, argv, "--wall-density", 0 );
+	if( find_option( argc, argv, "--wall-density" ) < 0 ){
+		wall_density = 0.2;
+	}
+	in.ranks = read_int( argc, argv, "--ranks", 16 );
+	in.probes = read_int( argc, argv, "--probes", 1 << 20 );
+	in.move_steps = read_int( argc, argv, "--move-steps", 100 );
+	in.frames = read_int( argc, argv, "--frames", 10 );
+	int trials = read_int( argc, argv, "--trials", 10 );
+	char *only = read_string( argc, argv, "--only", NULL );
+	uint64_t seed = read_seed( argc, argv );
+
+	if(in.n < 2 || map_size < 3 || trials < 1 || in.probes < 1 || in.frames < 1){
+		usage();
+		return 1;
+	}
+	int sqrt_ranks = (int) (sqrt((double) in.ranks) + 0.5);
+	if(sqrt_ranks * sqrt_ranks != in.ranks){
+		fprintf(stderr, "--ranks must be a power of 4\n");
+		return 1;
+	}
+
+	// map, and the same map as map-file text
+	synthetic_map(&in.map_cfg, map_size, wall_density, seed);
+	set_size(in.n, &in.map_cfg);
+	in.map_file = tmpfile();
+	write_map(in.map_file, &in.map_cfg, false);
+
+	// agents on the walkable cells, as the simulator places them
+	struct walkable_index spawn;
+	struct subdivision whole = {0.0, 0.0, 1.0, 1.0};
+	if(build_walkable_index(&spawn, &in.map_cfg, &whole, -1.0, -1.0) == 0){
+		fprintf(stderr, "No walkable cells, lower --wall-density\n");
+		return 1;
+	}
+	in.particles = (particle_t *) malloc(in.n * sizeof(particle_t));
+	in.work = (particle_t *) malloc(in.n * sizeof(particle_t));
+	init_particles(in.n, 0, NULL, in.particles, &in.map_cfg, &spawn, seed);
+	free_walkable_index(&spawn);
+
+	// the simulator's square subdivisions
+	in.areas = (struct subdivision *) malloc(in.ranks * sizeof(struct subdivision));
+	double range = 1.0 / sqrt_ranks;
+	for(int core = 0; core < in.ranks; core++){
+		in.areas[core].min_x = (core % sqrt_ranks) * range;
+		in.areas[core].max_x = (core % sqrt_ranks) * range + range;
+		in.areas[core].min_y = (core / sqrt_ranks) * range;
+		in.areas[core].max_y = (core / sqrt_ranks) * range + range;
+	}
+
+	// uniform probe points over the whole map
+	in.probe_x = (double *) malloc(in.probes * sizeof(double));
+	in.probe_y = (double *) malloc(in.probes * sizeof(double));
+	double draws[2];
+	for(int i = 0; i < in.probes; i++){
+		rng_uniforms(seed, map_size * map_size + i, RNG_SYNTHETIC, draws, 2);
+		in.probe_x[i] = draws[0];
+		in.probe_y[i] = draws[1];
+	}
+
+	// frames as the simulator writes them; save() writes the header with
+	// its first frame only, so that one goes to the file read_input parses
+	in.points = (struct minimum_particle *) malloc(in.n * sizeof(struct minimum_particle));
+	for(int i = 0; i < in.n; i++){
+		in.points[i].x = in.particles[i].x;
+		in.points[i].y = in.particles[i].y;
+		in.points[i].color_r = in.particles[i].color_r;
+		in.points[i].color_g = in.particles[i].color_g;
+		in.points[i].color_b = in.particles[i].color_b;
+	}
+	in.frames_file = tmpfile();
+	for(int frame = 0; frame <= in.frames; frame++){
+		save(in.frames_file, in.n, in.points, &in.map_cfg);
+	}
+	rewind(in.frames_file);
+	int num_particles = 0;
+	double radius, size;
+	unsigned int actual_size;
+	read_input(false, in.frames_file, &in.read_points, &num_particles, &radius, &size, &actual_size, &in.read_colors);
+	in.first_frame_end = ftell(in.frames_file);
+	in.null_file = fopen("/dev/null", "w");
+
+	int walkable = 0;
+	for(unsigned int cell = 0; cell < map_size * map_size; cell++){
+		walkable += in.map_cfg.data[cell] != 0;
+	}
+	printf("n = %d, map = %ux%u (%.1f%% walkable), ranks = %d, probes = %d, trials = %d, seed = %llu\n",
+		in.n, map_size, map_size, 100.0 * walkable / (map_size * map_size), in.ranks, in.probes, trials, (unsigned long long) seed);
+	printf("%-20s %-6s %12s %12s %12s %12s\n", "kernel", "op", "ops/batch", "mean ns/op", "stddev", "min ns/op");
+
+	int stderr_copy = dup(fileno(stderr));
+	int devnull = open("/dev/null", O_WRONLY);
+	for(unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++){
+		struct kernel *kernel = &kernels[k];
+		if(only && strcmp(only, kernel->name) != 0){
+			continue;
+		}
+		if(kernel->chatty){
+			fflush(stderr);
+			dup2(devnull, fileno(stderr));
+		}
+
+		double sum = 0, sum_squares = 0, best = 0;
+		long ops = 0;
+		// trial 0 warms the caches and is not counted
+		for(int trial = 0; trial <= trials; trial++){
+			if(kernel->prepare){
+				kernel->prepare(&in);
+			}
+			double start = read_timer();
+			ops = kernel->batch(&in);
+			double ns_per_op = 1.0e9 * (read_timer() - start) / (ops > 0 ? ops : 1);
+			if(trial == 0){
+				continue;
+			}
+			sum += ns_per_op;
+			sum_squares += ns_per_op * ns_per_op;
+			best = (trial == 1 || ns_per_op < best) ? ns_per_op : best;
+		}
+
+		if(kernel->chatty){
+			fflush(stderr);
+			dup2(stderr_copy, fileno(stderr));
+		}
+		double mean = sum / trials;
+		double variance = trials > 1 ? (sum_squares - trials * mean * mean) / (trials - 1) : 0.0;
+		printf("%-20s %-6s %12ld %12.3f %12.3f %12.3f\n", kernel->name, kernel->per, ops, mean, sqrt(MAX(variance, 0.0)), best);
+		fflush(stdout);
+	}
+	close(devnull);
+	close(stderr_copy);
+
+	fclose(in.null_file);
+	fclose(in.frames_file);
+	fclose(in.map_file);
+	free(in.read_points);
+	free(in.read_colors);
+	free(in.points);
+	free(in.probe_x);
+	free(in.probe_y);
+	free(in.areas);
+	free(in.particles);
+	free(in.work);
+	free(in.map_cfg.data);
+	return 0;
+}
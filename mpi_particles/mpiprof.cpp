@@ -0,0 +1,601 @@
+//
+//  PMPI communication profiler
+//
+//  Link ahead of the MPI library (see the run_prof target) to record, per
+//  rank: a rank x rank matrix of point-to-point and one-sided message
+//  counts and bytes, calls, time and bytes of each MPI function, and a
+//  message-size histogram with the send time spent in each size class.
+//  Everything is gathered and written as JSON in MPI_Finalize, to
+//  $MPIPROF_OUT (default mpiprof.json).
+//
+
+#include <mpi.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SIZE_BUCKETS 32  // bucket b holds messages of [2^(b-1), 2^b) bytes, bucket 0 is empty messages
+
+enum mpiprof_call{
+	CALL_SEND,
+	CALL_ISEND,
+	CALL_ISSEND,
+	CALL_RECV,
+	CALL_IRECV,
+	CALL_WAIT,
+	CALL_WAITALL,
+	CALL_TEST,
+	CALL_TESTALL,
+	CALL_IPROBE,
+	CALL_BARRIER,
+	CALL_IBARRIER,
+	CALL_BCAST,
+	CALL_GATHER,
+	CALL_GATHERV,
+	CALL_IGATHER,
+	CALL_IGATHERV,
+	CALL_REDUCE,
+	CALL_ALLREDUCE,
+	CALL_ALLGATHER,
+	CALL_ALLTOALL,
+	CALL_PUT,
+	CALL_FETCH_AND_OP,
+	CALL_WIN_FENCE,
+	CALL_WIN_POST,
+	CALL_WIN_START,
+	CALL_WIN_COMPLETE,
+	CALL_WIN_WAIT,
+	CALL_WIN_LOCK,
+	CALL_WIN_UNLOCK,
+	CALL_FILE_OPEN,
+	CALL_FILE_CLOSE,
+	CALL_FILE_DELETE,
+	CALL_FILE_READ_AT_ALL,
+	CALL_FILE_WRITE_AT_ALL,
+	NUM_CALLS
+};
+
+static const char *call_names[NUM_CALLS] = {
+	"MPI_Send", "MPI_Isend", "MPI_Issend", "MPI_Recv", "MPI_Irecv", "MPI_Wait", "MPI_Waitall",
+	"MPI_Test", "MPI_Testall", "MPI_Iprobe", "MPI_Barrier", "MPI_Ibarrier", "MPI_Bcast", "MPI_Gather",
+	"MPI_Gatherv", "MPI_Igather", "MPI_Igatherv", "MPI_Reduce", "MPI_Allreduce", "MPI_Allgather", "MPI_Alltoall",
+	"MPI_Put", "MPI_Fetch_and_op", "MPI_Win_fence", "MPI_Win_post", "MPI_Win_start", "MPI_Win_complete",
+	"MPI_Win_wait", "MPI_Win_lock", "MPI_Win_unlock", "MPI_File_open", "MPI_File_close", "MPI_File_delete",
+	"MPI_File_read_at_all", "MPI_File_write_at_all"
+};
+
+static struct{
+	bool active;
+	int rank;
+	int n_proc;
+	// point-to-point traffic to each world rank
+	long *msgs_to;
+	long *bytes_to;
+	long calls[NUM_CALLS];
+	double time[NUM_CALLS];
+	// bytes this rank sent, contributed or moved to and from files
+	long bytes[NUM_CALLS];
+	long size_msgs[SIZE_BUCKETS];
+	double size_time[SIZE_BUCKETS];
+	double start;
+} prof;
+
+static double now(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+static int size_bucket(long bytes){
+	int b = 0;
+	while(bytes > 0 && b < SIZE_BUCKETS - 1){
+		bytes >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static long type_bytes(int count, MPI_Datatype type){
+	int size;
+	PMPI_Type_size(type, &size);
+	return (long) count * size;
+}
+
+static int world_rank(int dest, MPI_Comm comm){
+	if(comm == MPI_COMM_WORLD || dest < 0){
+		return dest;
+	}
+	MPI_Group group, world;
+	int translated;
+	PMPI_Comm_group(comm, &group);
+	PMPI_Comm_group(MPI_COMM_WORLD, &world);
+	PMPI_Group_translate_ranks(group, 1, &dest, world, &translated);
+	PMPI_Group_free(&group);
+	PMPI_Group_free(&world);
+	return translated;
+}
+
+// target_rank of a window in MPI_COMM_WORLD
+static int win_world_rank(int target_rank, MPI_Win win){
+	MPI_Group group, world;
+	int translated;
+	PMPI_Win_get_group(win, &group);
+	PMPI_Comm_group(MPI_COMM_WORLD, &world);
+	PMPI_Group_translate_ranks(group, 1, &target_rank, world, &translated);
+	PMPI_Group_free(&group);
+	PMPI_Group_free(&world);
+	return translated;
+}
+
+static void record_send(int dest, MPI_Comm comm, long bytes, double elapsed){
+	int to = world_rank(dest, comm);
+	if(to >= 0 && to < prof.n_proc){
+		prof.msgs_to[to]++;
+		prof.bytes_to[to] += bytes;
+	}
+	int b = size_bucket(bytes);
+	prof.size_msgs[b]++;
+	prof.size_time[b] += elapsed;
+}
+
+static inline void record_call(int call, double began){
+	prof.calls[call]++;
+	prof.time[call] += now() - began;
+}
+
+static inline void record_bytes(int call, long bytes){
+	prof.bytes[call] += bytes;
+}
+
+//
+//  setup and report
+//
+
+static void mpiprof_start(){
+	PMPI_Comm_rank(MPI_COMM_WORLD, &prof.rank);
+	PMPI_Comm_size(MPI_COMM_WORLD, &prof.n_proc);
+	prof.msgs_to = (long *) calloc(prof.n_proc, sizeof(long));
+	prof.bytes_to = (long *) calloc(prof.n_proc, sizeof(long));
+	prof.start = now();
+	prof.active = true;
+}
+
+int MPI_Init(int *argc, char ***argv){
+	int result = PMPI_Init(argc, argv);
+	mpiprof_start();
+	return result;
+}
+
+int MPI_Init_thread(int *argc, char ***argv, int required, int *provided){
+	int result = PMPI_Init_thread(argc, argv, required, provided);
+	mpiprof_start();
+	return result;
+}
+
+static void write_matrix(FILE *f, const char *name, long *all, int n_proc){
+	fprintf(f, "  \"%s\": [", name);
+	for(int from = 0; from < n_proc; from++){
+		fprintf(f, "%s\n    [", from ? "," : "");
+		for(int to = 0; to < n_proc; to++){
+			fprintf(f, "%s%ld", to ? ", " : "", all[from * n_proc + to]);
+		}
+		fprintf(f, "]");
+	}
+	fprintf(f, "\n  ],\n");
+}
+
+int MPI_Finalize(){
+	if(!prof.active){
+		return PMPI_Finalize();
+	}
+	prof.active = false;
+	double wall = now() - prof.start;
+	int n = prof.n_proc;
+
+	long *msgs = NULL, *bytes = NULL;
+	if(prof.rank == 0){
+		msgs = (long *) malloc(n * n * sizeof(long));
+		bytes = (long *) malloc(n * n * sizeof(long));
+	}
+	PMPI_Gather(prof.msgs_to, n, MPI_LONG, msgs, n, MPI_LONG, 0, MPI_COMM_WORLD);
+	PMPI_Gather(prof.bytes_to, n, MPI_LONG, bytes, n, MPI_LONG, 0, MPI_COMM_WORLD);
+
+	long calls[NUM_CALLS], call_bytes[NUM_CALLS], size_msgs[SIZE_BUCKETS];
+	double time_sum[NUM_CALLS], time_max[NUM_CALLS], size_time[SIZE_BUCKETS], wall_max;
+	PMPI_Reduce(prof.calls, calls, NUM_CALLS, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(prof.bytes, call_bytes, NUM_CALLS, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(prof.time, time_sum, NUM_CALLS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(prof.time, time_max, NUM_CALLS, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(prof.size_msgs, size_msgs, SIZE_BUCKETS, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(prof.size_time, size_time, SIZE_BUCKETS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(&wall, &wall_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+	if(prof.rank == 0){
+		const char *filename = getenv("MPIPROF_OUT");
+		if(!filename){
+			filename = "mpiprof.json";
+		}
+		FILE *f = fopen(filename, "w");
+		if(!f){
+			fprintf(stderr, "mpiprof) Couldn't open %s\n", filename);
+		}else{
+			fprintf(f, "{\n  \"n_procs\": %d,\n  \"wall_time\": %g,\n", n, wall_max);
+			write_matrix(f, "messages", msgs, n);
+			write_matrix(f, "bytes", bytes, n);
+
+			fprintf(f, "  \"calls\": {");
+			bool first = true;
+			for(int c = 0; c < NUM_CALLS; c++){
+				if(calls[c] == 0){
+					continue;
+				}
+				fprintf(f, "%s\n    \"%s\": {\"calls\": %ld, \"bytes\": %ld, \"time_sum\": %g, \"time_max_rank\": %g, \"fraction_of_wall\": %g}",
+					first ? "" : ",", call_names[c], calls[c], call_bytes[c], time_sum[c], time_max[c], wall_max > 0 ? time_sum[c] / (n * wall_max) : 0.0);
+				first = false;
+			}
+			fprintf(f, "\n  },\n");
+
+			// point-to-point sends by size: [2^(b-1), 2^b) bytes
+			fprintf(f, "  \"send_sizes\": [");
+			first = true;
+			for(int b = 0; b < SIZE_BUCKETS; b++){
+				if(size_msgs[b] == 0){
+					continue;
+				}
+				fprintf(f, "%s\n    {\"min_bytes\": %ld, \"max_bytes\": %ld, \"messages\": %ld, \"send_time\": %g}",
+					first ? "" : ",", b ? 1L << (b - 1) : 0L, b ? (1L << b) - 1 : 0L, size_msgs[b], size_time[b]);
+				first = false;
+			}
+			fprintf(f, "\n  ]\n}\n");
+			fclose(f);
+			fprintf(stderr, "mpiprof) wrote %s\n", filename);
+		}
+		free(msgs);
+		free(bytes);
+	}
+
+	free(prof.msgs_to);
+	free(prof.bytes_to);
+	return PMPI_Finalize();
+}
+
+//
+//  point-to-point
+//
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Send(buf, count, datatype, dest, tag, comm);
+	if(prof.active){
+		record_send(dest, comm, type_bytes(count, datatype), now() - began);
+		record_call(CALL_SEND, began);
+	}
+	return result;
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request){
+	double began = now();
+	int result = PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+	if(prof.active){
+		record_send(dest, comm, type_bytes(count, datatype), now() - began);
+		record_call(CALL_ISEND, began);
+	}
+	return result;
+}
+
+int MPI_Issend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request){
+	double began = now();
+	int result = PMPI_Issend(buf, count, datatype, dest, tag, comm, request);
+	if(prof.active){
+		record_send(dest, comm, type_bytes(count, datatype), now() - began);
+		record_call(CALL_ISSEND, began);
+	}
+	return result;
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status){
+	double began = now();
+	int result = PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+	if(prof.active){
+		record_call(CALL_RECV, began);
+	}
+	return result;
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request){
+	double began = now();
+	int result = PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+	if(prof.active){
+		record_call(CALL_IRECV, began);
+	}
+	return result;
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status){
+	double began = now();
+	int result = PMPI_Wait(request, status);
+	if(prof.active){
+		record_call(CALL_WAIT, began);
+	}
+	return result;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]){
+	double began = now();
+	int result = PMPI_Waitall(count, requests, statuses);
+	if(prof.active){
+		record_call(CALL_WAITALL, began);
+	}
+	return result;
+}
+
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status){
+	double began = now();
+	int result = PMPI_Test(request, flag, status);
+	if(prof.active){
+		record_call(CALL_TEST, began);
+	}
+	return result;
+}
+
+int MPI_Testall(int count, MPI_Request requests[], int *flag, MPI_Status statuses[]){
+	double began = now();
+	int result = PMPI_Testall(count, requests, flag, statuses);
+	if(prof.active){
+		record_call(CALL_TESTALL, began);
+	}
+	return result;
+}
+
+int MPI_Iprobe(int source, int tag, MPI_Comm comm, int *flag, MPI_Status *status){
+	double began = now();
+	int result = PMPI_Iprobe(source, tag, comm, flag, status);
+	if(prof.active){
+		record_call(CALL_IPROBE, began);
+	}
+	return result;
+}
+
+//
+//  collectives and one-sided
+//
+
+int MPI_Barrier(MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Barrier(comm);
+	if(prof.active){
+		record_call(CALL_BARRIER, began);
+	}
+	return result;
+}
+
+int MPI_Ibarrier(MPI_Comm comm, MPI_Request *request){
+	double began = now();
+	int result = PMPI_Ibarrier(comm, request);
+	if(prof.active){
+		record_call(CALL_IBARRIER, began);
+	}
+	return result;
+}
+
+int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Bcast(buffer, count, datatype, root, comm);
+	if(prof.active){
+		record_call(CALL_BCAST, began);
+	}
+	return result;
+}
+
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+	if(prof.active){
+		record_call(CALL_GATHER, began);
+	}
+	return result;
+}
+
+int MPI_Gatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root, MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+	if(prof.active){
+		record_call(CALL_GATHERV, began);
+	}
+	return result;
+}
+
+int MPI_Igather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm, MPI_Request *request){
+	double began = now();
+	int result = PMPI_Igather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm, request);
+	if(prof.active){
+		record_call(CALL_IGATHER, began);
+	}
+	return result;
+}
+
+int MPI_Igatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root, MPI_Comm comm, MPI_Request *request){
+	double began = now();
+	int result = PMPI_Igatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm, request);
+	if(prof.active){
+		record_call(CALL_IGATHERV, began);
+	}
+	return result;
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+	if(prof.active){
+		record_call(CALL_REDUCE, began);
+	}
+	return result;
+}
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+	if(prof.active){
+		record_call(CALL_ALLREDUCE, began);
+	}
+	return result;
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+	if(prof.active){
+		record_bytes(CALL_ALLGATHER, type_bytes(sendcount, sendtype));
+		record_call(CALL_ALLGATHER, began);
+	}
+	return result;
+}
+
+int MPI_Alltoall(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm){
+	double began = now();
+	int result = PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+	if(prof.active){
+		record_call(CALL_ALLTOALL, began);
+	}
+	return result;
+}
+
+int MPI_Put(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype, int target_rank, MPI_Aint target_disp, int target_count, MPI_Datatype target_datatype, MPI_Win win){
+	double began = now();
+	int result = PMPI_Put(origin_addr, origin_count, origin_datatype, target_rank, target_disp, target_count, target_datatype, win);
+	if(prof.active){
+		long bytes = type_bytes(origin_count, origin_datatype);
+		record_send(win_world_rank(target_rank, win), MPI_COMM_WORLD, bytes, now() - began);
+		record_bytes(CALL_PUT, bytes);
+		record_call(CALL_PUT, began);
+	}
+	return result;
+}
+
+int MPI_Fetch_and_op(const void *origin_addr, void *result_addr, MPI_Datatype datatype, int target_rank, MPI_Aint target_disp, MPI_Op op, MPI_Win win){
+	double began = now();
+	int result = PMPI_Fetch_and_op(origin_addr, result_addr, datatype, target_rank, target_disp, op, win);
+	if(prof.active){
+		long bytes = type_bytes(1, datatype);
+		record_send(win_world_rank(target_rank, win), MPI_COMM_WORLD, bytes, now() - began);
+		record_bytes(CALL_FETCH_AND_OP, bytes);
+		record_call(CALL_FETCH_AND_OP, began);
+	}
+	return result;
+}
+
+int MPI_Win_fence(int assert, MPI_Win win){
+	double began = now();
+	int result = PMPI_Win_fence(assert, win);
+	if(prof.active){
+		record_call(CALL_WIN_FENCE, began);
+	}
+	return result;
+}
+
+int MPI_Win_post(MPI_Group group, int assert, MPI_Win win){
+	double began = now();
+	int result = PMPI_Win_post(group, assert, win);
+	if(prof.active){
+		record_call(CALL_WIN_POST, began);
+	}
+	return result;
+}
+
+int MPI_Win_start(MPI_Group group, int assert, MPI_Win win){
+	double began = now();
+	int result = PMPI_Win_start(group, assert, win);
+	if(prof.active){
+		record_call(CALL_WIN_START, began);
+	}
+	return result;
+}
+
+int MPI_Win_complete(MPI_Win win){
+	double began = now();
+	int result = PMPI_Win_complete(win);
+	if(prof.active){
+		record_call(CALL_WIN_COMPLETE, began);
+	}
+	return result;
+}
+
+int MPI_Win_wait(MPI_Win win){
+	double began = now();
+	int result = PMPI_Win_wait(win);
+	if(prof.active){
+		record_call(CALL_WIN_WAIT, began);
+	}
+	return result;
+}
+
+// a passive-target epoch; the operations inside it may only finish in the unlock
+int MPI_Win_lock(int lock_type, int rank, int assert, MPI_Win win){
+	double began = now();
+	int result = PMPI_Win_lock(lock_type, rank, assert, win);
+	if(prof.active){
+		record_call(CALL_WIN_LOCK, began);
+	}
+	return result;
+}
+
+int MPI_Win_unlock(int rank, MPI_Win win){
+	double began = now();
+	int result = PMPI_Win_unlock(rank, win);
+	if(prof.active){
+		record_call(CALL_WIN_UNLOCK, began);
+	}
+	return result;
+}
+
+//
+//  MPI-IO
+//
+
+int MPI_File_open(MPI_Comm comm, const char *filename, int amode, MPI_Info info, MPI_File *fh){
+	double began = now();
+	int result = PMPI_File_open(comm, filename, amode, info, fh);
+	if(prof.active){
+		record_call(CALL_FILE_OPEN, began);
+	}
+	return result;
+}
+
+int MPI_File_close(MPI_File *fh){
+	double began = now();
+	int result = PMPI_File_close(fh);
+	if(prof.active){
+		record_call(CALL_FILE_CLOSE, began);
+	}
+	return result;
+}
+
+int MPI_File_delete(const char *filename, MPI_Info info){
+	double began = now();
+	int result = PMPI_File_delete(filename, info);
+	if(prof.active){
+		record_call(CALL_FILE_DELETE, began);
+	}
+	return result;
+}
+
+int MPI_File_read_at_all(MPI_File fh, MPI_Offset offset, void *buf, int count, MPI_Datatype datatype, MPI_Status *status){
+	double began = now();
+	int result = PMPI_File_read_at_all(fh, offset, buf, count, datatype, status);
+	if(prof.active){
+		record_bytes(CALL_FILE_READ_AT_ALL, type_bytes(count, datatype));
+		record_call(CALL_FILE_READ_AT_ALL, began);
+	}
+	return result;
+}
+
+int MPI_File_write_at_all(MPI_File fh, MPI_Offset offset, const void *buf, int count, MPI_Datatype datatype, MPI_Status *status){
+	double began = now();
+	int result = PMPI_File_write_at_all(fh, offset, buf, count, datatype, status);
+	if(prof.active){
+		record_bytes(CALL_FILE_WRITE_AT_ALL, type_bytes(count, datatype));
+		record_call(CALL_FILE_WRITE_AT_ALL, began);
+	}
+	return result;
+}
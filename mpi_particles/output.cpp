@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "transport.h"
+#include "output.h"
+
+void frames_init( struct frame_queue *q, struct transport *t, int slots, int capacity,
+		void (*write)( void *arg, struct minimum_particle *frame, int count, int parked_count ), void *write_arg ){
+	memset(q, 0, sizeof(struct frame_queue));
+	q->t = t;
+	q->slots_count = slots > 0 ? slots : 1;
+	q->slots = (struct frame_slot *) calloc(q->slots_count, sizeof(struct frame_slot));
+	q->write = write;
+	q->write_arg = write_arg;
+	bool root = t->rank == 0;
+	for(int s = 0; s < q->slots_count; s++){
+		struct frame_slot *slot = &q->slots[s];
+		slot->send = (struct minimum_particle *) malloc(capacity * sizeof(struct minimum_particle));
+		if(root){
+			slot->recv = (struct minimum_particle *) malloc(capacity * sizeof(struct minimum_particle));
+			slot->frame.counts = (int *) malloc(t->n_proc * sizeof(int));
+			slot->frame.offsets = (int *) malloc(t->n_proc * sizeof(int));
+		}
+	}
+}
+
+// finishes the oldest frame in flight, unless it isn't in and we don't wait
+static bool retire_oldest( struct frame_queue *q, bool wait ){
+	struct frame_slot *slot = &q->slots[q->oldest];
+	if(!transport_frame_done(q->t, &slot->frame, wait)){
+		return false;
+	}
+	if(q->t->rank == 0){
+		q->write(q->write_arg, slot->recv, slot->frame.total, slot->parked_count);
+	}
+	q->oldest = (q->oldest + 1) % q->slots_count;
+	q->in_flight--;
+	return true;
+}
+
+struct minimum_particle *frames_next( struct frame_queue *q ){
+	if(q->in_flight == q->slots_count){
+		q->stalls++;
+		retire_oldest(q, true);
+	}
+	return q->slots[(q->oldest + q->in_flight) % q->slots_count].send;
+}
+
+void frames_start( struct frame_queue *q, int count, int parked_count ){
+	struct frame_slot *slot = &q->slots[(q->oldest + q->in_flight) % q->slots_count];
+	slot->parked_count = parked_count;
+	transport_frame_start(q->t, &slot->frame, slot->send, count, sizeof(struct minimum_particle), slot->recv, 0);
+	q->in_flight++;
+}
+
+void frames_poll( struct frame_queue *q ){
+	while(q->in_flight > 0 && retire_oldest(q, false));
+}
+
+void frames_flush( struct frame_queue *q ){
+	while(q->in_flight > 0){
+		retire_oldest(q, true);
+	}
+}
+
+void frames_free( struct frame_queue *q ){
+	for(int s = 0; s < q->slots_count; s++){
+		free(q->slots[s].send);
+		free(q->slots[s].recv);
+		free(q->slots[s].frame.counts);
+		free(q->slots[s].frame.offsets);
+	}
+	free(q->slots);
+	memset(q, 0, sizeof(struct frame_queue));
+}
@@ -0,0 +1,61 @@
+#ifndef OUTPUT_H__
+#define OUTPUT_H__
+
+#include "common.h"
+#include "transport.h"
+
+//
+//  output frames in flight to root
+//
+//  Each step every rank copies its agents into a free slot and starts the
+//  slot's gather, then carries on with the next step while the frame
+//  drains. Root writes frames out in step order as they arrive. There are
+//  only so many slots: once all of them are in flight, the next frame waits
+//  for the oldest, so a slow writer holds the simulation back instead of
+//  piling up memory.
+//
+
+struct frame_slot{
+	struct transport_frame frame;
+	struct minimum_particle *send;
+	// root: the gathered frame, room for every agent, and how many parked
+	// arrivals it shows
+	struct minimum_particle *recv;
+	int parked_count;
+};
+
+struct frame_queue{
+	struct transport *t;
+	struct frame_slot *slots;
+	int slots_count;
+	// oldest slot in flight, and how many are
+	int oldest;
+	int in_flight;
+	// root: called with each frame in order, its agents first and then room
+	// for the rest of the capacity
+	void (*write)( void *arg, struct minimum_particle *frame, int count, int parked_count );
+	void *write_arg;
+	// frames that had to wait for a free slot
+	long stalls;
+};
+
+void frames_init( struct frame_queue *q, struct transport *t, int slots, int capacity,
+	void (*write)( void *arg, struct minimum_particle *frame, int count, int parked_count ), void *write_arg );
+
+// a free slot's send buffer, for capacity agents; waits for the oldest
+// frame if none is free
+struct minimum_particle *frames_next( struct frame_queue *q );
+
+// starts gathering the first count agents of the buffer frames_next gave
+// (collective)
+void frames_start( struct frame_queue *q, int count, int parked_count );
+
+// writes out the frames that have arrived, oldest first
+void frames_poll( struct frame_queue *q );
+
+// waits for and writes out every frame in flight
+void frames_flush( struct frame_queue *q );
+
+void frames_free( struct frame_queue *q );
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include "pool.h"
+
+// polls of the job counter before a worker sleeps
+#define SPINS_BEFORE_SLEEP 4096
+#define SPINS_BEFORE_YIELD 128
+
+// [begin, end) packed into one word so owner and thieves agree with one CAS
+struct alignas(64) work_range{
+	std::atomic<uint64_t> bounds;
+};
+
+static inline uint64_t pack( uint32_t begin, uint32_t end ){
+	return ((uint64_t) end << 32) | begin;
+}
+
+struct work_pool{
+	int workers;
+	std::thread *threads;
+	struct work_range *ranges;
+	// current job
+	void (*fn)( void *arg, int task, int worker );
+	void *arg;
+	// bumped to start a job
+	std::atomic<long> generation;
+	// workers other than the caller still in the job
+	std::atomic<int> busy;
+	bool stop;
+	std::mutex lock;
+	std::condition_variable wake;
+};
+
+// next task from the front of our own range
+static bool take_own( struct work_pool *pool, int worker, int *task ){
+	std::atomic<uint64_t> &bounds = pool->ranges[worker].bounds;
+	uint64_t now = bounds.load(std::memory_order_acquire);
+	while(true){
+		uint32_t begin = (uint32_t) now, end = (uint32_t) (now >> 32);
+		if(begin >= end){
+			return false;
+		}
+		if(bounds.compare_exchange_weak(now, pack(begin + 1, end), std::memory_order_acq_rel)){
+			*task = begin;
+			return true;
+		}
+	}
+}
+
+// moves the back half of some other worker's range into ours
+static bool steal( struct work_pool *pool, int worker ){
+	for(int k = 1; k < pool->workers; k++){
+		int victim = (worker + k) % pool->workers;
+		std::atomic<uint64_t> &bounds = pool->ranges[victim].bounds;
+		uint64_t now = bounds.load(std::memory_order_acquire);
+		while(true){
+			uint32_t begin = (uint32_t) now, end = (uint32_t) (now >> 32);
+			if(begin >= end){
+				break;
+			}
+			uint32_t take = (end - begin + 1) / 2;
+			if(bounds.compare_exchange_weak(now, pack(begin, end - take), std::memory_order_acq_rel)){
+				pool->ranges[worker].bounds.store(pack(end - take, end), std::memory_order_release);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void run_tasks( struct work_pool *pool, int worker ){
+	int task;
+	do{
+		while(take_own(pool, worker, &task)){
+			pool->fn(pool->arg, task, worker);
+		}
+	}while(steal(pool, worker));
+}
+
+static void worker_main( struct work_pool *pool, int worker ){
+	long seen = 0;
+	while(true){
+		// spin briefly for the next job, then sleep
+		int spins = 0;
+		while(pool->generation.load(std::memory_order_acquire) == seen && spins < SPINS_BEFORE_SLEEP){
+			if(++spins % SPINS_BEFORE_YIELD == 0){
+				std::this_thread::yield();
+			}
+		}
+		if(pool->generation.load(std::memory_order_acquire) == seen){
+			std::unique_lock<std::mutex> held(pool->lock);
+			pool->wake.wait(held, [&]{ return pool->stop || pool->generation.load(std::memory_order_acquire) != seen; });
+		}
+		if(pool->stop){
+			return;
+		}
+		seen = pool->generation.load(std::memory_order_acquire);
+		run_tasks(pool, worker);
+		pool->busy.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+struct work_pool *pool_create( int workers ){
+	struct work_pool *pool = new work_pool;
+	pool->workers = workers > 0 ? workers : 1;
+	// plain new only guarantees the alignment of the largest scalar type
+	// before C++17, so each range gets its own cache line this way
+	void *ranges;
+	if(posix_memalign(&ranges, alignof(work_range), pool->workers * sizeof(work_range)) != 0){
+		ranges = NULL;
+	}
+	pool->ranges = (struct work_range *) ranges;
+	for(int w = 0; w < pool->workers; w++){
+		new (&pool->ranges[w]) work_range;
+		pool->ranges[w].bounds.store(0);
+	}
+	pool->fn = NULL;
+	pool->arg = NULL;
+	pool->generation.store(0);
+	pool->busy.store(0);
+	pool->stop = false;
+	pool->threads = new std::thread[pool->workers];
+	for(int w = 1; w < pool->workers; w++){
+		pool->threads[w] = std::thread(worker_main, pool, w);
+	}
+	return pool;
+}
+
+int pool_workers( struct work_pool *pool ){
+	return pool->workers;
+}
+
+void pool_for( struct work_pool *pool, int tasks, void (*fn)( void *arg, int task, int worker ), void *arg ){
+	if(pool->workers == 1 || tasks <= 1){
+		for(int task = 0; task < tasks; task++){
+			fn(arg, task, 0);
+		}
+		return;
+	}
+
+	pool->fn = fn;
+	pool->arg = arg;
+	for(int w = 0; w < pool->workers; w++){
+		uint32_t begin = (uint64_t) tasks * w / pool->workers;
+		uint32_t end = (uint64_t) tasks * (w + 1) / pool->workers;
+		pool->ranges[w].bounds.store(pack(begin, end), std::memory_order_relaxed);
+	}
+	pool->busy.store(pool->workers - 1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> held(pool->lock);
+		pool->generation.fetch_add(1, std::memory_order_release);
+	}
+	pool->wake.notify_all();
+
+	run_tasks(pool, 0);
+	int spins = 0;
+	while(pool->busy.load(std::memory_order_acquire) > 0){
+		if(++spins % SPINS_BEFORE_YIELD == 0){
+			std::this_thread::yield();
+		}
+	}
+}
+
+void pool_destroy( struct work_pool *pool ){
+	{
+		std::lock_guard<std::mutex> held(pool->lock);
+		pool->stop = true;
+	}
+	pool->wake.notify_all();
+	for(int w = 1; w < pool->workers; w++){
+		pool->threads[w].join();
+	}
+	delete [] pool->threads;
+	for(int w = 0; w < pool->workers; w++){
+		pool->ranges[w].~work_range();
+	}
+	free(pool->ranges);
+	delete pool;
+}
@@ -0,0 +1,25 @@
+#ifndef POOL_H__
+#define POOL_H__
+
+//
+//  work-stealing thread pool for loops over independent tasks
+//
+//  pool_for splits the tasks into one contiguous range per worker; a worker
+//  takes tasks from the front of its own range and, once that is empty,
+//  steals the back half of another worker's range. The calling thread is
+//  worker 0, so a pool of 1 worker runs everything inline.
+//
+
+struct work_pool;
+
+struct work_pool *pool_create( int workers );
+
+int pool_workers( struct work_pool *pool );
+
+// Runs fn(arg, task, worker) for every task in [0, tasks) and returns when
+// all of them are done. worker is in [0, pool_workers).
+void pool_for( struct work_pool *pool, int tasks, void (*fn)( void *arg, int task, int worker ), void *arg );
+
+void pool_destroy( struct work_pool *pool );
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "common.h"
+#include "profiler.h"
+#include "transport.h"
+
+const char *phase_names[NUM_PHASES] = {
+	"force",
+	"move",
+	"compaction",
+	"arrivals",
+	"gather",
+	"save",
+	"balance",
+	"ghost_classification",
+	"exchange",
+	"barrier"
+};
+
+// per-rank values reduced at the end, after the phase times
+enum{
+	STAT_AGENTS = NUM_PHASES,
+	STAT_AGENT_STEPS,
+	STAT_BYTES,
+	STAT_MESSAGES,
+	STAT_TOTAL,
+	STAT_FEWEST,
+	STAT_MOST,
+	STAT_RSS,
+	NUM_STATS
+};
+
+void profile_init( struct profiler *prof ){
+	memset(prof, 0, sizeof(struct profiler));
+	prof->min_agents = -1;
+	prof->last_mark = monotonic_time();
+}
+
+void profile_step( struct profiler *prof, int agents ){
+	prof->steps++;
+	prof->agent_steps += agents;
+	prof->min_agents = prof->min_agents < 0 ? agents : MIN(prof->min_agents, agents);
+	prof->max_agents = MAX(prof->max_agents, agents);
+	prof->last_mark = monotonic_time();
+}
+
+// memory high-water mark of this process
+static double max_rss_kb(){
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024.0; // bytes on macOS
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+static void write_stat(FILE *f, const char *name, double min, double mean, double max, bool last){
+	fprintf(f, "    \"%s\": {\"min\": %g, \"mean\": %g, \"max\": %g, \"imbalance\": %g}%s\n",
+		name, min, mean, max, mean > 0 ? max / mean : 1.0, last ? "" : ",");
+}
+
+void report_profile( const char *filename, struct profiler *prof, double simulation_time, struct transport *t ){
+	int rank = t->rank, n_proc = t->n_proc;
+
+	double stats[NUM_STATS], mins[NUM_STATS], maxs[NUM_STATS], sums[NUM_STATS];
+	for(int p = 0; p < NUM_PHASES; p++){
+		stats[p] = prof->phase_time[p];
+	}
+	stats[STAT_AGENTS] = prof->steps ? (double) prof->agent_steps / prof->steps : 0.0;
+	stats[STAT_AGENT_STEPS] = prof->agent_steps;
+	stats[STAT_BYTES] = prof->bytes_sent;
+	stats[STAT_MESSAGES] = prof->messages_sent;
+	stats[STAT_TOTAL] = simulation_time;
+	stats[STAT_FEWEST] = prof->min_agents;
+	stats[STAT_MOST] = prof->max_agents;
+	stats[STAT_RSS] = max_rss_kb();
+
+	transport_reduce(t, stats, mins, NUM_STATS, TRANSPORT_DOUBLE, TRANSPORT_MIN, 0);
+	transport_reduce(t, stats, maxs, NUM_STATS, TRANSPORT_DOUBLE, TRANSPORT_MAX, 0);
+	transport_reduce(t, stats, sums, NUM_STATS, TRANSPORT_DOUBLE, TRANSPORT_SUM, 0);
+
+	if(rank != 0){
+		return;
+	}
+
+	double wall = maxs[STAT_TOTAL];
+	// thread ranks all report the one process's high-water mark
+	double rss_total = t->shared_memory ? maxs[STAT_RSS] : sums[STAT_RSS];
+	fprintf(stderr, "%s profile over %d steps, %d ranks (seconds per rank)\n", MPI_PREPEND, prof->steps, n_proc);
+	fprintf(stderr, "%s %-22s %10s %10s %10s %9s\n", MPI_PREPEND, "phase", "min", "mean", "max", "max/mean");
+	for(int p = 0; p < NUM_PHASES; p++){
+		double mean = sums[p] / n_proc;
+		fprintf(stderr, "%s %-22s %10.4g %10.4g %10.4g %9.3f\n", MPI_PREPEND, phase_names[p], mins[p], mean, maxs[p], mean > 0 ? maxs[p] / mean : 1.0);
+	}
+	fprintf(stderr, "%s %-22s %10.4g %10.4g %10.4g %9.3f\n", MPI_PREPEND, "agents per step", mins[STAT_AGENTS], sums[STAT_AGENTS] / n_proc, maxs[STAT_AGENTS],
+		sums[STAT_AGENTS] > 0 ? maxs[STAT_AGENTS] * n_proc / sums[STAT_AGENTS] : 1.0);
+	fprintf(stderr, "%s %-22s %10.4g %10.4g %10.4g %9.3f\n", MPI_PREPEND, "bytes sent", mins[STAT_BYTES], sums[STAT_BYTES] / n_proc, maxs[STAT_BYTES],
+		sums[STAT_BYTES] > 0 ? maxs[STAT_BYTES] * n_proc / sums[STAT_BYTES] : 1.0);
+	fprintf(stderr, "%s %-22s %10.4g %10.4g %10.4g %9.3f\n", MPI_PREPEND, "max rss (KB)", mins[STAT_RSS], sums[STAT_RSS] / n_proc, maxs[STAT_RSS],
+		maxs[STAT_RSS] * n_proc / sums[STAT_RSS]);
+
+	if(!filename){
+		return;
+	}
+	bool to_stdout = strcmp(filename, "stdout") == 0;
+	bool to_stderr = strcmp(filename, "stderr") == 0;
+	FILE *f = to_stdout ? stdout : (to_stderr ? stderr : fopen(filename, "w"));
+	if(!f){
+		fprintf(stderr, "%s Couldn't open profile file %s\n", MPI_PREPEND, filename);
+		return;
+	}
+	fprintf(f, "{\n");
+	fprintf(f, "  \"n_procs\": %d,\n  \"steps\": %d,\n  \"simulation_time\": %g,\n", n_proc, prof->steps, wall);
+	fprintf(f, "  \"steps_per_second\": %g,\n  \"agent_updates_per_second\": %g,\n",
+		wall > 0 ? prof->steps / wall : 0.0, wall > 0 ? sums[STAT_AGENT_STEPS] / wall : 0.0);
+	fprintf(f, "  \"phases\": {\n");
+	for(int p = 0; p < NUM_PHASES; p++){
+		write_stat(f, phase_names[p], mins[p], sums[p] / n_proc, maxs[p], p == NUM_PHASES - 1);
+	}
+	fprintf(f, "  },\n  \"per_rank\": {\n");
+	write_stat(f, "agents_per_step", mins[STAT_AGENTS], sums[STAT_AGENTS] / n_proc, maxs[STAT_AGENTS], false);
+	write_stat(f, "bytes_sent", mins[STAT_BYTES], sums[STAT_BYTES] / n_proc, maxs[STAT_BYTES], false);
+	write_stat(f, "messages_sent", mins[STAT_MESSAGES], sums[STAT_MESSAGES] / n_proc, maxs[STAT_MESSAGES], false);
+	write_stat(f, "loop_time", mins[STAT_TOTAL], sums[STAT_TOTAL] / n_proc, maxs[STAT_TOTAL], false);
+	write_stat(f, "max_rss_kb", mins[STAT_RSS], sums[STAT_RSS] / n_proc, maxs[STAT_RSS], true);
+	fprintf(f, "  },\n  \"agents_in_any_step\": {\"min\": %g, \"max\": %g},\n", mins[STAT_FEWEST], maxs[STAT_MOST]);
+	fprintf(f, "  \"max_rss_kb_total\": %g\n}\n", rss_total);
+	fflush(f);
+	if(!to_stdout && !to_stderr){
+		fclose(f);
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef PROFILER_H__
+#define PROFILER_H__
+
+#include <time.h>
+#include "trace.h"
+
+struct transport;
+
+//
+//  per-phase step profiler
+//
+//  The step loop is a sequence of phases; profile_mark() charges the time
+//  since the previous mark to one phase, so each phase costs one clock read.
+//
+
+enum profile_phase{
+	PHASE_FORCE,
+	PHASE_MOVE,
+	PHASE_COMPACT,
+	PHASE_ARRIVALS,
+	PHASE_GATHER,
+	PHASE_SAVE,
+	PHASE_BALANCE,
+	PHASE_GHOST,
+	PHASE_EXCHANGE,
+	PHASE_BARRIER,
+	NUM_PHASES
+};
+
+extern const char *phase_names[NUM_PHASES];
+
+struct profiler{
+	double phase_time[NUM_PHASES];
+	double last_mark;
+	int steps;
+	// agents owned at the start of each step
+	long agent_steps;
+	int min_agents;
+	int max_agents;
+	long bytes_sent;
+	long messages_sent;
+	// timeline of the marks, NULL unless tracing
+	struct tracer *trace;
+};
+
+inline double monotonic_time(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + 1.0e-9 * now.tv_nsec;
+}
+
+void profile_init( struct profiler *prof );
+
+// start of a step owning `agents` agents
+void profile_step( struct profiler *prof, int agents );
+
+inline void profile_mark( struct profiler *prof, int phase ){
+	double now = monotonic_time();
+	prof->phase_time[phase] += now - prof->last_mark;
+	if(prof->trace){
+		trace_record(prof->trace, phase, prof->steps - 1, prof->last_mark, now);
+	}
+	prof->last_mark = now;
+}
+
+inline void profile_sent( struct profiler *prof, long bytes, int messages ){
+	prof->bytes_sent += bytes;
+	prof->messages_sent += messages;
+}
+
+// Collective over the transport: min/mean/max across ranks and imbalance
+// (max/mean) per phase. Rank 0 prints a table to stderr and, if filename is
+// not NULL, writes JSON to it ("stdout", "stderr" or a path).
+void report_profile( const char *filename, struct profiler *prof, double simulation_time, struct transport *t );
+
+#endif
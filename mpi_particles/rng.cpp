@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "common.h"
+#include "rng.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+void philox4x32( const uint32_t counter[4], const uint32_t key[2], uint32_t out[4] ){
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for(int round = 0; round < PHILOX_ROUNDS; round++){
+		uint64_t p0 = (uint64_t) PHILOX_M0 * c0;
+		uint64_t p1 = (uint64_t) PHILOX_M1 * c2;
+
+		uint32_t n0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+		uint32_t n2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+		c1 = (uint32_t) p1;
+		c3 = (uint32_t) p0;
+		c0 = n0;
+		c2 = n2;
+
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+// 53 random bits from two words
+static inline double to_unit(uint32_t a, uint32_t b){
+	return ((a >> 5) * 67108864.0 + (b >> 6)) * (1.0 / 9007199254740992.0);
+}
+
+void rng_uniforms( uint64_t seed, uint32_t agent, uint32_t purpose, double *out, int n ){
+	uint32_t key[2] = {(uint32_t) seed, (uint32_t) (seed >> 32)};
+	uint32_t counter[4] = {agent, purpose, 0, 0};
+	uint32_t block[4];
+
+	// each block of four words gives two doubles
+	for(int i = 0; i < n; i += 2){
+		counter[2] = i / 2;
+		philox4x32(counter, key, block);
+		out[i] = to_unit(block[0], block[1]);
+		if(i + 1 < n){
+			out[i + 1] = to_unit(block[2], block[3]);
+		}
+	}
+}
+
+uint64_t read_seed( int argc, char **argv ){
+	char *seed_arg = read_string( argc, argv, "--seed", NULL );
+	if(seed_arg){
+		return strtoull(seed_arg, NULL, 0);
+	}
+	return (uint64_t) time( NULL );
+}
@@ -0,0 +1,33 @@
+#ifndef RNG_H__
+#define RNG_H__
+
+#include <stdint.h>
+
+//
+//  counter-based random numbers (Philox4x32-10)
+//
+//  Every number is a pure function of (seed, agent id, purpose, draw), so
+//  no generator state is shared between agents, ranks or threads and the
+//  same seed gives the same agents whatever the rank count.
+//
+
+// what a stream of draws is used for, so streams never overlap
+enum rng_purpose{
+	RNG_SPAWN = 1,
+	RNG_VELOCITY = 2,
+	RNG_COLOR = 3,
+	// synthetic maps and probe points (microbench)
+	RNG_SYNTHETIC = 4,
+	// who breaks the rules in a scenario variant
+	RNG_RULES = 5
+};
+
+void philox4x32( const uint32_t counter[4], const uint32_t key[2], uint32_t out[4] );
+
+// fills out[0..n) with uniform doubles in [0,1) for one agent and purpose
+void rng_uniforms( uint64_t seed, uint32_t agent, uint32_t purpose, double *out, int n );
+
+// --seed argument, or the time when absent
+uint64_t read_seed( int argc, char **argv );
+
+#endif
@@ -2,17 +2,45 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <signal.h>
 #include "common.h"
 #include "gl.h"
+#include "rng.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "trace.h"
+#include "transport.h"
+#include "pool.h"
+#include "tiles.h"
+#include "balance.h"
+#include "output.h"
+#include "checkpoint.h"
+#include "scenario.h"
+#include "ensemble.h"
+#include "hallway.h"
+#include "jam.h"
+#include <unistd.h>
+#include <sys/wait.h>
 #include <thread>
 #include <chrono>
 
 #define TIMESTAMPS 10000
 
-#define SEND_INITIAL_PARTICLE_COUNT 100
-#define SEND_INITIAL_PARTICLES 101
+#define GHOST_DIRECTIONS 8
+// --balance moves tiles off ranks carrying more than this times the mean load
+#define BALANCE_TOLERANCE 1.1
 
-#define GHOST_ZONE_PADDING 0.1
+// SIGUSR1 asks for a checkpoint, SIGTERM for one and then to stop; ranks
+// agree on them at the next exchange
+static volatile sig_atomic_t checkpoint_requests = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_checkpoint( int signum ){
+	checkpoint_requests++;
+	if(signum == SIGTERM){
+		stop_requested = 1;
+	}
+}
 
 void usage(){
 	printf( "Example run: mpirun -np 4 ./run -p 20 -o stdout | ./run -i stdin\n\n");
@@ -26,6 +54,44 @@ void usage(){
 	printf( "-x <filename>	           : Load particle starting configuration.\n");
 	printf( "-y <agents number>        : Number of agents in the -p file.\n");
 	printf( "-r <random agents number> : Number of additional random agents to generate (default 2 if no -y arg).\n");
+	printf( "--spawn-region <x0,y0,x1,y1> : Only place random agents inside this rectangle (map coords, 0 to 1).\n");
+	printf( "--spawn-component <x,y>   : Only place random agents in the walkable area connected to this point.\n");
+	printf( "--metrics <filename>      : Write arrival-time, path-length and per-exit throughput metrics as JSON at the end (can be \"stdout\" or \"stderr\"). Works with -o none.\n");
+	printf( "--profile [filename]      : Time each phase of the step loop and report min/mean/max across ranks and imbalance on stderr, plus JSON to [filename] if given (can be \"stdout\" or \"stderr\").\n");
+	printf( "--trace <filename>        : Record every rank's step phases and write a Chrome trace (chrome://tracing, ui.perfetto.dev) at the end.\n");
+	printf( "--trace-events <int>      : Events kept per rank for --trace, oldest are dropped first (default 65536).\n");
+	printf( "--seed <int>              : Seed for the initial conditions, default is the time. Same seed gives the same agents on any number of cores.\n");
+	printf( "--threads <int>           : Run the subdivisions as this many threads of one process instead of MPI ranks (power of 4, no mpirun needed).\n");
+	printf( "--placement <node|row>    : Subdivisions for the ranks of one node as a compact block along a Hilbert curve (default), or row-major in rank order.\n");
+	printf( "--ranks-per-node <int>    : Plan placement as if every <int> consecutive ranks shared a node, instead of asking MPI.\n");
+	printf( "--shm                     : MPI ranks on one node share the map and initial agents in MPI shared-memory windows and pass ghosts through them instead of messages.\n");
+	printf( "--rma <fence|pscw>        : Put ghosts into one-sided MPI windows on the neighbouring ranks instead of sending messages, synchronized by fences over all ranks or post/start/complete/wait over the neighbours.\n");
+	printf( "--workers <int>           : Threads per rank for forces, movement and ghost classification, spread over tiles with work stealing (default 1).\n");
+	printf( "--tile-cells <int>        : Map cells per tile side; default is the fewest that span the interaction cutoff.\n");
+	printf( "--balance <int>           : Own the map by tiles instead of one rectangle per rank and move tiles between ranks every <int> steps to even out agents per rank (default 0, off).\n");
+	printf( "--balance-tiles <int>     : Ownership tiles per side of the map for --balance (default 8 per subdivision side).\n");
+	printf( "--halo-steps <int>        : Exchange ghosts every <int> steps through a halo wide enough to stay exact that long, moving ghosts locally in between (default 1).\n");
+	printf( "--frames-in-flight <int>  : Output frames still being gathered to rank 0 while later steps run; a step waits once this many are (default 4).\n");
+	printf( "--checkpoint <filename>   : Write the whole run to this file with MPI-IO after every --checkpoint-every steps, on SIGUSR1, and on SIGTERM before stopping.\n");
+	printf( "--checkpoint-every <int>  : Steps between checkpoints (default 0, only on a signal).\n");
+	printf( "--restart <filename>      : Carry on from a checkpoint, on any number of ranks; needs the same map and agent counts. -t still counts from step 0.\n");
+	printf( "--jam-window <int>        : Stop early, as jammed, once no goal seeker still walking got a map cell closer to its goal in this many steps, and report where they are stuck (default 0, off).\n");
+	printf( "--emergency <int>         : At this step every agent without a goal heads for the nearest exit (the goals of the -p agents).\n");
+	printf( "--block <x0,y0,x1,y1>     : Wall off the map cells in this rectangle (map coords); agents standing there move to the nearest walkable cell.\n");
+	printf( "--rule-breakers <float>   : Fraction of the agents that push through others instead of being repelled.\n");
+	printf( "--variants <filename>     : Run every variant in the file (a name, then any of the three options above, -t and --metrics; <name>.json by default) from one warm state, in parallel groups of ranks or, with --threads, forked processes.\n");
+	printf( "--warmup <int>            : For --variants without --restart, run this many steps first and checkpoint them to --checkpoint.\n");
+	printf( "--jobs <filename>         : Run every job in the file (a name, then options overriding these, such as -c, -r, --seed, -t and --metrics) as a run of its own, groups of ranks taking jobs from a shared queue.\n");
+	printf( "--group-size <int>        : Ranks per --jobs group, a power of 4 (default 1).\n");
+	printf( "--table <filename>        : Also write the --jobs or --optimize results as CSV.\n");
+	printf( "--optimize                : Find the hallway width and door position that get the -r agents out of a room soonest, by successive halving up to -t steps.\n");
+	printf( "--hallway-widths <min,max>: For --optimize, hallway widths in cells to try (default 1,8).\n");
+	printf( "--doors <list>            : For --optimize, comma-separated door positions along the wall, 0 to 1 (default 0.5).\n");
+	printf( "--map-size <int>          : For --optimize, cells per side of each candidate map (default 64).\n");
+	printf( "--hallway-length <int>    : For --optimize, thickness of the wall the hallway crosses, in cells (default 4).\n");
+	printf( "--eta <int>               : For --optimize, each round keeps the best 1/eta of the hallways and runs them eta times longer (default 3).\n");
+	printf( "--best-map <filename>     : For --optimize, write the winning hallway map.\n");
+	printf( "--halo-check              : Count interactions the halo missed: agents that arrive within the cutoff of a rank's own agents without having been held (debugging).\n");
 
 	printf( "\nOptions for OpenGL Visualizer:\n");
 	printf( "-s <int>      : Frame skip, skips <int> frames every draw. Will speed up simulation visualization.\n");
@@ -36,84 +102,10 @@ void usage(){
 	printf( "-c <filename> : Use map config, defaults to map.cfg (plain old square). Visualizer uses this to draw walls around points.\n");
 	
 	printf("\n\nEither -o (simulator) or -i (visualizer) must be set.\n");
-	printf("\n\nSimulator requires power-of-4 cores (1, 4, 16, etc) for area subdivision.\n");
-	
-}
-
-void read_map(FILE *fp, struct map *map_cfg){
-	char * line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    
-    short temp_str_len = 50;
-    char first_term[temp_str_len];
-	char first_letter[temp_str_len];
-	memset(&first_letter, 0, temp_str_len);
-    
-    if(fp == NULL){
-        fprintf(stderr, "%s Error reading file.\n", MPI_PREPEND);
-        exit(1);
-    }
+	printf("\n\nSimulator requires power-of-4 cores or --threads (1, 4, 16, etc) for area subdivision.\n");
 	
-	map_cfg->height = 0;
-	map_cfg->width = 0;
-	map_cfg->data = NULL;
-	unsigned int cells_read = 0;
-	unsigned int cells_rows = 0;
-	char cell;
-
-	while((read = getline(&line, &len, fp)) != -1){
-        first_term[0] = 0;
-		first_letter[0] = 0;
-		
-        sscanf(line, "%s", first_term);
-		
-		sscanf(line, "%c", first_letter);
-		
-        if(str_equals("h",first_letter)){
-            sscanf(line, "h %u\n", &map_cfg->height);
-			fprintf(stderr,"%s map height: %u\n",MPI_PREPEND, map_cfg->height);
-			
-		}else if(str_equals("w",first_letter)){
-            sscanf(line, "w %u\n", &map_cfg->width);
-			fprintf(stderr,"%s map width: %u\n",MPI_PREPEND, map_cfg->width);
-			
-		}else{
-			
-			for(int i=0; i < map_cfg->width; i++){
-				sscanf(&line[i], "%c", &cell);
-				map_cfg->data[cells_read] = (unsigned short) (cell - '0');
-				//printf("read cell %i, %c, %u\n", i, cell, map_cfg->data[cells_read]);
-				cells_read++;
-				//fprintf(stderr,"goal: row[%u] col[%u]\n",cells_rows,i);
-				int check = (int)(cell - '0');
-				//printf("---result: %u\n", check);
-
-				if (check == (int) 3) {
-					map_cfg->goal_col = i;
-  					map_cfg->goal_row = cells_rows;
-
-  					fprintf(stderr,"goal: row[%u] col[%u]\n",cells_rows,i);
-				}
-			}
-
-			//fprintf(stderr,"cell rows: %u\n",cells_rows);
-			cells_rows++;
-		}
-
-		// should only run this once, then it mallocs.
-		if(!map_cfg->data && map_cfg->height > 0 && map_cfg->width > 0){
-			map_cfg->data = (unsigned short *) malloc (map_cfg->height * map_cfg->width * sizeof(unsigned short));
-			if(!map_cfg->data){
-				fprintf(stderr, "%s Couldn't malloc for map config\n", MPI_PREPEND);
-				exit(1);
-			}
-			memset(map_cfg->data, 0, map_cfg->height * map_cfg->width * sizeof(unsigned short));
-		}
-	}
 }
 
-
 bool isPowerOfFour(int n){
 	// borrowed from http://www.geeksforgeeks.org/find-whether-a-given-number-is-a-power-of-4-or-not/
 	if(n == 0){
@@ -128,6 +120,110 @@ bool isPowerOfFour(int n){
 	return 1;
 }
 
+//
+//  one square subdivision of the unit square per rank, printed as rank@node
+//
+static void lay_out_subdivisions( int n_proc, const int *node_of, bool row_major, struct subdivision *areas ){
+	// calculate subdivisions for processing of specific areas
+	int sqrt_proc = sqrt(n_proc);
+	double range = 1.0 / sqrt_proc; // this makes it easy with 4 cores, just keep making squares (rectangles aren't AS easy)
+	// ranks of a node get neighbouring subdivisions
+	int cell_rank[n_proc];
+	int nodes = place_subdivisions(sqrt_proc, node_of, cell_rank);
+	if(row_major){
+		for(int cell = 0; cell < n_proc; cell++){
+			cell_rank[cell] = cell;
+		}
+	}
+	fprintf(stderr, "%s layout (rank@node): \n", MPI_PREPEND);
+	for(int row = 0; row < sqrt_proc; row++){
+		
+		for(int col = 0; col < sqrt_proc; col++){
+			
+			int core = cell_rank[row * sqrt_proc + col];
+			areas[core].min_x = col * range;
+			areas[core].max_x = col * range + range;
+			areas[core].min_y = row * range;
+			areas[core].max_y = row * range + range;
+			
+			fprintf(stderr, "\t%i@%i", core, node_of[core]);
+		}
+		fprintf(stderr, "\n");
+	}
+	
+	// neighbouring subdivisions, diagonals included, on different nodes
+	int pairs = 0, split = 0;
+	for(int cell = 0; cell < n_proc; cell++){
+		int row = cell / sqrt_proc, col = cell % sqrt_proc;
+		for(int other = cell + 1; other < n_proc; other++){
+			if(abs(other / sqrt_proc - row) <= 1 && abs(other % sqrt_proc - col) <= 1){
+				pairs++;
+				split += node_of[cell_rank[cell]] != node_of[cell_rank[other]];
+			}
+		}
+	}
+	fprintf(stderr, "%s %s placement over %i nodes: %i of %i neighbouring subdivision pairs cross nodes\n", MPI_PREPEND,
+		row_major || nodes <= 1 ? "row-major" : "node-blocked", nodes, split, pairs);
+	
+}
+
+//
+//  how a run went, filled in by its rank 0 when asked for
+//
+struct run_result{
+	int steps;
+	double simulation_time;
+	int goal_seekers;
+	int arrived;
+	// every goal seeker arrived, so steps is the completion time
+	bool completed;
+	// every goal seeker left had stalled, so the run stopped early
+	bool jammed;
+};
+
+//
+//  What every rank starts from. Built once per process and only read
+//  afterwards, so thread ranks share one copy of the map and the agents.
+//
+struct run_setup{
+	int argc;
+	char **argv;
+	struct map map_cfg;
+	struct subdivision *areas;
+	// lowest rank on the node of each rank
+	int *node_of;
+	int num_particles;
+	int special_agents_count;
+	double (*agents)[4];
+	// initial state of every agent, each rank keeps its own
+	particle_t *particles;
+	uint64_t seed;
+	// goals of the goal-seeking agents, one per exit
+	double (*exits)[2];
+	int n_exits;
+	char *savename;
+	bool benchmark_only;
+	bool write_to_stdout;
+	int timesteps;
+	// checkpoints and metrics, which each variant has its own of
+	char *checkpoint_file;
+	int checkpoint_every;
+	char *restart_file;
+	// the step the restart checkpoint must be at, -1 for any
+	int restart_step;
+	char *metrics_file;
+	// of the map as read, before any --block
+	uint64_t map_hash;
+	struct scenario_change change;
+	// NULL unless the caller wants to know how the run went
+	struct run_result *result;
+};
+
+int simulate( struct transport *t, void *arg );
+int run_variants( struct run_setup *setup, char *variants_file, int threads, struct transport *world );
+int run_ensemble( struct run_setup *setup, char *jobs_file, int threads, struct transport *world );
+int run_optimize( struct run_setup *setup, int threads, struct transport *world );
+
 int main( int argc, char **argv ){
 
     if( find_option( argc, argv, "-h" ) >= 0 ){
@@ -136,12 +232,25 @@ int main( int argc, char **argv ){
     }
 	
 	//
-    //  set up MPI
+    //  set up MPI, or the threads standing in for its ranks
     //
     int n_proc, rank;
-    MPI_Init( &argc, &argv );
-    MPI_Comm_size( MPI_COMM_WORLD, &n_proc );
-    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+	int threads = read_int( argc, argv, "--threads", 0 );
+	struct transport world;
+	if(threads > 0){
+		n_proc = threads;
+		rank = 0;
+	}else{
+		MPI_Init( &argc, &argv );
+		transport_mpi_init( &world, MPI_COMM_WORLD );
+		n_proc = world.n_proc;
+		rank = world.rank;
+	}
+	// MPI ranks get what rank 0 reads broadcast, thread ranks share it
+	bool broadcast = threads == 0;
+	// MPI ranks of a node share one copy of the map and initial agents
+	bool node_shared = broadcast && find_option( argc, argv, "--shm" ) >= 0;
+	bool node_leader = true;
 	
     char *input_file = NULL;
 	if(find_option(argc, argv, "-i") >= 0){
@@ -178,8 +287,10 @@ int main( int argc, char **argv ){
 
 		}
 		
-		MPI_Barrier(MPI_COMM_WORLD);
-		MPI_Finalize();
+		if(broadcast){
+			transport_barrier(&world);
+			transport_finalize(&world);
+		}
 		return 0;
 	}
 	
@@ -188,6 +299,18 @@ int main( int argc, char **argv ){
 	struct subdivision *areas = (struct subdivision *) malloc(n_proc * sizeof(struct subdivision));
 	memset(areas, 0, n_proc * sizeof(struct subdivision));
 	
+	// which node each rank is on, so neighbouring subdivisions can share one
+	int *node_of = (int *) calloc(n_proc, sizeof(int));
+	int ranks_per_node = read_int( argc, argv, "--ranks-per-node", 0 );
+	if(ranks_per_node > 0){
+		for(int r = 0; r < n_proc; r++){
+			node_of[r] = r / ranks_per_node * ranks_per_node;
+		}
+	}else if(broadcast){
+		transport_node_of(&world, node_of);
+	}
+	bool row_major = str_equals(read_string( argc, argv, "--placement", (char *) "node" ), (char *) "row");
+	
 	if(rank == 0){
 		if(!isPowerOfFour(n_proc)){
 			fprintf(stderr, "Must use a power-of-four number of cores (1, 4, 16, etc) for subdivision\n");
@@ -195,25 +318,7 @@ int main( int argc, char **argv ){
 			exit(0);
 		}
 		
-		// calculate subdivisions for processing of specific areas
-		int sqrt_proc = sqrt(n_proc);
-		double range = 1.0 / sqrt_proc; // this makes it easy with 4 cores, just keep making squares (rectangles aren't AS easy)
-		int core = 0;
-		fprintf(stderr, "%s layout: \n", MPI_PREPEND);
-		for(int row = 0; row < sqrt_proc; row++){
-			
-			for(int col = 0; col < sqrt_proc; col++){
-				
-				areas[core].min_x = col * range;
-				areas[core].max_x = col * range + range;
-				areas[core].min_y = row * range;
-				areas[core].max_y = row * range + range;
-				
-				fprintf(stderr, "\t%i", core);
-				core++;
-			}
-			fprintf(stderr, "\n");
-		}
+		lay_out_subdivisions(n_proc, node_of, row_major, areas);
 		
 		// tests
 		
@@ -234,10 +339,9 @@ int main( int argc, char **argv ){
 	}
 	
 	//MPI_Scatter(areas, 4, MPI_DOUBLE, &my_area, 4, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-	MPI_Bcast(areas, 4 * n_proc, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-	
-	struct subdivision *my_area = &(areas[rank]);
-	fprintf(stderr, "%s Assigning rank %i to (%lf, %lf), (%lf, %lf)\n",MPI_PREPEND, rank, my_area->min_x, my_area->min_y, my_area->max_x, my_area->max_y);
+	if(broadcast){
+		transport_bcast(&world, areas, n_proc * sizeof(struct subdivision), 0);
+	}
 	
 //	MPI_Barrier(MPI_COMM_WORLD);
 	
@@ -323,35 +427,33 @@ int main( int argc, char **argv ){
 	if(rank == 0){
 		fprintf(stderr, "%s Drawing %u timesteps\n",MPI_PREPEND, timesteps);
 	}
-    particle_t *particles = (particle_t*) malloc( num_particles * sizeof(particle_t) );
+    particle_t *particles = node_shared ? (particle_t *) transport_node_alloc(&world, (long) num_particles * sizeof(particle_t), &node_leader)
+		: (particle_t*) malloc( num_particles * sizeof(particle_t) );
 	
-	MPI_Bcast(&map_cfg.height, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD );
-	MPI_Bcast(&map_cfg.width, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD );
-	
-	if(rank > 0 && map_cfg.height > 0 && map_cfg.width > 0){
-		map_cfg.data = (unsigned short *) malloc (map_cfg.height * map_cfg.width * sizeof(unsigned short));
+	if(broadcast){
+		transport_bcast(&world, &map_cfg.height, sizeof(unsigned int), 0);
+		transport_bcast(&world, &map_cfg.width, sizeof(unsigned int), 0);
 	}
 	
-	if(map_cfg.height > 0 && map_cfg.width > 0){
-		MPI_Bcast(map_cfg.data, map_cfg.height * map_cfg.width, MPI_UNSIGNED_SHORT, 0, MPI_COMM_WORLD);
+	long map_bytes = (long) map_cfg.height * map_cfg.width * sizeof(unsigned short);
+	if(node_shared && map_bytes > 0){
+		unsigned short *read_data = map_cfg.data;
+		map_cfg.data = (unsigned short *) transport_node_alloc(&world, map_bytes, &node_leader);
+		if(rank == 0){
+			memcpy(map_cfg.data, read_data, map_bytes);
+			free(read_data);
+		}
+		transport_node_bcast(&world, map_cfg.data, map_bytes);
+	}else{
+		if(rank > 0 && map_bytes > 0){
+			map_cfg.data = (unsigned short *) malloc (map_bytes);
+		}
+		
+		if(broadcast && map_bytes > 0){
+			transport_bcast(&world, map_cfg.data, map_bytes, 0);
+		}
 	}
 	
-	
-
-	//
-	//  allocate generic resources
-	//
-
-	MPI_Datatype PARTICLE;
-	int ints_per_particle = sizeof(particle_t) / sizeof(int);
-	MPI_Type_contiguous( ints_per_particle, MPI_INT, &PARTICLE );
-	MPI_Type_commit( &PARTICLE );
-	
-	MPI_Datatype MIN_PARTICLE;
-	int ints_per_min_particle = sizeof(struct minimum_particle) / sizeof(int);
-	MPI_Type_contiguous( ints_per_min_particle, MPI_INT, &MIN_PARTICLE );
-	MPI_Type_commit( &MIN_PARTICLE );
-
 	//
 	//  set up the data partitioning across processors
 	//
@@ -365,303 +467,1921 @@ int main( int argc, char **argv ){
 	//  initialize and distribute the particles
 	//
 	set_size( num_particles, &map_cfg );
-	int local_count;
-	MPI_Status status;
-	particle_t *local = NULL;
-	int counts[n_proc], offsets[n_proc];
 	
-	if( rank == 0 ){
-		init_particles( num_particles, special_agents_count, agents, particles, &map_cfg );
-		
-		particle_t *batches[n_proc];
-		// figure out what particles belong to what cores
-		for(int i = 0; i < n_proc; i++){
-			// making room for enough for each core to receive ALL particles. Definitely overshooting, but it'll work later on when things are shared
-			batches[i] = (particle_t *) malloc(num_particles * sizeof(particle_t));
-			counts[i] = 0;
-		}
-		int index;
-		particle_t *particle;
-		for(int i = 0; i < num_particles; i++){
-			particle = &particles[i];
-			index = rank_for_location(particle->x, particle->y, n_proc, areas);
-			memcpy(&batches[index][counts[index]], particle, sizeof(particle_t));
-			
-			//fprintf(stderr,"%s Assigned particle at (%lf,%lf) to core %i\n", MPI_PREPEND,batches[index][counts[index]].x,batches[index][counts[index]].y,index );
-			counts[index]++;
-		}
-		
-		// now batches[i] holds array of counts[i] particles
-		
-		// as rank 0, just point locals pointer to array directly. done.
-		local_count = counts[0];
-		local = batches[0];
-		
-		for(int i = 1; i < n_proc; i++){
-			
-			MPI_Send(&counts[i], 1, MPI_INT, i, SEND_INITIAL_PARTICLE_COUNT, MPI_COMM_WORLD);
-			MPI_Send(batches[i], counts[i], PARTICLE, i, SEND_INITIAL_PARTICLES, MPI_COMM_WORLD);
-			
-		}
-		
-	}else{
-		MPI_Recv(&local_count, 1, MPI_INT, 0, SEND_INITIAL_PARTICLE_COUNT, MPI_COMM_WORLD, &status);
-		local = (particle_t*) malloc( num_particles * sizeof(particle_t) );
-		
-		MPI_Recv(local, local_count, PARTICLE, 0, SEND_INITIAL_PARTICLES, MPI_COMM_WORLD, &status);
+	// every rank builds the same initial conditions from the seed and keeps
+	// its own agents, so nothing depends on the number of ranks; without
+	// --seed that is rank 0's clock, since ranks may not start in the same
+	// second or agree on the time
+	uint64_t seed = read_seed( argc, argv );
+	if(broadcast){
+		transport_bcast(&world, &seed, sizeof(uint64_t), 0);
+	}
+	if(rank == 0){
+		fprintf(stderr, "%s seed: %llu\n", MPI_PREPEND, (unsigned long long) seed);
+	}
+	if(broadcast && special_agents_count > 0){
+		transport_bcast(&world, agents, special_agents_count * 4 * sizeof(double), 0);
 	}
 	
-	fprintf(stderr, "%s Rank %i got %i particles out of %i\n", MPI_PREPEND, rank, local_count, num_particles);
-	if(local_count > 0){
-		fprintf(stderr, "%s Rank %i point 0: (%lf, %lf) (of %i)\n", MPI_PREPEND, rank, local[0].x, local[0].y, local_count);
+	// index the walkable area random agents may be placed on
+	struct subdivision spawn_region = {0.0, 0.0, 1.0, 1.0};
+	double component_x = -1.0, component_y = -1.0;
+	char *spawn_arg = read_string( argc, argv, "--spawn-region", NULL );
+	if(spawn_arg && sscanf(spawn_arg, "%lf,%lf,%lf,%lf", &spawn_region.min_x, &spawn_region.min_y, &spawn_region.max_x, &spawn_region.max_y) != 4){
+		fprintf(stderr, "--spawn-region expects x0,y0,x1,y1\n");
+		exit(1);
+	}
+	spawn_arg = read_string( argc, argv, "--spawn-component", NULL );
+	if(spawn_arg && sscanf(spawn_arg, "%lf,%lf", &component_x, &component_y) != 2){
+		fprintf(stderr, "--spawn-component expects x,y\n");
+		exit(1);
 	}
 	
+	struct walkable_index spawn;
+	if(build_walkable_index(&spawn, &map_cfg, &spawn_region, component_x, component_y) == 0 && num_random_particles > 0){
+		fprintf(stderr, "%s No walkable cells to place random agents in\n", MPI_PREPEND);
+		exit(1);
+	}
+	if(rank == 0){
+		fprintf(stderr, "%s %u walkable spawn cells\n", MPI_PREPEND, spawn.count);
+	}
 	
+	if(node_leader){
+		init_particles( num_particles, special_agents_count, agents, particles, &map_cfg, &spawn, seed );
+	}
+	if(node_shared){
+		transport_node_sync(&world);
+		// ghosts for ranks on this node go through shared outboxes
+		transport_node_exchange(&world, num_particles);
+		if(rank == 0){
+			fprintf(stderr, "%s sharing map, agents and ghosts between the %i ranks of each node\n", MPI_PREPEND, transport_node_size(&world));
+		}
+	}
+	free_walkable_index(&spawn);
 	
+	double (*exits)[2] = (double (*)[2]) malloc((special_agents_count > 0 ? special_agents_count : 1) * sizeof(double[2]));
+	int n_exits = build_exits(special_agents_count, agents, &map_cfg, exits);
 	
-	bool first = true;
-	GLFWwindow *win = NULL;
-	//Textures *tex;
-	unsigned int *sphere_draw_ids;
-	Vec<3> *points;
-	Vec<3> *last_points;
+	struct scenario_change change;
+	if(!read_scenario_change(argc, argv, &change)){
+		exit(1);
+	}
 	
-	double radius = 15;
-	double now = glfwGetTime();
+	struct run_setup setup = {argc, argv, map_cfg, areas, node_of, num_particles, special_agents_count, agents, particles, seed,
+		exits, n_exits, savename, benchmark_only, write_to_stdout, timesteps,
+		read_string( argc, argv, "--checkpoint", NULL ), read_int( argc, argv, "--checkpoint-every", 0 ),
+		read_string( argc, argv, "--restart", NULL ), -1, read_string( argc, argv, "--metrics", NULL ),
+		checkpoint_map_hash( &map_cfg ), change, NULL};
 	
-	FILE *fsave = benchmark_only ? NULL : (savename && rank == 0 ? (write_to_stdout ? stdout : fopen( savename, "w" )) : NULL);
+	// first call starts the clock; do it before there are threads
+	read_timer( );
 	
-    //
-    //  simulate a number of time steps
-    //
-    double simulation_time = read_timer( );
-	struct minimum_particle *minimum_particles = (struct minimum_particle *) malloc (num_particles * sizeof(struct minimum_particle));
+	if(find_option( argc, argv, "--checkpoint" ) >= 0){
+		signal(SIGUSR1, request_checkpoint);
+		signal(SIGTERM, request_checkpoint);
+	}
 	
-	int nearby_core;
-	int t, temp;
-	particle_t *local_temp = (particle_t *) malloc (num_particles * sizeof(particle_t));
-	particle_t *another_temp;
+	int result;
+	char *variants_file = read_string( argc, argv, "--variants", NULL );
+	char *jobs_file = read_string( argc, argv, "--jobs", NULL );
+	if(variants_file){
+		result = run_variants( &setup, variants_file, threads, broadcast ? &world : NULL );
+	}else if(jobs_file){
+		result = run_ensemble( &setup, jobs_file, threads, broadcast ? &world : NULL );
+	}else if(find_option( argc, argv, "--optimize" ) >= 0){
+		result = run_optimize( &setup, threads, broadcast ? &world : NULL );
+	}else if(threads > 0){
+		result = transport_threads_run( threads, simulate, &setup );
+	}else{
+		result = simulate( &world, &setup );
+	}
 	
-	int num_directions = 8;  // up, down, left, right, upleft, upright, downleft, downright
-	int directions[num_directions];
-	memset(directions, -1, num_directions);
+    //
+    //  release resources
+    //
 	
-	particle_t *to_send[n_proc];
-	int to_send_counts[n_proc];
-	for(int i = 0; i < n_proc; i++){
-		to_send[i] = NULL;
-		to_send_counts[i] = 0;
+	// node blocks go with the transport
+	if(map_cfg.data && !node_shared){
+		free(map_cfg.data);
 	}
 	
+	if(!node_shared){
+		free( particles );
+	}
+	free( areas );
+	free( node_of );
+	free( exits );
 	
-    for( int step = 0; !timesteps || step < timesteps; step++ ){
-		
-		//
-		//  compute all forces
-		//
-		for( int i = 0; i < local_count; i++ ){
-			local[i].ax = local[i].ay = 0;
-		}
-		for( int i = 0; i < local_count-1; i++ ){
-			for (int j = i+1; j < local_count; j++ ){
-				//fprintf(stderr,"%s rank %i computing between %i and %i of %i\n", MPI_PREPEND, rank, i, j, local_count);
-				apply_force( local[i], local[j] );
+	if(broadcast){
+		transport_finalize( &world );
+	}
+    
+    return result;
+}
+
+// keeps a rectangle clipped to an area's exclusive edge out of the next cell
+#define AREA_EDGE_INSET 1e-9
+
+// largest stuck regions listed when a run jams
+#define JAM_REPORTED_REGIONS 10
+
+//
+//  whether rank `to` owns walkable map within halo of (x, y). Subdivision
+//  edges often run through solid wall, and agents can neither feel nor
+//  reach anyone on the far side of it.
+//
+static bool reaches_walkable( struct walkable_sum *walkable, struct tile_owners *owners, struct subdivision *areas, int to, double x, double y, double halo ){
+	double min_x = x - halo, min_y = y - halo, max_x = x + halo, max_y = y + halo;
+	if(!owners){
+		struct subdivision *area = &areas[to];
+		return walkable_in_rect(walkable, MAX(min_x, area->min_x), MAX(min_y, area->min_y),
+			MIN(max_x, area->max_x - AREA_EDGE_INSET), MIN(max_y, area->max_y - AREA_EDGE_INSET)) > 0;
+	}
+	int first = owner_tile(owners, min_x, min_y), last = owner_tile(owners, max_x, max_y);
+	for(int row = first / owners->per_side; row <= last / owners->per_side; row++){
+		for(int col = first % owners->per_side; col <= last % owners->per_side; col++){
+			if(owners->owner[row * owners->per_side + col] != to){
+				continue;
 			}
-		}
-		
-		// compute forces against nearby ghost zones
-		
-		
-		
-		//
-		//  move particles
-		//
-		t = 0;
-		//fprintf(stderr, "%s rank %i starting with local_count at %i\n", MPI_PREPEND, rank, local_count);
-		for( int i = 0; i < local_count; i++ ){
-			move( local[i], &map_cfg );
-			
-			// check if this core should forget about this particle now.
-			temp = rank_for_location(local[i].x, local[i].y, n_proc, areas);
-			if(temp != rank){
-				//fprintf(stderr,"%s rank %i forgot particle %i, at (%lf, %lf)\n", MPI_PREPEND, rank, i, local[i].x,local[i].y);
-			}else{
-				memcpy(&local_temp[t], &local[i], sizeof(particle_t));
-				t++;
+			double tile_x = col * owners->tile_size, tile_y = row * owners->tile_size;
+			if(walkable_in_rect(walkable, MAX(min_x, tile_x), MAX(min_y, tile_y),
+				MIN(max_x, tile_x + owners->tile_size - AREA_EDGE_INSET), MIN(max_y, tile_y + owners->tile_size - AREA_EDGE_INSET)) > 0){
+				return true;
 			}
 		}
-		
-		//swap pointers, since we now have a condensed local_temp list of things to care about (no extra mallocing)
-		another_temp = local;
-		local = local_temp;
-		local_temp = another_temp;
-		
-		local_count = t;
-		for(int i = 0; i < local_count; i++){
-			minimum_particles[i].x = local[i].x;
-			minimum_particles[i].y = local[i].y;
-			minimum_particles[i].color_r = local[i].color_r;
-			minimum_particles[i].color_g = local[i].color_g;
-			minimum_particles[i].color_b = local[i].color_b;
+	}
+	return false;
+}
+
+// subdivisions within halo of ours: the only ranks we ever send to
+static int halo_neighbors( int rank, int n_proc, struct subdivision *areas, double halo, int *neighbors ){
+	struct subdivision *mine = &areas[rank];
+	int count = 0;
+	for(int r = 0; r < n_proc; r++){
+		struct subdivision *theirs = &areas[r];
+		if(r != rank && theirs->min_x - halo < mine->max_x && mine->min_x < theirs->max_x + halo &&
+				theirs->min_y - halo < mine->max_y && mine->min_y < theirs->max_y + halo){
+			neighbors[count++] = r;
 		}
-		
-		
-		// tell root how many points each rank has
-		MPI_Gather(&local_count, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
-		
-		if(rank == 0){
-			for(int i = 0; i < n_proc; i++){
-				offsets[i] = (i == 0 ? 0 : offsets[i-1] + counts[i-1]);
-				//fprintf(stderr, "%s root says rank %i has %i mins, offset: %i\n", MPI_PREPEND, i, counts[i], offsets[i]);
-			}
+	}
+	return count;
+}
+
+//
+//  subdivisions within halo of ours that share any walkable map with it
+//  within halo; the rest are walled off and never exchange anything.
+//  Returns how many subdivisions are within halo at all.
+//
+static int walkable_neighbors( struct walkable_sum *walkable, int rank, int n_proc, struct subdivision *areas, double halo, bool *open_to ){
+	struct subdivision *mine = &areas[rank];
+	double cell = 1.0 / walkable->highest_dim;
+	int near = 0;
+	for(int r = 0; r < n_proc; r++){
+		open_to[r] = false;
+		if(r == rank){
+			continue;
 		}
-		
-		// send points to rank 0 to be written (only x,y & color)
-		MPI_Gatherv(minimum_particles, local_count, MIN_PARTICLE, minimum_particles, counts, offsets, MIN_PARTICLE, 0, MPI_COMM_WORLD);
-		
-		if(rank == 0 && !benchmark_only){
-			save( fsave, num_particles, minimum_particles, &map_cfg );
+		// the strip of our subdivision within halo of theirs
+		struct subdivision *theirs = &areas[r];
+		double min_x = MAX(mine->min_x, theirs->min_x - halo), max_x = MIN(mine->max_x, theirs->max_x + halo);
+		double min_y = MAX(mine->min_y, theirs->min_y - halo), max_y = MIN(mine->max_y, theirs->max_y + halo);
+		if(min_x >= max_x || min_y >= max_y){
+			continue;
 		}
-		
-		
-		// find particles nearby other cores:
-		bool up = false, down = false, left = false, right = false;
-		int recipient;
-		memset(to_send_counts, 0, n_proc * sizeof(int));
-		for( int i = 0; i < local_count; i++ ){
-			memset(directions, -1, num_directions * sizeof(int));
-			
-			// moving right:
-			if(my_area->max_x - local[i].x < GHOST_ZONE_PADDING){
-				right = true;
-				directions[0] = rank_for_location(local[i].x + GHOST_ZONE_PADDING, local[i].y, n_proc, areas);
-			}
-			
-			// moving left
-			if(local[i].x - my_area->min_x < GHOST_ZONE_PADDING){
-				left = true;
-				directions[1] = rank_for_location(local[i].x - GHOST_ZONE_PADDING, local[i].y, n_proc, areas);
-			}
-			
-			// moving up
-			if(my_area->max_y - local[i].y < GHOST_ZONE_PADDING){
-				up = true;
-				directions[2] = rank_for_location(local[i].x, local[i].y + GHOST_ZONE_PADDING, n_proc, areas);
-			}
-			
-			// moving down
-			if(local[i].y - my_area->min_y < GHOST_ZONE_PADDING){
-				down = true;
-				directions[3] = rank_for_location(local[i].x, local[i].y - GHOST_ZONE_PADDING, n_proc, areas);
-			}
-			
-			// moving up-right:
-			if(up && right){
-				directions[4] = rank_for_location(local[i].x + GHOST_ZONE_PADDING, local[i].y + GHOST_ZONE_PADDING, n_proc, areas);
-			}
-			
-			// moving up-left
-			if(up && left){
-				directions[5] = rank_for_location(local[i].x - GHOST_ZONE_PADDING, local[i].y + GHOST_ZONE_PADDING, n_proc, areas);
-			}
-			
-			// moving down-right:
-			if(down && right){
-				directions[6] = rank_for_location(local[i].x + GHOST_ZONE_PADDING, local[i].y - GHOST_ZONE_PADDING, n_proc, areas);
-			}
-			
-			// moving down-left
-			if(down && left){
-				directions[7] = rank_for_location(local[i].x - GHOST_ZONE_PADDING, local[i].y - GHOST_ZONE_PADDING, n_proc, areas);
-			}
-			
-			int sent_to[n_proc];
-			memset(sent_to, 0, n_proc * sizeof(int));
-			for(int j = 0; j < num_directions; j++){
-				recipient = directions[j];
-				if(recipient == -1 || recipient == rank || sent_to[recipient]){
+		near++;
+		int col0 = (int) floor(min_x / cell), col1 = (int) floor((max_x - AREA_EDGE_INSET) / cell);
+		int row0 = (int) floor(min_y / cell), row1 = (int) floor((max_y - AREA_EDGE_INSET) / cell);
+		for(int row = row0; row <= row1 && !open_to[r]; row++){
+			for(int col = col0; col <= col1 && !open_to[r]; col++){
+				double x = col * cell, y = row * cell;
+				if(walkable_in_rect(walkable, x, y, x + cell - AREA_EDGE_INSET, y + cell - AREA_EDGE_INSET) == 0){
 					continue;
 				}
-				// ensure each core only gets one copy at worst
-				sent_to[recipient] = 1;
-				
-				if(to_send[recipient] == NULL){
-					// if i CAN send to rank t, make room for stuff.
-					to_send[recipient] = (particle_t *) malloc(local_count * sizeof(particle_t));
-				}
-				//fprintf(stderr, "%s rank %i sending (%lf,%lf) direction %i to recipient %i\n", MPI_PREPEND, rank, local[i].x, local[i].y, j, recipient);
-				memcpy(&to_send[recipient][to_send_counts[recipient]], &local[i], sizeof(particle_t));
-				to_send_counts[recipient]++;
+				open_to[r] = walkable_in_rect(walkable, MAX(x - halo, theirs->min_x), MAX(y - halo, theirs->min_y),
+					MIN(x + cell + halo, theirs->max_x - AREA_EDGE_INSET), MIN(y + cell + halo, theirs->max_y - AREA_EDGE_INSET)) > 0;
 			}
 		}
-		
-		// send stuff around
-		int received = 0;
-		int to_receive[n_proc];
-		memset(to_receive, 0, n_proc * sizeof(int));
-		MPI_Request recv_request[n_proc];
-		MPI_Request particle_recv_request[n_proc];
-		for(int i = 0; i < n_proc; i++){
-			// Set up receives first, then sends
-			MPI_Irecv(&to_receive[i], 1, MPI_INT, i, SEND_INITIAL_PARTICLE_COUNT, MPI_COMM_WORLD, &recv_request[i]);
+	}
+	return near;
+}
+
+//
+//  ranks other than ours within halo of p, each once, into
+//  recipients (up to GHOST_DIRECTIONS, -1 after the last); ranks walled
+//  off from p are left out
+//
+static void ghost_recipients( particle_t &p, double halo, int rank, int n_proc, struct subdivision *my_area, struct subdivision *areas,
+		struct walkable_sum *walkable, bool *open_to, int *recipients ){
+	bool up = false, down = false, left = false, right = false;
+	int directions[GHOST_DIRECTIONS];  // right, left, up, down, upright, upleft, downright, downleft
+	memset(directions, -1, GHOST_DIRECTIONS * sizeof(int));
+	
+	// moving right:
+	if(my_area->max_x - p.x < halo){
+		right = true;
+		directions[0] = rank_for_location(p.x + halo, p.y, n_proc, areas);
+	}
+	
+	// moving left
+	if(p.x - my_area->min_x < halo){
+		left = true;
+		directions[1] = rank_for_location(p.x - halo, p.y, n_proc, areas);
+	}
+	
+	// moving up
+	if(my_area->max_y - p.y < halo){
+		up = true;
+		directions[2] = rank_for_location(p.x, p.y + halo, n_proc, areas);
+	}
+	
+	// moving down
+	if(p.y - my_area->min_y < halo){
+		down = true;
+		directions[3] = rank_for_location(p.x, p.y - halo, n_proc, areas);
+	}
+	
+	// moving up-right:
+	if(up && right){
+		directions[4] = rank_for_location(p.x + halo, p.y + halo, n_proc, areas);
+	}
+	
+	// moving up-left
+	if(up && left){
+		directions[5] = rank_for_location(p.x - halo, p.y + halo, n_proc, areas);
+	}
+	
+	// moving down-right:
+	if(down && right){
+		directions[6] = rank_for_location(p.x + halo, p.y - halo, n_proc, areas);
+	}
+	
+	// moving down-left
+	if(down && left){
+		directions[7] = rank_for_location(p.x - halo, p.y - halo, n_proc, areas);
+	}
+	
+	// an agent that has moved over to another rank always goes to it, even
+	// if a bounce has left it inside a wall
+	int owner = rank_for_location(p.x, p.y, n_proc, areas);
+	int found = 0;
+	for(int j = 0; j < GHOST_DIRECTIONS; j++){
+		int recipient = directions[j];
+		bool seen = recipient == -1 || recipient == rank || (recipient != owner &&
+			(!open_to[recipient] || !reaches_walkable(walkable, NULL, areas, recipient, p.x, p.y, halo)));
+		// ensure each core only gets one copy at worst
+		for(int k = 0; k < found && !seen; k++){
+			seen = recipients[k] == recipient;
 		}
-		for(int i = 0; i < n_proc; i++){
-			MPI_Send(&to_send_counts[i], 1, MPI_INT, i, SEND_INITIAL_PARTICLE_COUNT, MPI_COMM_WORLD);
-			if(to_send_counts[i] > 0){
-				//fprintf(stderr, "%s rank %i prepping to send %i to %i\n", MPI_PREPEND, rank, to_send_counts[i], i);fflush(stderr);
-			}
+		if(!seen){
+			recipients[found++] = recipient;
 		}
-		MPI_Barrier(MPI_COMM_WORLD);
-		
-		for(int i = 0; i < n_proc; i++){
-			if(to_receive[i] > 0){
-				MPI_Irecv(& (local[local_count]), to_receive[i], PARTICLE, i, SEND_INITIAL_PARTICLES, MPI_COMM_WORLD, &particle_recv_request[i] );
-				//fprintf(stderr, "%s rank %i prepping to receive %i from %i\n", MPI_PREPEND, rank, to_receive[i], i);fflush(stderr);
-				local_count += to_receive[i];
-				received += to_receive[i];
-			}
+	}
+	if(found < GHOST_DIRECTIONS){
+		recipients[found] = -1;
+	}
+}
+
+//
+//  ghost zone width that keeps a rank's own agents exact for `steps` steps
+//  between exchanges while it moves its ghosts itself. Step j back from the
+//  last one needs the agents a cutoff further out than step j+1 did, all
+//  of them up to 2 * max_step_distance closer by then, and agents that
+//  wander in must be held: steps * (cutoff + steps * max_step_distance)
+//  sums that up. One step is the old per-step exchange.
+//
+static double halo_width( int steps ){
+	return steps * (interaction_cutoff + steps * max_step_distance);
+}
+
+//
+//  rank that owns the agent at (x, y): by tile with --balance, else by subdivision
+//
+static int owner_rank( struct tile_owners *owners, double x, double y, int n_proc, struct subdivision *areas ){
+	return owners ? owner_for_location(owners, x, y) : rank_for_location(x, y, n_proc, areas);
+}
+
+//
+//  the stuck regions of a jammed run, on rank 0; collective
+//
+static void report_jam( struct transport *t, struct tile_owners *owners, particle_t *local, int local_count, int step, int window, struct map *map_cfg, struct subdivision *areas ){
+	unsigned int highest_dim = MAX(map_cfg->height, map_cfg->width);
+	double cell_size = 1.0 / highest_dim;
+	int stalled = 0;
+	struct jam_cell *cells = (struct jam_cell *) malloc(MAX(local_count, 1) * sizeof(struct jam_cell));
+	for(int i = 0; i < local_count; i++){
+		if(local[i].goal_x < 0 || step - local[i].progress_step < window){
+			continue;
 		}
-		
-		for(int i = 0; i < n_proc; i++){
-			if(to_send_counts[i] > 0){
-				MPI_Send(to_send[i], to_send_counts[i], PARTICLE, i, SEND_INITIAL_PARTICLES, MPI_COMM_WORLD);
-				//fprintf(stderr, "%s rank %i sent %i to %i, (%lf,%lf)\n", MPI_PREPEND, rank, to_send_counts[i], i, to_send[i][0].x, to_send[i][0].y);fflush(stderr);
+		int col = (int) (local[i].x * highest_dim), row = (int) (local[i].y * highest_dim);
+		// another rank may hold stalled agents in this cell or next to it
+		// if any of the 3x3 cells around it is partly its ground
+		bool edge = false;
+		for(int a = 0; a <= 6 && !edge; a++){
+			for(int b = 0; b <= 6 && !edge; b++){
+				double x = MIN(MAX((col - 1 + 0.5 * a) * cell_size, (col - 1) * cell_size + AREA_EDGE_INSET), (col + 2) * cell_size - AREA_EDGE_INSET);
+				double y = MIN(MAX((row - 1 + 0.5 * b) * cell_size, (row - 1) * cell_size + AREA_EDGE_INSET), (row + 2) * cell_size - AREA_EDGE_INSET);
+				edge = owner_rank(owners, x, y, t->n_proc, areas) != t->rank;
 			}
 		}
-		MPI_Barrier(MPI_COMM_WORLD);
-		
-		if(received > 0){
-			//fprintf(stderr, "%s rank %i newest: (%lf,%lf)\n", MPI_PREPEND, rank, local[local_count-1].x, local[local_count-1].y);fflush(stderr);
+		struct jam_cell cell = {(int) cell_for_pos(local[i].x, local[i].y, map_cfg), 1, edge, 0};
+		cells[stalled++] = cell;
+	}
+	struct jam_region *regions = NULL;
+	int found = jam_regions(t, cells, stalled, map_cfg, &regions);
+	int total = stalled;
+	transport_reduce(t, &total, &total, 1, TRANSPORT_INT, TRANSPORT_SUM, 0);
+	if(t->rank == 0){
+		fprintf(stderr, "%s jammed at step %i: none of the %i goal seekers still walking got a cell closer in %i steps, stuck in %i regions\n", MPI_PREPEND, step, total, window, found);
+		for(int r = 0; r < MIN(found, JAM_REPORTED_REGIONS); r++){
+			fprintf(stderr, "%s   %i agents in (%.4f, %.4f) - (%.4f, %.4f)\n", MPI_PREPEND, regions[r].agents, regions[r].min_x, regions[r].min_y, regions[r].max_x, regions[r].max_y);
 		}
-		// reset buffers
-		for(int i = 0; i < n_proc; i++){
-			if(to_send[i]){
-				free(to_send[i]);
-				to_send[i] = NULL;
-			}
+		if(found > JAM_REPORTED_REGIONS){
+			fprintf(stderr, "%s   and %i smaller regions\n", MPI_PREPEND, found - JAM_REPORTED_REGIONS);
 		}
-		//fprintf(stderr,"%s Rank %i finished %i\n",MPI_PREPEND, rank, step);
-    }
-    simulation_time = read_timer( ) - simulation_time;
-    
+	}
+	free(regions);
+	free(cells);
+}
+
+//
+//  per-tile tasks of a step, run by the rank's work pool
+//
+struct step_work{
+	struct tile_grid *tiles;
+	particle_t *local;
+	struct map *map_cfg;
+	int rank;
+	int n_proc;
+	struct subdivision *my_area;
+	struct subdivision *areas;
+	double halo;
+	struct walkable_sum *walkable;
+	bool *open_to;
+	// GHOST_DIRECTIONS recipients per agent
+	int *ghost_to;
+};
+
+static void force_task( void *arg, int task, int worker ){
+	struct step_work *work = (struct step_work *) arg;
+	tile_forces(work->tiles, work->local, work->tiles->occupied[task]);
+}
+
+static void move_task( void *arg, int task, int worker ){
+	struct step_work *work = (struct step_work *) arg;
+	struct tile_grid *tiles = work->tiles;
+	int tile = tiles->occupied[task];
+	for(int a = tiles->start[tile]; a < tiles->start[tile + 1]; a++){
+		move( work->local[tiles->order[a]], work->map_cfg );
+	}
+}
+
+static void ghost_task( void *arg, int task, int worker ){
+	struct step_work *work = (struct step_work *) arg;
+	struct tile_grid *tiles = work->tiles;
+	int tile = tiles->occupied[task];
+	
+	// tiles well inside our subdivision have nothing to send
+	double min_x = (tile % tiles->per_side) * tiles->tile_size, min_y = (tile / tiles->per_side) * tiles->tile_size;
+	struct subdivision *area = work->my_area;
+	double halo = work->halo;
+	bool inner = min_x - area->min_x >= halo && area->max_x - (min_x + tiles->tile_size) >= halo &&
+		min_y - area->min_y >= halo && area->max_y - (min_y + tiles->tile_size) >= halo;
+	
+	for(int a = tiles->start[tile]; a < tiles->start[tile + 1]; a++){
+		int i = tiles->order[a];
+		if(inner){
+			work->ghost_to[i * GHOST_DIRECTIONS] = -1;
+		}else{
+			ghost_recipients(work->local[i], halo, work->rank, work->n_proc, area, work->areas, work->walkable, work->open_to, &work->ghost_to[i * GHOST_DIRECTIONS]);
+		}
+	}
+}
+
+//
+//  every rank that needs a copy of one of our agents, as a ghost or because
+//  it owns the agent now, gets one in to_send; work->ghost_to grows to fit
+//
+static void classify_ghosts( struct step_work *work, struct work_pool *pool, struct tile_owners *owners,
+		particle_t *local, int local_count, int *ghost_space, particle_t **to_send, int *to_send_counts ){
+	int rank = work->rank;
+	int recipient;
+	memset(to_send_counts, 0, work->n_proc * sizeof(int));
+	int *recipients = work->ghost_to;
+	int recipients_count = GHOST_DIRECTIONS;
+	if(!owners){
+		tile_bin(work->tiles, local, local_count);
+		if(local_count > *ghost_space){
+			*ghost_space = local_count;
+			work->ghost_to = (int *) realloc(work->ghost_to, *ghost_space * GHOST_DIRECTIONS * sizeof(int));
+		}
+		work->local = local;
+		pool_for(pool, work->tiles->occupied_count, ghost_task, work);
+	}
+	
+	for( int i = 0; i < local_count; i++ ){
+		if(owners){
+			// every rank owning a tile within reach of this agent's tile
+			int tile = owner_tile(owners, local[i].x, local[i].y);
+			recipients = &owners->halo[owners->halo_start[tile]];
+			recipients_count = owners->halo_start[tile + 1] - owners->halo_start[tile];
+		}else{
+			recipients = &work->ghost_to[i * GHOST_DIRECTIONS];
+		}
+		for(int j = 0; j < recipients_count; j++){
+			recipient = recipients[j];
+			if(recipient == -1){
+				break;
+			}
+			if(recipient == rank || (owners && recipient != owner_for_location(owners, local[i].x, local[i].y) &&
+				!reaches_walkable(work->walkable, owners, work->areas, recipient, local[i].x, local[i].y, work->halo))){
+				continue;
+			}
+			
+			if(to_send[recipient] == NULL){
+				// if i CAN send to rank t, make room for stuff.
+				to_send[recipient] = (particle_t *) malloc(local_count * sizeof(particle_t));
+			}
+			//fprintf(stderr, "%s rank %i sending (%lf,%lf) direction %i to recipient %i\n", MPI_PREPEND, rank, local[i].x, local[i].y, j, recipient);
+			memcpy(&to_send[recipient][to_send_counts[recipient]], &local[i], sizeof(particle_t));
+			to_send_counts[recipient]++;
+		}
+	}
+}
+
+// what root needs to write a frame out
+struct frame_writer{
+	FILE *fsave;
+	struct map *map_cfg;
+	int num_particles;
+	struct minimum_particle *parked;
+};
+
+static void write_frame( void *arg, struct minimum_particle *frame, int count, int parked_count ){
+	struct frame_writer *writer = (struct frame_writer *) arg;
+	if(!writer->fsave){
+		return;
+	}
+	// arrived agents stay drawn where they stopped
+	int num_particles = writer->num_particles;
+	if(count < num_particles && parked_count > 0){
+		memcpy(&frame[count], writer->parked, MIN(parked_count, num_particles - count) * sizeof(struct minimum_particle));
+	}
+	save( writer->fsave, num_particles, frame, writer->map_cfg );
+}
+
+//
+//  what a scenario variant changes about an agent before it starts
+//
+static void change_agent( particle_t &p, struct scenario_change *change, struct map *map_cfg, uint64_t seed ){
+	if(change->blocked){
+		clear_of_walls(p, map_cfg);
+	}
+	if(change->rule_breakers > 0){
+		p.rule_breaker = breaks_rules(seed, p.id, change->rule_breakers);
+	}
+}
+
+//
+//  agents read back from a checkpoint to the ranks that own them now;
+//  returns how many we own
+//
+static int resume_agents( struct transport *t, struct tile_owners *owners, struct subdivision *areas, particle_t *read, int read_count, particle_t *local ){
+	int rank = t->rank, n_proc = t->n_proc;
+	particle_t *to_owner[n_proc];
+	int to_owner_counts[n_proc];
+	memset(to_owner, 0, n_proc * sizeof(particle_t *));
+	memset(to_owner_counts, 0, n_proc * sizeof(int));
+	int local_count = 0;
+	for(int i = 0; i < read_count; i++){
+		int owner = owner_rank(owners, read[i].x, read[i].y, n_proc, areas);
+		if(owner == rank){
+			memcpy(&local[local_count++], &read[i], sizeof(particle_t));
+			continue;
+		}
+		if(to_owner[owner] == NULL){
+			to_owner[owner] = (particle_t *) malloc(read_count * sizeof(particle_t));
+		}
+		memcpy(&to_owner[owner][to_owner_counts[owner]++], &read[i], sizeof(particle_t));
+	}
+	// not a step, so not in the step profile
+	struct profiler scratch;
+	profile_init(&scratch);
+	transport_exchange(t, to_owner, to_owner_counts, local, &local_count, &scratch);
+	for(int r = 0; r < n_proc; r++){
+		free(to_owner[r]);
+	}
+	return local_count;
+}
+
+//
+//  one rank's share of the simulation
+//
+int simulate( struct transport *t, void *arg ){
+	struct run_setup *setup = (struct run_setup *) arg;
+	int argc = setup->argc;
+	char **argv = setup->argv;
+	int rank = t->rank, n_proc = t->n_proc;
+	struct map map_cfg = setup->map_cfg;
+	struct subdivision *areas = setup->areas;
+	int num_particles = setup->num_particles;
+	int special_agents_count = setup->special_agents_count;
+	particle_t *particles = setup->particles;
+	char *savename = setup->savename;
+	bool benchmark_only = setup->benchmark_only;
+	bool write_to_stdout = setup->write_to_stdout;
+	int timesteps = setup->timesteps;
+	struct scenario_change *change = &setup->change;
+	
+	// a blocked corridor is walled off in a copy of the map of our own
+	if(change->blocked){
+		long map_bytes = (long) map_cfg.width * map_cfg.height * sizeof(unsigned short);
+		map_cfg.data = (unsigned short *) malloc(map_bytes);
+		memcpy(map_cfg.data, setup->map_cfg.data, map_bytes);
+		int walled = block_cells(&map_cfg, &change->block);
+		if(rank == 0){
+			fprintf(stderr, "%s blocked %i walkable cells in (%g, %g), (%g, %g)\n", MPI_PREPEND, walled,
+				change->block.min_x, change->block.min_y, change->block.max_x, change->block.max_y);
+		}
+	}
+	if(rank == 0 && change->emergency_step >= 0 && setup->n_exits == 0){
+		fprintf(stderr, "%s --emergency has no exits to send agents to; they are the goals of the -p agents\n", MPI_PREPEND);
+	}
+	
+	struct subdivision *my_area = &(areas[rank]);
+	fprintf(stderr, "%s Assigning rank %i to (%lf, %lf), (%lf, %lf)\n",MPI_PREPEND, rank, my_area->min_x, my_area->min_y, my_area->max_x, my_area->max_y);
+	
+	// ghosts are exchanged every halo_steps steps and moved by every rank
+	// holding them in between
+	int halo_steps = MAX(read_int( argc, argv, "--halo-steps", 1 ), 1);
+	double halo = halo_width(halo_steps);
+	bool halo_check = find_option( argc, argv, "--halo-check" ) >= 0;
+	if(rank == 0){
+		fprintf(stderr, "%s halo %g wide, exchanged every %d steps\n", MPI_PREPEND, halo, halo_steps);
+	}
+	
+	// goal seekers that got no cell closer in a window of steps have
+	// stalled, looked for a few times a window
+	int jam_window = MAX(read_int( argc, argv, "--jam-window", 0 ), 0);
+	int jam_every = MAX(jam_window / 4, 1);
+	double jam_progress = 1.0 / MAX(map_cfg.height, map_cfg.width);
+	
+	// over-decomposition: ranks own tiles of the map that the balancer moves around
+	int balance_every = read_int( argc, argv, "--balance", 0 );
+	struct tile_owners owners_storage;
+	struct tile_owners *owners = NULL;
+	int rebalances = 0, tiles_moved = 0, last_balance = 0;
+	if(balance_every > 0){
+		owners = &owners_storage;
+		owners_init( owners, read_int( argc, argv, "--balance-tiles", 8 * (int) sqrt(n_proc) ), n_proc, areas, halo );
+		if(rank == 0){
+			fprintf(stderr, "%s balancing %dx%d tiles every %d steps\n", MPI_PREPEND, owners->per_side, owners->per_side, balance_every);
+		}
+	}
+	
+	// the eight probes of ghost_recipients only reach the next subdivision
+	if(!owners && n_proc > 1 && halo >= 1.0 / sqrt(n_proc)){
+		if(rank == 0){
+			fprintf(stderr, "%s --halo-steps %d needs a halo of %g, wider than a subdivision; use fewer steps or --balance\n", MPI_PREPEND, halo_steps, halo);
+		}
+		return 1;
+	}
+	
+	int local_count;
+	particle_t *local = NULL;
+	int counts[n_proc], offsets[n_proc];
+	
+	local = (particle_t*) malloc( num_particles * sizeof(particle_t) );
+	local_count = 0;
+	
+	// a checkpoint to carry on from, its agents in place of the initial ones
+	char *checkpoint_file = setup->checkpoint_file;
+	int checkpoint_every = setup->checkpoint_every;
+	char *restart_file = setup->restart_file;
+	struct checkpoint_header resumed;
+	uint64_t map_hash = setup->map_hash;
+	struct arrival *resumed_arrivals = NULL;
+	int resumed_arrivals_count = 0;
+	struct minimum_particle *parked = (struct minimum_particle *) malloc (num_particles * sizeof(struct minimum_particle));
+	if(restart_file){
+		if(!checkpoint_read_header( t, restart_file, &resumed ) || resumed.num_particles != num_particles ||
+			resumed.special_agents_count != special_agents_count || resumed.map_hash != map_hash){
+			if(rank == 0){
+				fprintf(stderr, "%s %s is not a checkpoint of %i agents (%i special) on this map\n", MPI_PREPEND, restart_file, num_particles, special_agents_count);
+			}
+			free( local );
+			free( parked );
+			return 1;
+		}
+		if(setup->restart_step >= 0 && resumed.steps_done != setup->restart_step){
+			if(rank == 0){
+				fprintf(stderr, "%s %s is a checkpoint of step %i, not %i\n", MPI_PREPEND, restart_file, resumed.steps_done, setup->restart_step);
+			}
+			free( local );
+			free( parked );
+			return 1;
+		}
+		particle_t *read = (particle_t *) malloc( MAX(resumed.agents, 1) * sizeof(particle_t) );
+		int read_count = checkpoint_read( t, restart_file, &resumed, read, &resumed_arrivals, &resumed_arrivals_count, parked );
+		for(int i = 0; i < read_count; i++){
+			change_agent( read[i], change, &map_cfg, setup->seed );
+		}
+		local_count = resume_agents( t, owners, areas, read, read_count, local );
+		free( read );
+		if(rank == 0){
+			fprintf(stderr, "%s resuming step %i from %s, written by %i ranks with %ld agents still walking\n", MPI_PREPEND,
+				resumed.steps_done, restart_file, resumed.n_proc, resumed.agents);
+		}
+	}else{
+		for(int i = 0; i < num_particles; i++){
+			particle_t p = particles[i];
+			change_agent( p, change, &map_cfg, setup->seed );
+			if(owner_rank(owners, p.x, p.y, n_proc, areas) == rank){
+				local[local_count++] = p;
+			}
+		}
+	}
+	
+	fprintf(stderr, "%s Rank %i got %i particles out of %i\n", MPI_PREPEND, rank, local_count, num_particles);
+	if(local_count > 0){
+		fprintf(stderr, "%s Rank %i point 0: (%lf, %lf) (of %i)\n", MPI_PREPEND, rank, local[0].x, local[0].y, local_count);
+	}
+	if(change->rule_breakers > 0){
+		int breakers[2] = {0, local_count};
+		for(int i = 0; i < local_count; i++){
+			breakers[0] += local[i].rule_breaker;
+		}
+		transport_reduce(t, breakers, breakers, 2, TRANSPORT_INT, TRANSPORT_SUM, 0);
+		if(rank == 0){
+			fprintf(stderr, "%s %i of %i agents break the rules\n", MPI_PREPEND, breakers[0], breakers[1]);
+		}
+	}
+	
+	// ghosts put straight into windows on the fixed neighbours
+	char *rma = read_string( argc, argv, "--rma", NULL );
+	if(rma){
+		bool pscw = str_equals(rma, (char *) "pscw");
+		if((!pscw && !str_equals(rma, (char *) "fence")) || t->shared_memory || owners || find_option( argc, argv, "--shm" ) >= 0){
+			if(rank == 0){
+				fprintf(stderr, "%s --rma takes fence or pscw, and needs MPI ranks on fixed subdivisions (no --threads, --balance or --shm)\n", MPI_PREPEND);
+			}
+			free( local );
+			free( parked );
+			free( resumed_arrivals );
+			return 1;
+		}
+		int neighbors[n_proc];
+		int neighbor_count = halo_neighbors( rank, n_proc, areas, halo, neighbors );
+		transport_rma_exchange( t, neighbors, neighbor_count, MAX(num_particles / n_proc, 1), pscw );
+		if(rank == 0){
+			fprintf(stderr, "%s ghosts go by MPI_Put in %s\n", MPI_PREPEND, pscw ? "post/start/complete/wait epochs over the neighbours" : "fence epochs");
+		}
+	}
+	
+	
+	
+	
+	FILE *fsave = benchmark_only ? NULL : (savename && rank == 0 ? (write_to_stdout ? stdout : fopen( savename, "w" )) : NULL);
+	
+    //
+    //  simulate a number of time steps
+    //
+    double simulation_time = read_timer( );
+	int nearby_core;
+	int kept, temp;
+	particle_t *local_temp = (particle_t *) malloc (num_particles * sizeof(particle_t));
+	particle_t *another_temp;
+	
+	// intra-rank threads over tiles for force, move and ghost classification
+	struct work_pool *pool = pool_create( read_int( argc, argv, "--workers", 1 ) );
+	struct tile_grid tiles;
+	tile_init( &tiles, &map_cfg, read_int( argc, argv, "--tile-cells", 0 ) );
+	int ghost_space = 0;
+	// which neighbours we share walkable map with; with --balance the
+	// owners move, so that is decided agent by agent
+	struct walkable_sum walkable;
+	build_walkable_sum( &walkable, &map_cfg );
+	bool *open_to = (bool *) malloc(n_proc * sizeof(bool));
+	if(owners){
+		memset(open_to, 1, n_proc * sizeof(bool));
+	}else{
+		int neighbor_pairs[2] = {walkable_neighbors( &walkable, rank, n_proc, areas, halo, open_to ), 0};
+		for(int r = 0; r < n_proc; r++){
+			neighbor_pairs[1] += open_to[r];
+		}
+		transport_reduce(t, neighbor_pairs, neighbor_pairs, 2, TRANSPORT_INT, TRANSPORT_SUM, 0);
+		if(rank == 0){
+			fprintf(stderr, "%s walls close %i of %i neighbouring subdivision pairs\n", MPI_PREPEND, (neighbor_pairs[0] - neighbor_pairs[1]) / 2, neighbor_pairs[0] / 2);
+		}
+	}
+	struct step_work work = {&tiles, NULL, &map_cfg, rank, n_proc, my_area, areas, halo, &walkable, open_to, NULL};
+	if(rank == 0){
+		fprintf(stderr, "%s %d workers per rank over %dx%d tiles\n", MPI_PREPEND, pool_workers(pool), tiles.per_side, tiles.per_side);
+	}
+	
+	particle_t *to_send[n_proc];
+	int to_send_counts[n_proc];
+	for(int i = 0; i < n_proc; i++){
+		to_send[i] = NULL;
+		to_send_counts[i] = 0;
+	}
+	
+	// agents that reached their goal leave the active set; each rank keeps a
+	// compact record of its arrivals, rank 0 keeps their last position so
+	// every frame still holds all agents
+	bool track_arrivals = special_agents_count > 0;
+	bool completed = false, jammed = false;
+	struct arrival *arrivals = resumed_arrivals;
+	int arrivals_count = resumed_arrivals_count, arrivals_space = resumed_arrivals_count;
+	struct minimum_particle *arrived_now = (struct minimum_particle *) malloc (num_particles * sizeof(struct minimum_particle));
+	int arrived_now_count = 0, parked_count = restart_file && rank == 0 ? (int) resumed.parked : 0;
+	int goal_seekers = 0, arrived_total = restart_file ? resumed.arrived_total : 0;
+	int steps_done = restart_file ? resumed.steps_done : 0;
+	// a restart past the emergency resumes agents already heading out
+	bool emergency = setup->n_exits > 0 && change->emergency_step >= 0 && change->emergency_step < steps_done;
+	int last_checkpoint = steps_done, checkpoints_handled = 0;
+	int last_jam_check = steps_done;
+	// agent bytes we sent to ranks on our node, and to other nodes
+	long halo_bytes[2] = {0, 0};
+	
+	// frames drain to root while the next steps run
+	struct frame_writer writer = {fsave, &map_cfg, num_particles, parked};
+	struct frame_queue frames;
+	frames_init( &frames, t, read_int( argc, argv, "--frames-in-flight", 4 ), num_particles, write_frame, &writer );
+	
+	char *metrics_file = setup->metrics_file;
+	
+	bool profiling = find_option( argc, argv, "--profile" ) >= 0;
+	char *profile_file = read_string( argc, argv, "--profile", NULL );
+	if(profile_file && profile_file[0] == '-'){
+		// bare --profile: table only
+		profile_file = NULL;
+	}
+	struct profiler prof;
+	profile_init(&prof);
+	
+	char *trace_file = read_string( argc, argv, "--trace", NULL );
+	struct tracer trace;
+	if(trace_file){
+		trace_init(&trace, read_int( argc, argv, "--trace-events", 65536 ), t);
+		prof.trace = &trace;
+	}
+	
+	// agents held in each window between exchanges, by id, for --halo-check
+	int *held_at = NULL;
+	int exchanges = 0, ghost_count = 0;
+	long halo_missed = 0;
+	if(halo_check){
+		held_at = (int *) malloc(num_particles * sizeof(int));
+		memset(held_at, -1, num_particles * sizeof(int));
+	}
+	
+	// neither the initial agents nor a checkpoint hold ghosts; one exchange
+	// brings them before the first window, so an agent that crosses to a
+	// neighbour before the first exchange step already has a copy there
+	last_balance = steps_done;
+	classify_ghosts(&work, pool, owners, local, local_count, &ghost_space, to_send, to_send_counts);
+	struct profiler scratch;
+	profile_init(&scratch);
+	transport_exchange(t, to_send, to_send_counts, local, &local_count, &scratch);
+	for(int i = 0; i < n_proc; i++){
+		free(to_send[i]);
+		to_send[i] = NULL;
+	}
+	
+    for( int step = steps_done; !timesteps || step < timesteps; step++ ){
+		steps_done = step + 1;
+		bool exchange_due = steps_done % halo_steps == 0;
+		profile_step(&prof, local_count);
+		
+		// copies of an agent are in the same place, so ghosts and owner agree
+		if(step == change->emergency_step && setup->n_exits > 0){
+			head_for_exits(local, local_count, setup->exits, setup->n_exits);
+			emergency = true;
+			if(rank == 0){
+				fprintf(stderr, "%s emergency at step %i: every agent heads for its nearest of %i exits\n", MPI_PREPEND, step, setup->n_exits);
+			}
+		}
+		
+		//
+		//  compute all forces
+		//
+		for( int i = 0; i < local_count; i++ ){
+			local[i].ax = local[i].ay = 0;
+		}
+		// each agent feels the agents of its own and the neighbouring tiles,
+		// ghosts from nearby ranks included
+		tile_bin(&tiles, local, local_count);
+		work.local = local;
+		pool_for(pool, tiles.occupied_count, force_task, &work);
+		
+		profile_mark(&prof, PHASE_FORCE);
+		
+		//
+		//  move particles
+		//
+		pool_for(pool, tiles.occupied_count, move_task, &work);
+		profile_mark(&prof, PHASE_MOVE);
+		
+		if(held_at && exchange_due){
+			for( int i = 0; i < local_count; i++ ){
+				held_at[local[i].id] = exchanges;
+			}
+		}
+		
+		kept = 0;
+		ghost_count = 0;
+		arrived_now_count = 0;
+		goal_seekers = 0;
+		for( int i = 0; i < local_count; i++ ){
+			// check if this core should forget about this particle now.
+			temp = owner_rank(owners, local[i].x, local[i].y, n_proc, areas);
+			if(temp != rank){
+				//fprintf(stderr,"%s rank %i forgot particle %i, at (%lf, %lf)\n", MPI_PREPEND, rank, i, local[i].x,local[i].y);
+				// ghosts last until fresh ones arrive; meanwhile they wait
+				// at the back of the array
+				if(!exchange_due){
+					ghost_count++;
+					memcpy(&local_temp[num_particles - ghost_count], &local[i], sizeof(particle_t));
+				}
+			}else if(track_arrivals && local[i].goal_x >= 0 && at_goal(local[i].x, local[i].y, local[i].goal_x, local[i].goal_y)){
+				// retire it: no more forces, migration, ghosts or output
+				if(arrivals_count == arrivals_space){
+					arrivals_space = arrivals_space ? 2 * arrivals_space : 64;
+					arrivals = (struct arrival *) realloc(arrivals, arrivals_space * sizeof(struct arrival));
+				}
+				arrivals[arrivals_count].id = local[i].id;
+				arrivals[arrivals_count].exit = exit_for_goal(setup->exits, setup->n_exits, local[i].goal_x, local[i].goal_y, &map_cfg);
+				arrivals[arrivals_count].step = step;
+				arrivals[arrivals_count].path_length = local[i].path_length;
+				arrivals_count++;
+				
+				arrived_now[arrived_now_count].x = local[i].x;
+				arrived_now[arrived_now_count].y = local[i].y;
+				arrived_now[arrived_now_count].color_r = local[i].color_r;
+				arrived_now[arrived_now_count].color_g = local[i].color_g;
+				arrived_now[arrived_now_count].color_b = local[i].color_b;
+				arrived_now_count++;
+			}else{
+				goal_seekers += local[i].goal_x >= 0;
+				memcpy(&local_temp[kept], &local[i], sizeof(particle_t));
+				kept++;
+			}
+		}
+		
+		//swap pointers, since we now have a condensed local_temp list of things to care about (no extra mallocing)
+		another_temp = local;
+		local = local_temp;
+		local_temp = another_temp;
+		
+		local_count = kept;
+		profile_mark(&prof, PHASE_COMPACT);
+		
+		// how many goal seekers are still walking, and how many just arrived
+		int arrival_state[2] = {goal_seekers, arrived_now_count};
+		if(track_arrivals){
+			transport_reduce(t, arrival_state, arrival_state, 2, TRANSPORT_INT, TRANSPORT_SUM, TRANSPORT_ALL);
+			arrived_total += arrival_state[1];
+		}
+		
+		// park the last position of new arrivals on root
+		if(arrival_state[1] > 0 && !benchmark_only){
+			transport_gather(t, &arrived_now_count, sizeof(int), counts, 0);
+			if(rank == 0){
+				for(int i = 0; i < n_proc; i++){
+					offsets[i] = (i == 0 ? parked_count : offsets[i-1] + counts[i-1]);
+				}
+				parked_count = MIN(offsets[n_proc-1] + counts[n_proc-1], num_particles);
+			}
+			transport_gatherv(t, arrived_now, arrived_now_count, sizeof(struct minimum_particle), parked, counts, offsets, 0);
+			profile_sent(&prof, sizeof(int) + arrived_now_count * sizeof(struct minimum_particle), 2);
+		}
+		profile_mark(&prof, PHASE_ARRIVALS);
+		
+		// send points to rank 0 to be written (only x,y & color); the frame
+		// is snapshotted, so we can move on before it has arrived
+		struct minimum_particle *minimum_particles = frames_next(&frames);
+		for(int i = 0; i < local_count; i++){
+			minimum_particles[i].x = local[i].x;
+			minimum_particles[i].y = local[i].y;
+			minimum_particles[i].color_r = local[i].color_r;
+			minimum_particles[i].color_g = local[i].color_g;
+			minimum_particles[i].color_b = local[i].color_b;
+		}
+		frames_start(&frames, local_count, parked_count);
+		profile_sent(&prof, sizeof(int) + local_count * sizeof(struct minimum_particle), 2);
+		profile_mark(&prof, PHASE_GATHER);
+		
+		frames_poll(&frames);
+		profile_mark(&prof, PHASE_SAVE);
+		
+		// done once every goal seeker has arrived
+		if(track_arrivals && arrival_state[0] == 0){
+			if(rank == 0){
+				fprintf(stderr, "%s all %i goal-seeking agents arrived by step %i\n", MPI_PREPEND, arrived_total, step);
+			}
+			completed = true;
+			break;
+		}
+		
+		// give up once every goal seeker still walking has stalled
+		if(jam_window > 0 && track_arrivals && steps_done - last_jam_check >= jam_every){
+			last_jam_check = steps_done;
+			int stalled = 0;
+			for(int i = 0; i < local_count; i++){
+				stalled += jam_track(local[i], steps_done, jam_window, jam_progress);
+			}
+			transport_reduce(t, &stalled, &stalled, 1, TRANSPORT_INT, TRANSPORT_SUM, TRANSPORT_ALL);
+			if(stalled == arrival_state[0]){
+				report_jam(t, owners, local, local_count, steps_done, jam_window, &map_cfg, areas);
+				jammed = true;
+				break;
+			}
+			profile_mark(&prof, PHASE_ARRIVALS);
+		}
+		
+		if(!exchange_due){
+			// keep moving our copies of the ghosts, behind our own agents
+			memmove(&local[local_count], &local[num_particles - ghost_count], ghost_count * sizeof(particle_t));
+			local_count += ghost_count;
+			profile_mark(&prof, PHASE_GHOST);
+			continue;
+		}
+		
+		// hand tiles from busy ranks to idle neighbours; the agents of a tile
+		// that changed hands go to the new owner with the ghosts below
+		if(owners && steps_done - last_balance >= balance_every){
+			last_balance = steps_done;
+			memset(owners->load, 0, owners->per_side * owners->per_side * sizeof(int));
+			for( int i = 0; i < local_count; i++ ){
+				owners->load[owner_tile(owners, local[i].x, local[i].y)]++;
+			}
+			transport_reduce(t, owners->load, owners->load, owners->per_side * owners->per_side, TRANSPORT_INT, TRANSPORT_SUM, TRANSPORT_ALL);
+			profile_sent(&prof, owners->per_side * owners->per_side * sizeof(int), 1);
+			tiles_moved += owners_balance(owners, BALANCE_TOLERANCE, halo);
+			rebalances++;
+			profile_mark(&prof, PHASE_BALANCE);
+		}
+		
+		// find particles nearby other cores:
+		classify_ghosts(&work, pool, owners, local, local_count, &ghost_space, to_send, to_send_counts);
+		profile_mark(&prof, PHASE_GHOST);
+		
+		for(int r = 0; r < n_proc; r++){
+			halo_bytes[setup->node_of[r] != setup->node_of[rank]] += (long) to_send_counts[r] * sizeof(particle_t);
+		}
+		
+		// send stuff around
+		int owned = local_count;
+		transport_exchange(t, to_send, to_send_counts, local, &local_count, &prof);
+		
+		// anything that turns up within reach of our agents without having
+		// been held since the last exchange is an interaction the halo missed
+		if(held_at){
+			tile_bin(&tiles, local, owned);
+			for(int i = owned; i < local_count; i++){
+				if(held_at[local[i].id] != exchanges && tile_any_within(&tiles, local, local[i].x, local[i].y, interaction_cutoff)){
+					halo_missed++;
+				}
+			}
+		}
+		exchanges++;
+		
+		// reset buffers
+		for(int i = 0; i < n_proc; i++){
+			if(to_send[i]){
+				free(to_send[i]);
+				to_send[i] = NULL;
+			}
+		}
+		
+		// between exchanges every rank holds exactly the agents it owns
+		if(checkpoint_file){
+			int requested[2] = {checkpoint_requests, stop_requested};
+			transport_reduce(t, requested, requested, 2, TRANSPORT_INT, TRANSPORT_MAX, TRANSPORT_ALL);
+			if(requested[0] > checkpoints_handled || (checkpoint_every > 0 && steps_done - last_checkpoint >= checkpoint_every)){
+				checkpoints_handled = requested[0];
+				last_checkpoint = steps_done;
+				struct checkpoint_header header;
+				memset(&header, 0, sizeof(struct checkpoint_header));
+				header.num_particles = num_particles;
+				header.special_agents_count = special_agents_count;
+				header.steps_done = steps_done;
+				header.arrived_total = arrived_total;
+				header.seed = setup->seed;
+				header.map_width = map_cfg.width;
+				header.map_height = map_cfg.height;
+				header.map_hash = map_hash;
+				double seconds = checkpoint_write(t, checkpoint_file, &header, local, owned, arrivals, arrivals_count, parked, parked_count);
+				transport_reduce(t, &seconds, &seconds, 1, TRANSPORT_DOUBLE, TRANSPORT_MAX, 0);
+				if(rank == 0){
+					double megabytes = (sizeof(struct checkpoint_header) + header.agents * sizeof(particle_t) +
+						header.arrivals * sizeof(struct arrival) + header.parked * sizeof(struct minimum_particle)) / 1.0e6;
+					fprintf(stderr, "%s checkpoint of step %i to %s: %.3g MB in %.3g s\n", MPI_PREPEND, steps_done, checkpoint_file, megabytes, seconds);
+				}
+				profile_mark(&prof, PHASE_SAVE);
+			}
+			if(requested[1]){
+				if(rank == 0){
+					fprintf(stderr, "%s stopping after step %i on SIGTERM\n", MPI_PREPEND, steps_done);
+				}
+				break;
+			}
+		}
+		//fprintf(stderr,"%s Rank %i finished %i\n",MPI_PREPEND, rank, step);
+    }
+	frames_flush(&frames);
+	transport_reduce(t, &frames.stalls, &frames.stalls, 1, TRANSPORT_LONG, TRANSPORT_MAX, 0);
+    simulation_time = read_timer( ) - simulation_time;
+    
     if( rank == 0 ){
-        fprintf(stderr, "%s n = %d, n_procs = %d, simulation time = %g s\n", MPI_PREPEND, num_particles, n_proc, simulation_time );
+        fprintf(stderr, "%s n = %d, n_procs = %d, steps = %d, simulation time = %g s\n", MPI_PREPEND, num_particles, n_proc, steps_done, simulation_time );
+		if(track_arrivals){
+			fprintf(stderr, "%s %i of %i goal-seeking agents arrived\n", MPI_PREPEND, arrived_total, emergency ? num_particles : special_agents_count);
+		}
+		if(frames.stalls > 0){
+			fprintf(stderr, "%s up to %ld of %d output frames per rank waited for one of %d in flight to drain\n", MPI_PREPEND, frames.stalls, steps_done, frames.slots_count);
+		}
+		if(owners){
+			fprintf(stderr, "%s load balancer moved %i tiles over %i rebalances\n", MPI_PREPEND, tiles_moved, rebalances);
+		}
+		if(setup->result){
+			struct run_result result = {steps_done, simulation_time, emergency ? num_particles : special_agents_count, arrived_total, completed, jammed};
+			*setup->result = result;
+		}
+	}
+	
+	transport_reduce(t, halo_bytes, halo_bytes, 2, TRANSPORT_LONG, TRANSPORT_SUM, 0);
+	if(rank == 0 && halo_bytes[0] + halo_bytes[1] > 0){
+		fprintf(stderr, "%s %.1f%% of %.3g MB of halo and migration traffic crossed nodes\n", MPI_PREPEND,
+			100.0 * halo_bytes[1] / (halo_bytes[0] + halo_bytes[1]), (halo_bytes[0] + halo_bytes[1]) / 1.0e6);
+	}
+	
+	if(held_at){
+		transport_reduce(t, &halo_missed, &halo_missed, 1, TRANSPORT_LONG, TRANSPORT_SUM, 0);
+		if(rank == 0){
+			fprintf(stderr, "%s halo check: %ld interactions missed over %d exchanges\n", MPI_PREPEND, halo_missed, exchanges);
+		}
+		free(held_at);
+	}
+	
+	if(profiling){
+		report_profile(profile_file, &prof, simulation_time, t);
+	}
+	
+	if(trace_file){
+		trace_write(&trace, trace_file, t);
+		trace_free(&trace);
+	}
+	
+	if(metrics_file){
+		struct metrics_run run = {num_particles, emergency ? num_particles : special_agents_count, n_proc, steps_done, simulation_time, setup->seed, jammed};
+		report_metrics(metrics_file, arrivals, arrivals_count, setup->n_exits, &run, t);
 	}
     
     //
     //  release resources
     //
 	
-	if(map_cfg.data){
-		free(map_cfg.data);
+	pool_destroy( pool );
+	tile_free( &tiles );
+	free_walkable_sum( &walkable );
+	free( open_to );
+	if(owners){
+		owners_free( owners );
 	}
-	
+	free( work.ghost_to );
     free( local );
-    free( particles );
+	free( local_temp );
+	frames_free( &frames );
+	free( arrivals );
+	free( arrived_now );
+	free( parked );
+	if(change->blocked){
+		free( map_cfg.data );
+	}
     if( fsave )
         fclose( fsave );
     
-    MPI_Finalize( );
-    
     return 0;
 }
+
+//
+//  a file rank 0 reads for everyone, NUL-terminated; NULL if it can't
+//
+static char *read_shared_text( struct transport *world, const char *filename ){
+	long bytes = -1;
+	char *text = NULL;
+	if(!world || world->rank == 0){
+		FILE *fp = fopen(filename, "r");
+		if(fp){
+			fseek(fp, 0, SEEK_END);
+			bytes = ftell(fp);
+			fseek(fp, 0, SEEK_SET);
+			text = (char *) malloc(bytes + 1);
+			bytes = fread(text, 1, bytes, fp);
+			fclose(fp);
+		}else{
+			fprintf(stderr, "%s Couldn't open %s\n", MPI_PREPEND, filename);
+		}
+	}
+	if(world){
+		transport_bcast(world, &bytes, sizeof(long), 0);
+		if(bytes < 0){
+			return NULL;
+		}
+		if(world->rank > 0){
+			text = (char *) malloc(bytes + 1);
+		}
+		transport_bcast(world, text, bytes, 0);
+	}
+	if(text){
+		text[bytes] = '\0';
+	}
+	return text;
+}
+
+//
+//  subdivisions for the ranks of a group's transport, placed by node as
+//  main places the whole world's
+//
+static void lay_out_group( struct transport *t, int argc, char **argv, int *node_of, struct subdivision *areas ){
+	int ranks_per_node = read_int( argc, argv, "--ranks-per-node", 0 );
+	if(ranks_per_node > 0){
+		for(int r = 0; r < t->n_proc; r++){
+			node_of[r] = r / ranks_per_node * ranks_per_node;
+		}
+	}else{
+		transport_node_of( t, node_of );
+	}
+	if(t->rank == 0){
+		lay_out_subdivisions( t->n_proc, node_of, str_equals(read_string( argc, argv, "--placement", (char *) "node" ), (char *) "row"), areas );
+	}
+	transport_bcast( t, areas, t->n_proc * sizeof(struct subdivision), 0 );
+}
+
+//
+//  variants of one scenario from a shared warm state (--variants)
+//
+//  The warm state is a checkpoint: --restart's, or one --warmup steps into
+//  the scenario written to --checkpoint. MPI ranks split into as many equal
+//  groups as there are variants, up to one group per rank and a power of 4
+//  of them, and each group runs its share of the variants in turn. Thread
+//  ranks run each variant in a process forked after the warm-up, sharing
+//  the map and the agents copy-on-write. Variants write their own metrics,
+//  no frames, and rank 0 ends with a table of how each went.
+//
+int run_variants( struct run_setup *setup, char *variants_file, int threads, struct transport *world ){
+	int argc = setup->argc;
+	char **argv = setup->argv;
+	int rank = world ? world->rank : 0;
+	int n_proc = world ? world->n_proc : threads;
+	
+	char *text = read_shared_text( world, variants_file );
+	struct scenario_variant *variants = NULL;
+	int count = text ? parse_variants(text, &variants) : 0;
+	struct scenario_change changes[count > 0 ? count : 1];
+	bool valid = count > 0;
+	for(int v = 0; v < count; v++){
+		valid = read_scenario_change(variants[v].argc, variants[v].argv, &changes[v]) && valid;
+	}
+	
+	// the warm state every variant starts from
+	char *warm_file = setup->restart_file;
+	int warmup = read_int( argc, argv, "--warmup", 0 );
+	if(!warm_file && (warmup <= 0 || !setup->checkpoint_file)){
+		if(rank == 0){
+			fprintf(stderr, "%s --variants starts from --restart <checkpoint>, or from --warmup <steps> written to --checkpoint <file>\n", MPI_PREPEND);
+		}
+		valid = false;
+	}
+	if(!valid){
+		free_variants(variants, count);
+		free(text);
+		return 1;
+	}
+	if(!warm_file){
+		// checkpoints are only taken on exchange steps
+		int halo_steps = MAX(read_int( argc, argv, "--halo-steps", 1 ), 1);
+		if(warmup % halo_steps != 0){
+			warmup += halo_steps - warmup % halo_steps;
+			if(rank == 0){
+				fprintf(stderr, "%s warm-up rounded up to %i steps, a multiple of --halo-steps\n", MPI_PREPEND, warmup);
+			}
+		}
+		// nothing resumes from an earlier warm-up's checkpoint
+		if(rank == 0){
+			unlink(setup->checkpoint_file);
+		}
+		struct run_setup warm = *setup;
+		warm.timesteps = warmup;
+		warm.checkpoint_every = warmup;
+		warm.metrics_file = NULL;
+		int result = threads > 0 ? transport_threads_run( threads, simulate, &warm ) : simulate( world, &warm );
+		if(result != 0){
+			free_variants(variants, count);
+			free(text);
+			return result;
+		}
+		warm_file = setup->checkpoint_file;
+	}else{
+		warmup = -1;
+	}
+	
+	// how each variant went, for the table
+	int status[count];
+	double seconds[count];
+	memset(status, 0, count * sizeof(int));
+	memset(seconds, 0, count * sizeof(double));
+	char metrics_names[count][256];
+	struct run_setup variant_setups[count];
+	for(int v = 0; v < count; v++){
+		struct run_setup *vs = &variant_setups[v];
+		*vs = *setup;
+		vs->restart_file = warm_file;
+		vs->restart_step = warmup;
+		vs->checkpoint_file = NULL;
+		vs->checkpoint_every = 0;
+		vs->savename = NULL;
+		vs->benchmark_only = true;
+		vs->write_to_stdout = false;
+		vs->timesteps = read_int( variants[v].argc, variants[v].argv, "-t", setup->timesteps );
+		vs->change = changes[v];
+		snprintf(metrics_names[v], sizeof(metrics_names[v]), "%s.json", variants[v].argv[0]);
+		vs->metrics_file = read_string( variants[v].argc, variants[v].argv, "--metrics", metrics_names[v] );
+	}
+	
+	if(threads > 0){
+		// every variant in a process of its own, as many at a time as the
+		// node has cores for their threads; the next starts when one ends
+		int at_once = MAX((int) sysconf(_SC_NPROCESSORS_ONLN) / threads, 1);
+		fprintf(stderr, "%s up to %i variants at a time, of %i threads each\n", MPI_PREPEND, MIN(at_once, count), threads);
+		pid_t pids[count];
+		double started[count];
+		fflush(stdout);
+		fflush(stderr);
+		int running = 0, next = 0;
+		while(next < count || running > 0){
+			if(next < count && running < at_once){
+				int v = next++;
+				started[v] = read_timer( );
+				pids[v] = fork();
+				if(pids[v] == 0){
+					_exit(transport_threads_run( threads, simulate, &variant_setups[v] ));
+				}
+				if(pids[v] < 0){
+					fprintf(stderr, "%s Couldn't fork for variant %s\n", MPI_PREPEND, variants[v].argv[0]);
+					status[v] = 1;
+				}else{
+					running++;
+				}
+				continue;
+			}
+			int wait_status;
+			pid_t pid = wait(&wait_status);
+			if(pid < 0){
+				break;
+			}
+			for(int v = 0; v < next; v++){
+				if(pids[v] == pid){
+					status[v] = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 1;
+					seconds[v] = read_timer( ) - started[v];
+					running--;
+				}
+			}
+		}
+	}else{
+		// as many groups as variants, a power of 4 ranks each
+		int groups = 1;
+		while(groups * 4 <= MIN(count, n_proc)){
+			groups *= 4;
+		}
+		int group_size = n_proc / groups, group = rank / group_size;
+		MPI_Comm group_comm;
+		MPI_Comm_split(world->comm, group, rank, &group_comm);
+		
+		int group_node_of[group_size];
+		struct subdivision group_areas[group_size];
+		for(int v = group; v < count; v += groups){
+			// a fresh transport per variant, so no variant inherits another's windows
+			struct transport t;
+			transport_mpi_init( &t, group_comm );
+			if(t.rank == 0){
+				fprintf(stderr, "%s variant %s on ranks %i to %i\n", MPI_PREPEND, variants[v].argv[0], rank, rank + group_size - 1);
+			}
+			lay_out_group( &t, argc, argv, group_node_of, group_areas );
+			variant_setups[v].areas = group_areas;
+			variant_setups[v].node_of = group_node_of;
+			
+			double started = read_timer( );
+			int result = simulate( &t, &variant_setups[v] );
+			transport_reduce( &t, &result, &result, 1, TRANSPORT_INT, TRANSPORT_MAX, 0 );
+			if(t.rank == 0){
+				status[v] = result;
+				seconds[v] = read_timer( ) - started;
+			}
+			transport_finalize( &t );
+		}
+		MPI_Comm_free(&group_comm);
+		
+		// the first rank of each group has its variants' results
+		transport_reduce( world, status, status, count, TRANSPORT_INT, TRANSPORT_MAX, 0 );
+		transport_reduce( world, seconds, seconds, count, TRANSPORT_DOUBLE, TRANSPORT_MAX, 0 );
+	}
+	
+	int failed = 0;
+	if(rank == 0){
+		fprintf(stderr, "%s %i variants from %s:\n", MPI_PREPEND, count, warm_file);
+		for(int v = 0; v < count; v++){
+			fprintf(stderr, "%s   %-24s %s, %.3g s, metrics in %s\n", MPI_PREPEND, variants[v].argv[0],
+				status[v] == 0 ? "done" : "FAILED", seconds[v], variant_setups[v].metrics_file);
+			failed += status[v] != 0;
+		}
+	}
+	free_variants(variants, count);
+	free(text);
+	return failed > 0;
+}
+
+//
+//  one job of an ensemble: the base run with the job's options on top,
+//  on a map read once for every job that uses it. Fills in js, whose
+//  particles and exits the caller frees; false if the job can't run.
+//
+static bool set_up_job( struct run_setup *setup, struct scenario_variant *job, struct map *map_cfg, char **merged, struct run_setup *js, bool report ){
+	// the job's options come first, so they win over the base run's
+	int argc = job->argc + setup->argc - 1;
+	merged[0] = setup->argv[0];
+	for(int i = 1; i < job->argc; i++){
+		merged[i] = job->argv[i];
+	}
+	for(int i = 1; i < setup->argc; i++){
+		merged[job->argc - 1 + i] = setup->argv[i];
+	}
+	
+	*js = *setup;
+	js->argc = argc;
+	js->argv = merged;
+	js->map_cfg = *map_cfg;
+	js->particles = NULL;
+	js->exits = NULL;
+	js->num_particles = setup->special_agents_count + read_int( argc, merged, "-r", setup->num_particles - setup->special_agents_count );
+	// a job without a seed of its own takes the base run's, which every rank shares
+	js->seed = read_string( job->argc, job->argv, "--seed", NULL ) ? read_seed( job->argc, job->argv ) : setup->seed;
+	js->timesteps = read_int( argc, merged, "-t", setup->timesteps );
+	js->savename = NULL;
+	js->benchmark_only = true;
+	js->write_to_stdout = false;
+	js->checkpoint_file = NULL;
+	js->checkpoint_every = 0;
+	js->restart_file = NULL;
+	js->metrics_file = read_string( job->argc, job->argv, "--metrics", NULL );
+	js->map_hash = checkpoint_map_hash( map_cfg );
+	
+	if(map_cfg->height == 0 || map_cfg->width == 0){
+		return false;
+	}
+	if(!read_scenario_change( job->argc, job->argv, &js->change )){
+		return false;
+	}
+	for(int i = 0; i < setup->special_agents_count; i++){
+		if(!is_valid_location(setup->agents[i][0], setup->agents[i][1], map_cfg) || !is_valid_location(setup->agents[i][2], setup->agents[i][3], map_cfg)){
+			if(report){
+				fprintf(stderr, "%s job %s: agent %i starts or ends in a wall\n", MPI_PREPEND, job->argv[0], i);
+			}
+			return false;
+		}
+	}
+	
+	struct subdivision spawn_region = {0.0, 0.0, 1.0, 1.0};
+	double component_x = -1.0, component_y = -1.0;
+	char *spawn_arg = read_string( argc, merged, "--spawn-region", NULL );
+	if(spawn_arg && sscanf(spawn_arg, "%lf,%lf,%lf,%lf", &spawn_region.min_x, &spawn_region.min_y, &spawn_region.max_x, &spawn_region.max_y) != 4){
+		return false;
+	}
+	spawn_arg = read_string( argc, merged, "--spawn-component", NULL );
+	if(spawn_arg && sscanf(spawn_arg, "%lf,%lf", &component_x, &component_y) != 2){
+		return false;
+	}
+	struct walkable_index spawn;
+	if(build_walkable_index(&spawn, map_cfg, &spawn_region, component_x, component_y) == 0 && js->num_particles > setup->special_agents_count){
+		if(report){
+			fprintf(stderr, "%s job %s: no walkable cells to place random agents in\n", MPI_PREPEND, job->argv[0]);
+		}
+		free_walkable_index(&spawn);
+		return false;
+	}
+	
+	set_size( js->num_particles, map_cfg );
+	js->particles = (particle_t *) malloc( js->num_particles * sizeof(particle_t) );
+	init_particles( js->num_particles, setup->special_agents_count, setup->agents, js->particles, map_cfg, &spawn, js->seed );
+	free_walkable_index(&spawn);
+	js->exits = (double (*)[2]) malloc((setup->special_agents_count > 0 ? setup->special_agents_count : 1) * sizeof(double[2]));
+	js->n_exits = build_exits(setup->special_agents_count, setup->agents, map_cfg, js->exits);
+	return true;
+}
+
+//
+//  how one run of a batch went
+//
+struct job_outcome{
+	int status;
+	// first rank of the group that ran it
+	int first_rank;
+	int agents;
+	struct run_result result;
+	double seconds;
+};
+
+// sets up job j of a batch in js, as set_up_job does; false if it can't run
+typedef bool (*job_setup)( void *arg, int j, struct run_setup *js, bool report );
+
+//
+//  a batch of runs over groups of group_size MPI ranks, or one after
+//  another on every thread rank. The first rank of a group takes the next
+//  job from a queue held by world rank 0, so a group that finishes early
+//  moves on rather than waiting on a fixed share. Every rank ends up with
+//  every job's outcome.
+//
+static void run_jobs( int count, char **names, job_setup set_up, void *arg, int threads, int group_size, struct transport *world, struct job_outcome *outcomes ){
+	memset(outcomes, 0, count * sizeof(struct job_outcome));
+	if(threads > 0){
+		for(int j = 0; j < count; j++){
+			struct run_setup js;
+			bool ready = set_up( arg, j, &js, true );
+			js.result = &outcomes[j].result;
+			fprintf(stderr, "%s job %s on %i threads\n", MPI_PREPEND, names[j], threads);
+			double started = read_timer( );
+			outcomes[j].status = ready ? transport_threads_run( threads, simulate, &js ) : 1;
+			outcomes[j].seconds = read_timer( ) - started;
+			outcomes[j].agents = js.num_particles;
+			free(js.particles);
+			free(js.exits);
+		}
+		return;
+	}
+	
+	int rank = world->rank;
+	MPI_Comm group_comm;
+	MPI_Comm_split(world->comm, rank / group_size, rank, &group_comm);
+	int group_node_of[group_size];
+	struct subdivision group_areas[group_size];
+	
+	struct job_queue queue;
+	job_queue_init( &queue, world->comm, count );
+	while(true){
+		int j = rank % group_size == 0 ? job_queue_take( &queue ) : -1;
+		MPI_Bcast(&j, 1, MPI_INT, 0, group_comm);
+		if(j < 0){
+			break;
+		}
+		
+		// a fresh transport per job, so no job inherits another's windows
+		struct transport t;
+		transport_mpi_init( &t, group_comm );
+		if(t.rank == 0){
+			fprintf(stderr, "%s job %s on ranks %i to %i\n", MPI_PREPEND, names[j], rank, rank + group_size - 1);
+		}
+		
+		struct run_result result = {0, 0.0, 0, 0, false, false};
+		struct run_setup js;
+		bool ready = set_up( arg, j, &js, t.rank == 0 );
+		lay_out_group( &t, js.argc, js.argv, group_node_of, group_areas );
+		js.areas = group_areas;
+		js.node_of = group_node_of;
+		js.result = &result;
+		double started = read_timer( );
+		int status = ready ? simulate( &t, &js ) : 1;
+		transport_reduce( &t, &status, &status, 1, TRANSPORT_INT, TRANSPORT_MAX, 0 );
+		if(t.rank == 0){
+			struct job_outcome outcome = {status, rank, js.num_particles, result, read_timer( ) - started};
+			outcomes[j] = outcome;
+		}
+		free(js.particles);
+		free(js.exits);
+		transport_finalize( &t );
+	}
+	job_queue_free( &queue );
+	MPI_Comm_free(&group_comm);
+	
+	// only the first rank of the group that ran a job has its outcome, the
+	// rest hold zeros
+	int counts[count][8];
+	double times[count][2];
+	for(int j = 0; j < count; j++){
+		struct job_outcome *o = &outcomes[j];
+		int c[8] = {o->status, o->first_rank, o->agents, o->result.steps, o->result.goal_seekers, o->result.arrived, o->result.completed, o->result.jammed};
+		memcpy(counts[j], c, sizeof(c));
+		times[j][0] = o->seconds;
+		times[j][1] = o->result.simulation_time;
+	}
+	transport_reduce( world, counts, counts, count * 8, TRANSPORT_INT, TRANSPORT_MAX, TRANSPORT_ALL );
+	transport_reduce( world, times, times, count * 2, TRANSPORT_DOUBLE, TRANSPORT_MAX, TRANSPORT_ALL );
+	for(int j = 0; j < count; j++){
+		struct job_outcome outcome = {counts[j][0], counts[j][1], counts[j][2],
+			{counts[j][3], times[j][1], counts[j][4], counts[j][5], counts[j][6] != 0, counts[j][7] != 0}, times[j][0]};
+		outcomes[j] = outcome;
+	}
+}
+
+//
+//  many independent runs over groups of ranks (--jobs)
+//
+//  Each line of the job file is a name and options laid over the command
+//  line's: a map, agent count, seed, steps, scenario change or metrics
+//  file. Every distinct map is read once and broadcast, and the jobs go
+//  through run_jobs. Rank 0 ends with a table of every job, also written
+//  as CSV to --table.
+//
+struct ensemble{
+	struct run_setup *setup;
+	struct scenario_variant *jobs;
+	struct map *maps;
+	int *map_of;
+	char **merged;
+};
+
+static bool set_up_ensemble_job( void *arg, int j, struct run_setup *js, bool report ){
+	struct ensemble *e = (struct ensemble *) arg;
+	return set_up_job( e->setup, &e->jobs[j], &e->maps[e->map_of[j]], e->merged, js, report );
+}
+
+int run_ensemble( struct run_setup *setup, char *jobs_file, int threads, struct transport *world ){
+	int argc = setup->argc;
+	char **argv = setup->argv;
+	int rank = world ? world->rank : 0;
+	int n_proc = world ? world->n_proc : threads;
+	
+	char *text = read_shared_text( world, jobs_file );
+	struct scenario_variant *jobs = NULL;
+	int count = text ? parse_variants(text, &jobs) : 0;
+	int group_size = threads > 0 ? threads : read_int( argc, argv, "--group-size", 1 );
+	if(count == 0 || !isPowerOfFour(group_size) || group_size > n_proc){
+		if(rank == 0){
+			fprintf(stderr, "%s --jobs needs at least one job, and --group-size a power of 4 up to the %i ranks\n", MPI_PREPEND, n_proc);
+		}
+		free_variants(jobs, count);
+		free(text);
+		return 1;
+	}
+	
+	// each map is read once by rank 0 and shared by every job that uses it
+	char *base_map = read_string( argc, argv, "-c", (char *) "map.cfg" );
+	char *map_names[count + 1];
+	struct map maps[count + 1];
+	int map_of[count];
+	int n_maps = 1;
+	map_names[0] = base_map;
+	maps[0] = setup->map_cfg;
+	for(int j = 0; j < count; j++){
+		char *name = read_string( jobs[j].argc, jobs[j].argv, "-c", base_map );
+		int m = 0;
+		while(m < n_maps && !str_equals(map_names[m], name)){
+			m++;
+		}
+		if(m == n_maps){
+			struct map read = {0, 0, NULL};
+			if(rank == 0){
+				FILE *fp = fopen(name, "r");
+				if(fp){
+					read_map(fp, &read);
+					fclose(fp);
+				}else{
+					fprintf(stderr, "%s Couldn't open map %s\n", MPI_PREPEND, name);
+				}
+			}
+			if(world){
+				transport_bcast(world, &read.height, sizeof(unsigned int), 0);
+				transport_bcast(world, &read.width, sizeof(unsigned int), 0);
+				long map_bytes = (long) read.height * read.width * sizeof(unsigned short);
+				if(rank > 0 && map_bytes > 0){
+					read.data = (unsigned short *) malloc(map_bytes);
+				}
+				if(map_bytes > 0){
+					transport_bcast(world, read.data, map_bytes, 0);
+				}
+			}
+			map_names[n_maps] = name;
+			maps[n_maps++] = read;
+		}
+		map_of[j] = m;
+	}
+	if(rank == 0){
+		fprintf(stderr, "%s %i jobs on %i maps, %i ranks each\n", MPI_PREPEND, count, n_maps, group_size);
+	}
+	
+	int longest = 0;
+	char *names[count];
+	for(int j = 0; j < count; j++){
+		longest = MAX(longest, jobs[j].argc);
+		names[j] = jobs[j].argv[0];
+	}
+	char *merged[argc + longest];
+	struct ensemble e = {setup, jobs, maps, map_of, merged};
+	struct job_outcome outcomes[count];
+	run_jobs( count, names, set_up_ensemble_job, &e, threads, group_size, world, outcomes );
+	
+	int failed = 0;
+	if(rank == 0){
+		char *table_file = read_string( argc, argv, "--table", NULL );
+		FILE *table = table_file ? fopen(table_file, "w") : NULL;
+		if(table_file && !table){
+			fprintf(stderr, "%s Couldn't write %s\n", MPI_PREPEND, table_file);
+		}
+		if(table){
+			fprintf(table, "job,map,first_rank,ranks,agents,seed,steps,goal_seekers,arrived,completed,seconds,status\n");
+		}
+		fprintf(stderr, "%s %i jobs from %s:\n", MPI_PREPEND, count, jobs_file);
+		for(int j = 0; j < count; j++){
+			struct job_outcome *o = &outcomes[j];
+			uint64_t seed = read_string( jobs[j].argc, jobs[j].argv, "--seed", NULL ) ? read_seed( jobs[j].argc, jobs[j].argv ) : setup->seed;
+			fprintf(stderr, "%s   %-24s %-16s %7i agents  %6i steps  %i of %i arrived%s  %.3g s  %s\n", MPI_PREPEND,
+				names[j], map_names[map_of[j]], o->agents, o->result.steps, o->result.arrived, o->result.goal_seekers,
+				o->result.completed ? " (all)" : "", o->seconds, o->status != 0 ? "FAILED" : (o->result.jammed ? "jammed" : "done"));
+			if(table){
+				fprintf(table, "%s,%s,%i,%i,%i,%llu,%i,%i,%i,%i,%.6f,%s\n", names[j], map_names[map_of[j]],
+					o->first_rank, group_size, o->agents, (unsigned long long) seed, o->result.steps, o->result.goal_seekers,
+					o->result.arrived, o->result.completed, o->seconds, o->status != 0 ? "failed" : (o->result.jammed ? "jammed" : "done"));
+			}
+			failed += o->status != 0;
+		}
+		if(table){
+			fclose(table);
+		}
+	}
+	for(int m = 1; m < n_maps; m++){
+		free(maps[m].data);
+	}
+	free_variants(jobs, count);
+	free(text);
+	return failed > 0;
+}
+
+//
+//  the hallway that gets a crowd out soonest (--optimize)
+//
+//  Every width in --hallway-widths and door in --doors makes a candidate
+//  hallway map (hallway.h). The -r agents start in the left half, all head
+//  for the exit at step 0, and a candidate scores the step its last agent
+//  got out. Successive halving keeps the sweep short: every candidate runs
+//  a small budget of steps, the best 1/eta of them go on to eta times as
+//  many, and so on up to -t, each resuming from the checkpoint its last
+//  round ended with. A candidate whose crowd is all out has its exact
+//  score and runs no further, nor does one that jammed (--jam-window).
+//  Each round is a batch for run_jobs.
+//
+struct optimizer{
+	// the command line's run, with the hallway's goal-seeking agent
+	struct run_setup *setup;
+	struct map *maps;
+	char (*checkpoints)[256];
+	bool *resume;
+	// candidates of the current round
+	int *running;
+	// steps this round runs to, and the last round ran to
+	int budget;
+	int previous_budget;
+	// options every candidate shares, spawn region and emergency
+	struct scenario_variant job;
+	char **merged;
+};
+
+static bool set_up_candidate( void *arg, int j, struct run_setup *js, bool report ){
+	struct optimizer *o = (struct optimizer *) arg;
+	int c = o->running[j];
+	bool ready = set_up_job( o->setup, &o->job, &o->maps[c], o->merged, js, report );
+	js->timesteps = o->budget;
+	js->checkpoint_file = o->checkpoints[c];
+	// a checkpoint where this round ends, for the next to resume from
+	js->checkpoint_every = o->budget - (o->resume[c] ? o->previous_budget : 0);
+	js->restart_file = o->resume[c] ? o->checkpoints[c] : NULL;
+	return ready;
+}
+
+// ordering of candidates by outcome: all out soonest, then most out
+static int compare_outcomes( struct job_outcome *a, struct job_outcome *b ){
+	if((a->status != 0) != (b->status != 0)){
+		return a->status != 0 ? 1 : -1;
+	}
+	if(a->result.completed != b->result.completed){
+		return a->result.completed ? -1 : 1;
+	}
+	if(a->result.completed){
+		return a->result.steps - b->result.steps;
+	}
+	return b->result.arrived - a->result.arrived;
+}
+
+int run_optimize( struct run_setup *setup, int threads, struct transport *world ){
+	int argc = setup->argc;
+	char **argv = setup->argv;
+	int rank = world ? world->rank : 0;
+	int n_proc = world ? world->n_proc : threads;
+	
+	int size = read_int( argc, argv, "--map-size", 64 );
+	int length = read_int( argc, argv, "--hallway-length", 4 );
+	int eta = read_int( argc, argv, "--eta", 3 );
+	int group_size = threads > 0 ? threads : read_int( argc, argv, "--group-size", 1 );
+	int halo_steps = MAX(read_int( argc, argv, "--halo-steps", 1 ), 1);
+	int narrowest = 1, widest = 8;
+	char *widths = read_string( argc, argv, "--hallway-widths", NULL );
+	bool valid = !widths || sscanf(widths, "%i,%i", &narrowest, &widest) == 2;
+	double doors[64];
+	int n_doors = 0;
+	char doors_arg[256];
+	snprintf(doors_arg, sizeof(doors_arg), "%s", read_string( argc, argv, "--doors", (char *) "0.5" ));
+	for(char *door = strtok(doors_arg, ","); door && n_doors < 64; door = strtok(NULL, ",")){
+		doors[n_doors] = atof(door);
+		valid = valid && doors[n_doors] >= 0 && doors[n_doors] <= 1;
+		n_doors++;
+	}
+	valid = valid && size >= length + 6 && length >= 1 && narrowest >= 1 && narrowest <= widest && widest <= size - 2 && eta >= 2 && n_doors > 0 &&
+		setup->timesteps > 0 && isPowerOfFour(group_size) && group_size <= n_proc;
+	if(!valid){
+		if(rank == 0){
+			fprintf(stderr, "%s --optimize needs -t steps, --hallway-widths min,max within --map-size, --doors fractions 0 to 1, --eta of 2 or more, and --group-size a power of 4 up to the %i ranks\n", MPI_PREPEND, n_proc);
+		}
+		return 1;
+	}
+	
+	// every rank makes every candidate's map, there is nothing to read
+	int count = (widest - narrowest + 1) * n_doors;
+	struct hallway candidates[count];
+	struct map maps[count];
+	char names[count][32];
+	char checkpoints[count][256];
+	bool resume[count];
+	const char *prefix = setup->checkpoint_file ? setup->checkpoint_file : "hallway";
+	for(int w = narrowest, c = 0; w <= widest; w++){
+		for(int d = 0; d < n_doors; d++, c++){
+			struct hallway h = {size, length, w, doors[d]};
+			candidates[c] = h;
+			hallway_map( &maps[c], &candidates[c] );
+			snprintf(names[c], sizeof(names[c]), "w%i-d%.2f", w, doors[d]);
+			snprintf(checkpoints[c], sizeof(checkpoints[c]), "%s.%s.ckpt", prefix, names[c]);
+			resume[c] = false;
+		}
+	}
+	
+	// the crowd: one agent whose goal is the exit, the rest spawned in the
+	// left half and sent after it at step 0
+	double agent[1][4];
+	hallway_exit( &candidates[0], agent[0] );
+	struct run_setup base = *setup;
+	base.special_agents_count = 1;
+	base.agents = agent;
+	base.num_particles = 1 + setup->num_particles - setup->special_agents_count;
+	struct subdivision left = hallway_spawn( &candidates[0] );
+	char spawn_region[128];
+	snprintf(spawn_region, sizeof(spawn_region), "%.17g,%.17g,%.17g,%.17g", left.min_x, left.min_y, left.max_x, left.max_y);
+	char *job_argv[] = {(char *) "hallway", (char *) "--spawn-region", spawn_region, (char *) "--emergency", (char *) "0"};
+	char *merged[argc + 5];
+	int running[count];
+	struct optimizer o = {&base, maps, checkpoints, resume, running, 0, 0, {5, job_argv}, merged};
+	
+	// rounds, each eta times the budget of the one before, ending on -t
+	int rounds = 1;
+	for(long reach = 1; reach < count; reach *= eta){
+		rounds++;
+	}
+	int alive[count], alive_count = count;
+	int eliminated_in[count];
+	struct job_outcome outcomes[count], round_outcomes[count];
+	memset(outcomes, 0, count * sizeof(struct job_outcome));
+	for(int c = 0; c < count; c++){
+		alive[c] = c;
+		eliminated_in[c] = -1;
+	}
+	if(rank == 0){
+		// nothing resumes from an earlier sweep's checkpoints
+		for(int c = 0; c < count; c++){
+			unlink(checkpoints[c]);
+		}
+		fprintf(stderr, "%s %i hallways (widths %i to %i, %i doors) of %i agents, %i rounds up to %i steps\n", MPI_PREPEND,
+			count, narrowest, widest, n_doors, base.num_particles, rounds, setup->timesteps);
+	}
+	
+	long steps_run = 0;
+	for(int round = 0; round < rounds; round++){
+		double share = 1.0;
+		for(int r = round; r < rounds - 1; r++){
+			share /= eta;
+		}
+		int budget = (int) ceil(setup->timesteps * share / halo_steps) * halo_steps;
+		o.budget = round == rounds - 1 ? setup->timesteps : MIN(budget, setup->timesteps);
+		if(o.budget <= o.previous_budget){
+			continue;
+		}
+		
+		// candidates still short of their score
+		int running_count = 0;
+		char *running_names[count];
+		for(int a = 0; a < alive_count; a++){
+			int c = alive[a];
+			if(outcomes[c].status == 0 && !outcomes[c].result.completed && !outcomes[c].result.jammed){
+				running[running_count] = c;
+				running_names[running_count++] = names[c];
+			}
+		}
+		if(running_count == 0){
+			break;
+		}
+		
+		// carry on from the last round's checkpoint where there is one
+		int have[count];
+		if(rank == 0){
+			for(int j = 0; j < running_count; j++){
+				have[j] = o.previous_budget > 0 && access(checkpoints[running[j]], R_OK) == 0;
+			}
+		}
+		if(world){
+			transport_bcast( world, have, running_count * sizeof(int), 0 );
+		}
+		for(int j = 0; j < running_count; j++){
+			resume[running[j]] = have[j];
+		}
+		
+		run_jobs( running_count, running_names, set_up_candidate, &o, threads, group_size, world, round_outcomes );
+		for(int j = 0; j < running_count; j++){
+			int c = running[j];
+			steps_run += MAX(round_outcomes[j].result.steps - (resume[c] ? o.previous_budget : 0), 0);
+			outcomes[c] = round_outcomes[j];
+		}
+		o.previous_budget = o.budget;
+		
+		// best first, ties to the narrower hallway and the earlier door
+		for(int a = 1; a < alive_count; a++){
+			int c = alive[a], b = a;
+			for(; b > 0 && compare_outcomes(&outcomes[c], &outcomes[alive[b - 1]]) < 0; b--){
+				alive[b] = alive[b - 1];
+			}
+			alive[b] = c;
+		}
+		if(round < rounds - 1){
+			// only what is clearly behind goes, never one tied with the last kept
+			int keep = (alive_count + eta - 1) / eta;
+			while(keep < alive_count && compare_outcomes(&outcomes[alive[keep]], &outcomes[alive[keep - 1]]) == 0){
+				keep++;
+			}
+			for(int a = keep; a < alive_count; a++){
+				eliminated_in[alive[a]] = round;
+			}
+			if(rank == 0){
+				fprintf(stderr, "%s round %i: %i hallways ran to step %i, %i of %i go on\n", MPI_PREPEND, round, running_count, o.budget, keep, alive_count);
+			}
+			alive_count = keep;
+		}
+	}
+	
+	int best = alive[0];
+	if(rank == 0){
+		fprintf(stderr, "%s %i hallways by the step their crowd was out:\n", MPI_PREPEND, count);
+		char *table_file = read_string( argc, argv, "--table", NULL );
+		FILE *table = table_file ? fopen(table_file, "w") : NULL;
+		if(table_file && !table){
+			fprintf(stderr, "%s Couldn't write %s\n", MPI_PREPEND, table_file);
+		}
+		if(table){
+			fprintf(table, "hallway,width,door,steps,goal_seekers,arrived,completed,eliminated_in,status\n");
+		}
+		for(int c = 0; c < count; c++){
+			struct job_outcome *oc = &outcomes[c];
+			char fate[64];
+			if(eliminated_in[c] >= 0){
+				snprintf(fate, sizeof(fate), "dropped after round %i", eliminated_in[c]);
+			}else{
+				snprintf(fate, sizeof(fate), "%s", c == best ? "best" : "finalist");
+			}
+			fprintf(stderr, "%s   %-14s %6i steps  %i of %i out%s  %s%s\n", MPI_PREPEND, names[c], oc->result.steps,
+				oc->result.arrived, oc->result.goal_seekers, oc->result.completed ? " (all)" : "", fate, oc->status != 0 ? ", FAILED" : (oc->result.jammed ? ", jammed" : ""));
+			if(table){
+				fprintf(table, "%s,%i,%g,%i,%i,%i,%i,%i,%s\n", names[c], candidates[c].width, candidates[c].door, oc->result.steps,
+					oc->result.goal_seekers, oc->result.arrived, oc->result.completed, eliminated_in[c], oc->status != 0 ? "failed" : (oc->result.jammed ? "jammed" : "done"));
+			}
+		}
+		if(table){
+			fclose(table);
+		}
+		fprintf(stderr, "%s best: hallway %i cells wide with its door at %g, %i of %i agents out by step %i\n", MPI_PREPEND,
+			candidates[best].width, candidates[best].door, outcomes[best].result.arrived, outcomes[best].result.goal_seekers, outcomes[best].result.steps);
+		fprintf(stderr, "%s ran %ld candidate steps, %.1f%% of running every hallway to step %i\n", MPI_PREPEND,
+			steps_run, 100.0 * steps_run / ((double) count * setup->timesteps), setup->timesteps);
+		
+		char *best_map = read_string( argc, argv, "--best-map", NULL );
+		if(best_map){
+			FILE *fp = fopen(best_map, "w");
+			if(fp){
+				write_map(fp, &maps[best], false);
+				fclose(fp);
+			}else{
+				fprintf(stderr, "%s Couldn't write %s\n", MPI_PREPEND, best_map);
+			}
+		}
+		for(int c = 0; c < count; c++){
+			unlink(checkpoints[c]);
+		}
+	}
+	for(int c = 0; c < count; c++){
+		free(maps[c].data);
+	}
+	return outcomes[best].status != 0;
+}
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "rng.h"
+#include "scenario.h"
+
+bool read_scenario_change( int argc, char **argv, struct scenario_change *change ){
+	memset(change, 0, sizeof(struct scenario_change));
+	change->emergency_step = read_int( argc, argv, "--emergency", -1 );
+	change->rule_breakers = read_double( argc, argv, "--rule-breakers", 0 );
+	if(change->rule_breakers < 0 || change->rule_breakers > 1){
+		fprintf(stderr, "%s --rule-breakers takes a fraction of the agents, 0 to 1\n", MPI_PREPEND);
+		return false;
+	}
+	char *block = read_string( argc, argv, "--block", NULL );
+	if(block){
+		struct subdivision *b = &change->block;
+		if(sscanf(block, "%lf,%lf,%lf,%lf", &b->min_x, &b->min_y, &b->max_x, &b->max_y) != 4 || b->min_x >= b->max_x || b->min_y >= b->max_y){
+			fprintf(stderr, "%s --block expects x0,y0,x1,y1 with x0 < x1 and y0 < y1\n", MPI_PREPEND);
+			return false;
+		}
+		change->blocked = true;
+	}
+	return true;
+}
+
+int block_cells( struct map *map_cfg, struct subdivision *block ){
+	unsigned int highest_dim = MAX(map_cfg->height, map_cfg->width);
+	int first_col = MAX((int) floor(block->min_x * highest_dim), 0);
+	int first_row = MAX((int) floor(block->min_y * highest_dim), 0);
+	int last_col = MIN((int) ceil(block->max_x * highest_dim), (int) map_cfg->width) - 1;
+	int last_row = MIN((int) ceil(block->max_y * highest_dim), (int) map_cfg->height) - 1;
+	int walled = 0;
+	for(int row = first_row; row <= last_row; row++){
+		for(int col = first_col; col <= last_col; col++){
+			unsigned short *cell = &map_cfg->data[row * map_cfg->width + col];
+			walled += *cell != 0;
+			*cell = 0;
+		}
+	}
+	return walled;
+}
+
+void clear_of_walls( particle_t &p, struct map *map_cfg ){
+	if(is_valid_location(p.x, p.y, map_cfg)){
+		return;
+	}
+	unsigned int highest_dim = MAX(map_cfg->height, map_cfg->width);
+	int col = MIN(MAX((int) floor(p.x * highest_dim), 0), (int) map_cfg->width - 1);
+	int row = MIN(MAX((int) floor(p.y * highest_dim), 0), (int) map_cfg->height - 1);
+	// rings of cells around ours, nearest centre of the first ring with any
+	for(int ring = 1; ring < (int) highest_dim; ring++){
+		double best = -1;
+		int best_col = 0, best_row = 0;
+		for(int r = row - ring; r <= row + ring; r++){
+			for(int c = col - ring; c <= col + ring; c++){
+				bool edge = r == row - ring || r == row + ring || c == col - ring || c == col + ring;
+				if(!edge || r < 0 || c < 0 || r >= (int) map_cfg->height || c >= (int) map_cfg->width || map_cfg->data[r * map_cfg->width + c] == 0){
+					continue;
+				}
+				double dx = (c + 0.5) / highest_dim - p.x, dy = (r + 0.5) / highest_dim - p.y;
+				if(best < 0 || dx * dx + dy * dy < best){
+					best = dx * dx + dy * dy;
+					best_col = c;
+					best_row = r;
+				}
+			}
+		}
+		if(best >= 0){
+			p.x = (best_col + 0.5) / highest_dim;
+			p.y = (best_row + 0.5) / highest_dim;
+			return;
+		}
+	}
+}
+
+bool breaks_rules( uint64_t seed, int id, double fraction ){
+	double draw;
+	rng_uniforms(seed, id, RNG_RULES, &draw, 1);
+	return draw < fraction;
+}
+
+void head_for_exits( particle_t *p, int n, double exits[][2], int n_exits ){
+	for(int i = 0; i < n; i++){
+		if(p[i].goal_x >= 0 || n_exits == 0){
+			continue;
+		}
+		int nearest = 0;
+		double best = -1;
+		for(int e = 0; e < n_exits; e++){
+			double dx = exits[e][0] - p[i].x, dy = exits[e][1] - p[i].y;
+			if(best < 0 || dx * dx + dy * dy < best){
+				best = dx * dx + dy * dy;
+				nearest = e;
+			}
+		}
+		p[i].goal_x = exits[nearest][0];
+		p[i].goal_y = exits[nearest][1];
+	}
+}
+
+int parse_variants( char *text, struct scenario_variant **variants ){
+	int count = 0, space = 0;
+	*variants = NULL;
+	for(char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")){
+		// split the line into words in place
+		char **words = NULL;
+		int words_count = 0;
+		for(char *c = line; *c; ){
+			while(*c == ' ' || *c == '\t' || *c == '\r'){
+				*c++ = '\0';
+			}
+			if(!*c || (words_count == 0 && *c == '#')){
+				break;
+			}
+			words = (char **) realloc(words, (words_count + 2) * sizeof(char *));
+			words[words_count++] = c;
+			while(*c && *c != ' ' && *c != '\t' && *c != '\r'){
+				c++;
+			}
+		}
+		if(words_count == 0){
+			continue;
+		}
+		words[words_count] = NULL;
+		if(count == space){
+			space = space ? 2 * space : 8;
+			*variants = (struct scenario_variant *) realloc(*variants, space * sizeof(struct scenario_variant));
+		}
+		(*variants)[count].argc = words_count;
+		(*variants)[count].argv = words;
+		count++;
+	}
+	return count;
+}
+
+void free_variants( struct scenario_variant *variants, int count ){
+	for(int v = 0; v < count; v++){
+		free(variants[v].argv);
+	}
+	free(variants);
+}
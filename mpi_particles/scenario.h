@@ -0,0 +1,52 @@
+#ifndef SCENARIO_H__
+#define SCENARIO_H__
+
+#include "common.h"
+
+//
+//  variants of a scenario, run from one warm state (--variants)
+//
+//  A study warms a crowd up once and then changes one thing about it:
+//  --emergency S sends every wandering agent to its nearest exit at step
+//  S, --block x0,y0,x1,y1 walls off a rectangle of the map, and
+//  --rule-breakers F has a fraction F of the agents push through others
+//  instead of being repelled. These work on a plain run as well. A
+//  variants file holds one variant per line, a name and then its options.
+//
+
+struct scenario_change{
+	// step of the emergency, -1 for none
+	int emergency_step;
+	bool blocked;
+	struct subdivision block;
+	double rule_breakers;
+};
+
+// the change asked for by argv; false, having said why, if it makes no sense
+bool read_scenario_change( int argc, char **argv, struct scenario_change *change );
+
+// walls over every cell the block touches; returns how many were walkable
+int block_cells( struct map *map_cfg, struct subdivision *block );
+
+// an agent left standing in a wall goes to the centre of the nearest walkable cell
+void clear_of_walls( particle_t &p, struct map *map_cfg );
+
+// decided by the agent's own random stream, so alike on any number of ranks
+bool breaks_rules( uint64_t seed, int id, double fraction );
+
+// every agent without a goal heads for the exit nearest to it
+void head_for_exits( particle_t *p, int n, double exits[][2], int n_exits );
+
+struct scenario_variant{
+	// argv[0] is the name, options follow as on the command line
+	int argc;
+	char **argv;
+};
+
+// One variant per line of text; blank lines and lines starting with #
+// are skipped. text is split up in place. Returns the number of variants.
+int parse_variants( char *text, struct scenario_variant **variants );
+
+void free_variants( struct scenario_variant *variants, int count );
+
+#endif
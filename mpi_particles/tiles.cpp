@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "tiles.h"
+
+void tile_init( struct tile_grid *grid, struct map *map_cfg, int tile_cells ){
+	memset(grid, 0, sizeof(struct tile_grid));
+	unsigned int highest_dim = MAX(map_cfg->height, map_cfg->width);
+	if(highest_dim == 0){
+		highest_dim = 1;
+	}
+	double cell = 1.0 / highest_dim;
+	int min_cells = (int) ceil(interaction_cutoff / cell);
+	tile_cells = MAX(tile_cells, MAX(min_cells, 1));
+
+	grid->per_side = (highest_dim + tile_cells - 1) / tile_cells;
+	grid->tile_size = tile_cells * cell;
+	int tiles = grid->per_side * grid->per_side;
+	grid->start = (int *) calloc(tiles + 1, sizeof(int));
+	grid->occupied = (int *) malloc(tiles * sizeof(int));
+}
+
+void tile_free( struct tile_grid *grid ){
+	free(grid->start);
+	free(grid->order);
+	free(grid->agent_tile);
+	free(grid->occupied);
+	memset(grid, 0, sizeof(struct tile_grid));
+}
+
+void tile_bin( struct tile_grid *grid, particle_t *p, int n ){
+	if(n > grid->capacity){
+		grid->capacity = n;
+		grid->order = (int *) realloc(grid->order, n * sizeof(int));
+		grid->agent_tile = (int *) realloc(grid->agent_tile, n * sizeof(int));
+	}
+
+	// counting sort by tile, keeping agents in their original order within a tile
+	int tiles = grid->per_side * grid->per_side;
+	memset(grid->start, 0, (tiles + 1) * sizeof(int));
+	for(int i = 0; i < n; i++){
+		grid->agent_tile[i] = tile_of(grid, p[i].x, p[i].y);
+		grid->start[grid->agent_tile[i] + 1]++;
+	}
+	grid->occupied_count = 0;
+	for(int k = 0; k < tiles; k++){
+		if(grid->start[k + 1] > 0){
+			grid->occupied[grid->occupied_count++] = k;
+		}
+		grid->start[k + 1] += grid->start[k];
+	}
+	for(int i = 0; i < n; i++){
+		grid->order[grid->start[grid->agent_tile[i]]++] = i;
+	}
+	// the fill pass advanced each start to the next tile's; shift back
+	for(int k = tiles; k > 0; k--){
+		grid->start[k] = grid->start[k - 1];
+	}
+	grid->start[0] = 0;
+}
+
+void tile_forces( struct tile_grid *grid, particle_t *p, int tile ){
+	int row = tile / grid->per_side, col = tile % grid->per_side;
+	for(int a = grid->start[tile]; a < grid->start[tile + 1]; a++){
+		int i = grid->order[a];
+		for(int r = MAX(row - 1, 0); r <= MIN(row + 1, grid->per_side - 1); r++){
+			for(int c = MAX(col - 1, 0); c <= MIN(col + 1, grid->per_side - 1); c++){
+				int neighbor_tile = r * grid->per_side + c;
+				for(int b = grid->start[neighbor_tile]; b < grid->start[neighbor_tile + 1]; b++){
+					int j = grid->order[b];
+					if(j != i){
+						apply_force_from(p[i], p[j]);
+					}
+				}
+			}
+		}
+	}
+}
+
+bool tile_any_within( struct tile_grid *grid, particle_t *p, double x, double y, double radius ){
+	int tile = tile_of(grid, x, y);
+	int row = tile / grid->per_side, col = tile % grid->per_side;
+	for(int r = MAX(row - 1, 0); r <= MIN(row + 1, grid->per_side - 1); r++){
+		for(int c = MAX(col - 1, 0); c <= MIN(col + 1, grid->per_side - 1); c++){
+			int neighbor_tile = r * grid->per_side + c;
+			for(int b = grid->start[neighbor_tile]; b < grid->start[neighbor_tile + 1]; b++){
+				int j = grid->order[b];
+				double dx = p[j].x - x, dy = p[j].y - y;
+				if(dx * dx + dy * dy <= radius * radius){
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
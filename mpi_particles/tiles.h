@@ -0,0 +1,49 @@
+#ifndef TILES_H__
+#define TILES_H__
+
+#include "common.h"
+
+//
+//  square tiles of map cells, the unit of per-rank work
+//
+//  Tiles are at least the interaction cutoff wide, so an agent only feels
+//  agents in its own tile and the 8 around it. tile_bin sorts a rank's
+//  agents by tile without moving them.
+//
+
+struct tile_grid{
+	// tiles per side of the unit square, and their width
+	int per_side;
+	double tile_size;
+	// agents of tile k are order[start[k]] .. order[start[k+1]-1]
+	int *start;
+	int *order;
+	int *agent_tile;
+	int capacity;
+	// tiles holding at least one agent, the tasks of a step
+	int *occupied;
+	int occupied_count;
+};
+
+// tile_cells map cells per tile side; 0 picks the fewest that span the cutoff
+void tile_init( struct tile_grid *grid, struct map *map_cfg, int tile_cells );
+
+void tile_free( struct tile_grid *grid );
+
+inline int tile_of( struct tile_grid *grid, double x, double y ){
+	int col = (int) (x / grid->tile_size);
+	int row = (int) (y / grid->tile_size);
+	col = col < 0 ? 0 : (col >= grid->per_side ? grid->per_side - 1 : col);
+	row = row < 0 ? 0 : (row >= grid->per_side ? grid->per_side - 1 : row);
+	return row * grid->per_side + col;
+}
+
+void tile_bin( struct tile_grid *grid, particle_t *p, int n );
+
+// forces on every agent of one tile from the agents of the 3x3 tiles around it
+void tile_forces( struct tile_grid *grid, particle_t *p, int tile );
+
+// whether a binned agent lies within radius (at most a tile) of (x, y)
+bool tile_any_within( struct tile_grid *grid, particle_t *p, double x, double y, double radius );
+
+#endif
@@ -0,0 +1,117 @@
+#include <mpi.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "profiler.h"
+#include "trace.h"
+#include "transport.h"
+
+#define TRACE_CLOCK_TAG 200
+#define TRACE_CLOCK_ROUNDS 8
+
+void trace_init( struct tracer *trace, int capacity, struct transport *t ){
+	int rank = t->rank, n_proc = t->n_proc;
+	MPI_Comm comm = t->comm;
+
+	memset(trace, 0, sizeof(struct tracer));
+	trace->capacity = capacity > 0 ? capacity : 1;
+	trace->ring = (struct trace_event *) malloc(trace->capacity * sizeof(struct trace_event));
+
+	// rank 0 answers each rank's pings with its clock, one rank at a time
+	double root_time, best_rtt = -1.0;
+	if(t->shared_memory){
+		trace->clock_offset = 0.0;
+	}else if(rank == 0){
+		for(int r = 1; r < n_proc; r++){
+			for(int round = 0; round < TRACE_CLOCK_ROUNDS; round++){
+				MPI_Recv(NULL, 0, MPI_BYTE, r, TRACE_CLOCK_TAG, comm, MPI_STATUS_IGNORE);
+				root_time = monotonic_time();
+				MPI_Send(&root_time, 1, MPI_DOUBLE, r, TRACE_CLOCK_TAG, comm);
+			}
+		}
+	}else{
+		for(int round = 0; round < TRACE_CLOCK_ROUNDS; round++){
+			double sent = monotonic_time();
+			MPI_Send(NULL, 0, MPI_BYTE, 0, TRACE_CLOCK_TAG, comm);
+			MPI_Recv(&root_time, 1, MPI_DOUBLE, 0, TRACE_CLOCK_TAG, comm, MPI_STATUS_IGNORE);
+			double received = monotonic_time();
+			if(best_rtt < 0 || received - sent < best_rtt){
+				best_rtt = received - sent;
+				trace->clock_offset = root_time - 0.5 * (sent + received);
+			}
+		}
+	}
+
+	trace->origin = monotonic_time() + trace->clock_offset;
+	transport_bcast(t, &trace->origin, sizeof(double), 0);
+}
+
+void trace_write( struct tracer *trace, const char *filename, struct transport *t ){
+	int rank = t->rank, n_proc = t->n_proc;
+
+	// oldest first, on rank 0's clock
+	int count = (int) MIN(trace->recorded, (long) trace->capacity);
+	long first = trace->recorded - count;
+	struct trace_event *events = (struct trace_event *) malloc((count > 0 ? count : 1) * sizeof(struct trace_event));
+	for(int i = 0; i < count; i++){
+		events[i] = trace->ring[(first + i) % trace->capacity];
+		events[i].begin += trace->clock_offset - trace->origin;
+		events[i].end += trace->clock_offset - trace->origin;
+	}
+
+	int bytes = count * sizeof(struct trace_event);
+	int *sizes = NULL, *offsets = NULL;
+	struct trace_event *all = NULL;
+	if(rank == 0){
+		sizes = (int *) malloc(n_proc * sizeof(int));
+		offsets = (int *) malloc(n_proc * sizeof(int));
+	}
+	transport_gather(t, &bytes, sizeof(int), sizes, 0);
+	if(rank == 0){
+		int total = 0;
+		for(int r = 0; r < n_proc; r++){
+			offsets[r] = total;
+			total += sizes[r];
+		}
+		all = (struct trace_event *) malloc(total > 0 ? total : 1);
+	}
+	transport_gatherv(t, events, bytes, 1, all, sizes, offsets, 0);
+
+	if(rank == 0){
+		FILE *f = fopen(filename, "w");
+		if(!f){
+			fprintf(stderr, "%s Couldn't open trace file %s\n", MPI_PREPEND, filename);
+		}else{
+			fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+			bool first_event = true;
+			for(int r = 0; r < n_proc; r++){
+				fprintf(f, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}}", first_event ? "" : ",\n", r, r);
+				first_event = false;
+
+				struct trace_event *e = (struct trace_event *) ((char *) all + offsets[r]);
+				int n = sizes[r] / sizeof(struct trace_event);
+				for(int i = 0; i < n; i++){
+					fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"step\": %d}}",
+						phase_names[e[i].phase], r, 1.0e6 * e[i].begin, 1.0e6 * (e[i].end - e[i].begin), e[i].step);
+				}
+			}
+			fprintf(f, "\n]}\n");
+			fclose(f);
+			fprintf(stderr, "%s wrote trace to %s\n", MPI_PREPEND, filename);
+		}
+		free(sizes);
+		free(offsets);
+		free(all);
+	}
+
+	if(trace->recorded > trace->capacity){
+		fprintf(stderr, "%s rank %d trace kept the last %d of %ld events\n", MPI_PREPEND, rank, trace->capacity, trace->recorded);
+	}
+	free(events);
+}
+
+void trace_free( struct tracer *trace ){
+	free(trace->ring);
+	memset(trace, 0, sizeof(struct tracer));
+}
@@ -0,0 +1,49 @@
+#ifndef TRACE_H__
+#define TRACE_H__
+
+struct transport;
+
+//
+//  timeline tracing of step phases, written as Chrome trace JSON
+//  (chrome://tracing, ui.perfetto.dev)
+//
+//  Each rank keeps its last `capacity` events in a ring buffer; nothing is
+//  communicated until the end of the run.
+//
+
+struct trace_event{
+	double begin;
+	double end;
+	int phase;
+	int step;
+};
+
+struct tracer{
+	struct trace_event *ring;
+	int capacity;
+	long recorded;
+	// add to local monotonic time to get rank 0's clock
+	double clock_offset;
+	double origin;
+};
+
+// Collective: allocates the ring and aligns this rank's clock to rank 0's
+// with a few ping-pongs (keeping the one with the smallest round trip);
+// thread ranks already share one clock.
+void trace_init( struct tracer *trace, int capacity, struct transport *t );
+
+inline void trace_record( struct tracer *trace, int phase, int step, double begin, double end ){
+	struct trace_event *e = &trace->ring[trace->recorded % trace->capacity];
+	e->begin = begin;
+	e->end = end;
+	e->phase = phase;
+	e->step = step;
+	trace->recorded++;
+}
+
+// Collective: gathers every rank's events on rank 0, which writes filename.
+void trace_write( struct tracer *trace, const char *filename, struct transport *t );
+
+void trace_free( struct tracer *trace );
+
+#endif
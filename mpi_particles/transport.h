@@ -0,0 +1,173 @@
+#ifndef TRANSPORT_H__
+#define TRANSPORT_H__
+
+#include <mpi.h>
+#include "common.h"
+
+struct profiler;
+
+//
+//  how ranks talk to each other
+//
+//  The step loop only uses these collectives and the neighbour exchange of
+//  agents. Ranks are either MPI processes (transport_mpi_init) or threads
+//  of one process sharing the map and the initial agents
+//  (transport_threads_run). Every rank of a transport must make the same
+//  calls in the same order.
+//
+
+enum transport_type{
+	TRANSPORT_INT,
+	TRANSPORT_LONG,
+	TRANSPORT_DOUBLE
+};
+
+enum transport_op{
+	TRANSPORT_SUM,
+	TRANSPORT_MIN,
+	TRANSPORT_MAX
+};
+
+// root of a reduction whose result every rank gets
+#define TRANSPORT_ALL -1
+
+struct transport;
+
+//
+//  an output frame: a gatherv to root that completes in the background. It
+//  goes over a channel of its own, so it may stay in flight across any of
+//  the other calls; frames complete in the order they were started.
+//
+struct transport_frame{
+	const void *send;
+	int count;
+	int elem_size;
+	void *recv;
+	int root;
+	// root: elements from every rank in all, once done
+	int total;
+	// root: n_proc ints each, scratch for the backend while in flight
+	int *counts;
+	int *offsets;
+	// backend state
+	bool counts_in;
+	MPI_Request requests[2];
+};
+
+struct transport_ops{
+	void (*barrier)( struct transport *t );
+	void (*bcast)( struct transport *t, void *buf, int bytes, int root );
+	// recv may be send (in place); it is only written on root, or on
+	// every rank for TRANSPORT_ALL
+	void (*reduce)( struct transport *t, const void *send, void *recv, int count, int type, int op, int root );
+	// `bytes` from every rank into root's recv, in rank order
+	void (*gather)( struct transport *t, const void *send, int bytes, void *recv, int root );
+	// count elements of elem_size bytes from every rank; counts and offsets
+	// (in elements) are only read on root. Root's send may already sit at
+	// its own offset in recv.
+	void (*gatherv)( struct transport *t, const void *send, int count, int elem_size, void *recv, const int *counts, const int *offsets, int root );
+	// agents near or over a subdivision edge: to_send[r] holds send_counts[r]
+	// agents for rank r, and may be reused once this returns. What other
+	// ranks sent is appended to recv from *recv_count on, which is advanced.
+	void (*exchange)( struct transport *t, particle_t **to_send, const int *send_counts, particle_t *recv, int *recv_count, struct profiler *prof );
+	// like gatherv, with root's counts found by the backend; send and recv
+	// are in use until frame_done says otherwise
+	void (*frame_start)( struct transport *t, struct transport_frame *frame, const void *send, int count, int elem_size, void *recv, int root );
+	// whether the frame is done, waiting for it if asked to
+	bool (*frame_done)( struct transport *t, struct transport_frame *frame, bool wait );
+	// MPI itself is finalized with the transport over MPI_COMM_WORLD
+	void (*finalize)( struct transport *t );
+};
+
+struct transport{
+	int rank;
+	int n_proc;
+	// ranks share one address space and one clock
+	bool shared_memory;
+	const struct transport_ops *ops;
+	// communicator of the MPI backend, MPI_COMM_NULL for threads
+	MPI_Comm comm;
+	// backend state
+	void *impl;
+};
+
+// one rank per process of comm (MPI must be initialized)
+void transport_mpi_init( struct transport *t, MPI_Comm comm );
+
+//
+//  memory shared by the MPI ranks of one node (--shm); all collective over
+//  the transport, MPI backend only
+//
+
+// The same block of bytes on every rank of a node; *leader is set on the
+// one rank per node that should fill it.
+void *transport_node_alloc( struct transport *t, long bytes, bool *leader );
+
+// returns once the leaders of this node's blocks are done writing them
+void transport_node_sync( struct transport *t );
+
+// rank 0's node block to the same block on every other node, then a sync
+void transport_node_bcast( struct transport *t, void *block, long bytes );
+
+// Agents for ranks on this node go through a shared outbox of capacity
+// agents per rank from now on; batches that don't fit are sent as messages.
+void transport_node_exchange( struct transport *t, int capacity );
+
+int transport_node_size( struct transport *t );
+
+// the lowest rank on each rank's node, for every rank
+void transport_node_of( struct transport *t, int *node_of );
+
+//
+//  one-sided exchange (--rma), MPI backend only
+//
+//  From now on agents are MPI_Put into a window on each neighbour, the count
+//  and the agents of a batch in the same epoch. The epoch is either a fence
+//  over all ranks or, with pscw, post/start/complete/wait over the
+//  neighbours alone. neighbors must be the same relation on every rank and
+//  hold every rank we ever send to. A neighbour's slot holds capacity
+//  agents; the rest of a bigger batch follows as a message. Collective.
+//
+void transport_rma_exchange( struct transport *t, const int *neighbors, int count, int capacity, bool pscw );
+
+// Runs body on n_proc threads of this process, one rank each, and returns
+// the first non-zero result once all of them finished.
+int transport_threads_run( int n_proc, int (*body)( struct transport *t, void *arg ), void *arg );
+
+inline void transport_barrier( struct transport *t ){
+	t->ops->barrier(t);
+}
+
+inline void transport_bcast( struct transport *t, void *buf, int bytes, int root ){
+	t->ops->bcast(t, buf, bytes, root);
+}
+
+inline void transport_reduce( struct transport *t, const void *send, void *recv, int count, int type, int op, int root ){
+	t->ops->reduce(t, send, recv, count, type, op, root);
+}
+
+inline void transport_gather( struct transport *t, const void *send, int bytes, void *recv, int root ){
+	t->ops->gather(t, send, bytes, recv, root);
+}
+
+inline void transport_gatherv( struct transport *t, const void *send, int count, int elem_size, void *recv, const int *counts, const int *offsets, int root ){
+	t->ops->gatherv(t, send, count, elem_size, recv, counts, offsets, root);
+}
+
+inline void transport_exchange( struct transport *t, particle_t **to_send, const int *send_counts, particle_t *recv, int *recv_count, struct profiler *prof ){
+	t->ops->exchange(t, to_send, send_counts, recv, recv_count, prof);
+}
+
+inline void transport_frame_start( struct transport *t, struct transport_frame *frame, const void *send, int count, int elem_size, void *recv, int root ){
+	t->ops->frame_start(t, frame, send, count, elem_size, recv, root);
+}
+
+inline bool transport_frame_done( struct transport *t, struct transport_frame *frame, bool wait ){
+	return t->ops->frame_done(t, frame, wait);
+}
+
+inline void transport_finalize( struct transport *t ){
+	t->ops->finalize(t);
+}
+
+#endif
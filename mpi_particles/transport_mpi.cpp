@@ -0,0 +1,636 @@
+#include <mpi.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include <thread>
+#include "common.h"
+#include "profiler.h"
+#include "transport.h"
+
+//
+//  ranks are MPI processes
+//
+//  With node sharing (--shm) the ranks of one node also share MPI windows:
+//  blocks such as the map that the node leader fills, and one outbox per
+//  rank from which on-node neighbours copy their ghosts directly once its
+//  round flag is up. Only ranks on other nodes get messages.
+//
+//  With --rma, ghosts are put straight into a window on each neighbour,
+//  one slot per neighbour, and nothing is matched on the receiving side.
+//
+//  Output frames go over a duplicate of the communicator: a non-blocking
+//  gather of the counts, then the gatherv of the agents, which root can
+//  only post once it has the counts.
+//
+
+// exchange rounds alternate between two tags, so a rank already sending
+// the next round can't be mistaken for this one by a slower rank
+#define SEND_PARTICLES 102
+// the part of a batch that didn't fit a neighbour's window slot
+#define RMA_OVERFLOW 104
+
+// outbox header fields each get a line so flags don't share one
+#define CACHE_LINE 64
+// spins before yielding the core while waiting on a node neighbour
+#define SPINS_BEFORE_YIELD 128
+// largest single broadcast of a node block
+#define NODE_BCAST_CHUNK (1 << 30)
+
+struct mpi_transport{
+	// byte counts and offsets for gatherv on root
+	int *sizes;
+	int *offsets;
+	// output frames, and on root the last one started, whose gatherv is
+	// posted before the next frame's counts so they stay in order
+	MPI_Comm frame_comm;
+	struct transport_frame *unposted;
+	// exchange bookkeeping, one per rank: agents that came by message and
+	// where they wait in stage, and our sends
+	int *to_receive;
+	int *staged_at;
+	MPI_Request *particle_requests;
+	particle_t *stage;
+	int stage_space;
+	// --shm: ranks of this node, in node order, and each world rank's place
+	// among them (-1 off this node)
+	MPI_Comm node_comm;
+	MPI_Comm leader_comm;
+	int node_rank;
+	int node_size;
+	int *node_ranks;
+	int *node_index;
+	// windows to free at the end
+	MPI_Win *windows;
+	int windows_count;
+	// every node rank's outbox, NULL unless exchanging through them
+	char **outboxes;
+	int capacity;
+	long round;
+	// batches of this round that didn't fit our outbox and go as messages
+	bool *by_message;
+	// --rma: our window, neighbours in rank order, our slot in each of their
+	// windows and where the agents start there, and what we put this round
+	MPI_Win rma_win;
+	char *rma_base;
+	MPI_Group rma_group;
+	bool rma_pscw;
+	int rma_count;
+	int rma_capacity;
+	int *rma_neighbors;
+	int *rma_slot;
+	int *rma_agents_at;
+	int *rma_sent;
+};
+
+//
+//  outbox: the round last posted, then the round each node rank last took
+//  its batch in, then per node rank the batch's count (-1: sent as a
+//  message instead) and offset, then the agents
+//
+static inline std::atomic<long> *box_posted( char *box ){
+	return (std::atomic<long> *) box;
+}
+
+static inline std::atomic<long> *box_taken( char *box, int node_rank ){
+	return (std::atomic<long> *) (box + CACHE_LINE * (1 + node_rank));
+}
+
+static inline int *box_counts( struct mpi_transport *mt, char *box ){
+	return (int *) (box + CACHE_LINE * (1 + mt->node_size));
+}
+
+static inline int *box_offsets( struct mpi_transport *mt, char *box ){
+	return box_counts(mt, box) + mt->node_size;
+}
+
+static inline long box_header_bytes( struct mpi_transport *mt ){
+	long table = 2 * mt->node_size * sizeof(int);
+	return CACHE_LINE * (1 + mt->node_size) + (table + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+static inline particle_t *box_agents( struct mpi_transport *mt, char *box ){
+	return (particle_t *) (box + box_header_bytes(mt));
+}
+
+static inline bool node_peer( struct mpi_transport *mt, int rank, int other ){
+	return mt->outboxes && other != rank && mt->node_index[other] >= 0;
+}
+
+static void wait_round( std::atomic<long> *flag, long round ){
+	int spins = 0;
+	while(flag->load(std::memory_order_acquire) != round){
+		if(++spins >= SPINS_BEFORE_YIELD){
+			std::this_thread::yield();
+			spins = 0;
+		}
+	}
+}
+
+static MPI_Datatype mpi_type( int type ){
+	return type == TRANSPORT_INT ? MPI_INT : (type == TRANSPORT_LONG ? MPI_LONG : MPI_DOUBLE);
+}
+
+static MPI_Op mpi_op( int op ){
+	return op == TRANSPORT_SUM ? MPI_SUM : (op == TRANSPORT_MIN ? MPI_MIN : MPI_MAX);
+}
+
+static void mpi_barrier( struct transport *t ){
+	MPI_Barrier(t->comm);
+}
+
+static void mpi_bcast( struct transport *t, void *buf, int bytes, int root ){
+	MPI_Bcast(buf, bytes, MPI_BYTE, root, t->comm);
+}
+
+static void mpi_reduce( struct transport *t, const void *send, void *recv, int count, int type, int op, int root ){
+	if(root == TRANSPORT_ALL){
+		MPI_Allreduce(send == recv ? MPI_IN_PLACE : send, recv, count, mpi_type(type), mpi_op(op), t->comm);
+	}else{
+		bool in_place = send == recv && t->rank == root;
+		MPI_Reduce(in_place ? MPI_IN_PLACE : send, recv, count, mpi_type(type), mpi_op(op), root, t->comm);
+	}
+}
+
+static void mpi_gather( struct transport *t, const void *send, int bytes, void *recv, int root ){
+	MPI_Gather(send, bytes, MPI_BYTE, recv, bytes, MPI_BYTE, root, t->comm);
+}
+
+static void mpi_gatherv( struct transport *t, const void *send, int count, int elem_size, void *recv, const int *counts, const int *offsets, int root ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	bool in_place = false;
+	if(t->rank == root){
+		for(int r = 0; r < t->n_proc; r++){
+			mt->sizes[r] = counts[r] * elem_size;
+			mt->offsets[r] = offsets[r] * elem_size;
+		}
+		in_place = send == (char *) recv + mt->offsets[root];
+	}
+	MPI_Gatherv(in_place ? MPI_IN_PLACE : send, count * elem_size, MPI_BYTE, recv, mt->sizes, mt->offsets, MPI_BYTE, root, t->comm);
+}
+
+// root's gatherv of a frame, once its counts are in
+static void post_frame( struct transport *t, struct transport_frame *frame ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	MPI_Wait(&frame->requests[0], MPI_STATUS_IGNORE);
+	frame->total = 0;
+	for(int r = 0; r < t->n_proc; r++){
+		frame->offsets[r] = frame->total * frame->elem_size;
+		frame->total += frame->counts[r];
+		frame->counts[r] *= frame->elem_size;
+	}
+	MPI_Igatherv(frame->send, frame->count * frame->elem_size, MPI_BYTE, frame->recv, frame->counts, frame->offsets, MPI_BYTE,
+		frame->root, mt->frame_comm, &frame->requests[1]);
+	frame->counts_in = true;
+	mt->unposted = NULL;
+}
+
+static void mpi_frame_start( struct transport *t, struct transport_frame *frame, const void *send, int count, int elem_size, void *recv, int root ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	if(mt->unposted){
+		post_frame(t, mt->unposted);
+	}
+	frame->send = send;
+	frame->count = count;
+	frame->elem_size = elem_size;
+	frame->recv = recv;
+	frame->root = root;
+	frame->counts_in = false;
+	MPI_Igather(&frame->count, 1, MPI_INT, frame->counts, 1, MPI_INT, root, mt->frame_comm, &frame->requests[0]);
+	if(t->rank == root){
+		mt->unposted = frame;
+	}else{
+		MPI_Igatherv(send, count * elem_size, MPI_BYTE, NULL, NULL, NULL, MPI_BYTE, root, mt->frame_comm, &frame->requests[1]);
+	}
+}
+
+static bool mpi_frame_done( struct transport *t, struct transport_frame *frame, bool wait ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	int done = 0;
+	if(frame == mt->unposted){
+		if(!wait){
+			MPI_Test(&frame->requests[0], &done, MPI_STATUS_IGNORE);
+			if(!done){
+				return false;
+			}
+		}
+		post_frame(t, frame);
+	}
+	if(wait){
+		MPI_Waitall(2, frame->requests, MPI_STATUSES_IGNORE);
+		return true;
+	}
+	MPI_Testall(2, frame->requests, &done, MPI_STATUSES_IGNORE);
+	return done;
+}
+
+// on-node batches into our outbox, once every neighbour took the last ones;
+// the batches are packed back to back, so a neighbour's new batch may
+// cover what another has yet to copy out of the last round
+static void post_outbox( struct transport *t, particle_t **to_send, const int *send_counts, long round, struct profiler *prof ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	char *mine = mt->outboxes[mt->node_rank];
+	int *counts = box_counts(mt, mine), *offsets = box_offsets(mt, mine);
+	particle_t *agents = box_agents(mt, mine);
+	for(int j = 0; j < mt->node_size; j++){
+		if(j != mt->node_rank){
+			wait_round(box_taken(mine, j), round - 1);
+		}
+	}
+	int used = 0;
+	for(int j = 0; j < mt->node_size; j++){
+		int to = mt->node_ranks[j];
+		if(to == t->rank){
+			continue;
+		}
+		int count = send_counts[to];
+		mt->by_message[to] = false;
+		if(count > 0 && used + count <= mt->capacity){
+			memcpy(&agents[used], to_send[to], count * sizeof(particle_t));
+			offsets[j] = used;
+			counts[j] = count;
+			used += count;
+			profile_sent(prof, count * sizeof(particle_t), 1);
+		}else{
+			counts[j] = count > 0 ? -1 : 0;
+			mt->by_message[to] = count > 0;
+		}
+	}
+	box_posted(mine)->store(round, std::memory_order_release);
+}
+
+//
+//  sparse exchange (NBX): synchronous sends only to the ranks that get
+//  agents, receives of whatever arrives, and a non-blocking barrier entered
+//  once all our sends were matched. When that barrier completes every
+//  message of the round has been received, so the cost follows the number
+//  of neighbours rather than of ranks.
+//
+static void rma_exchange( struct transport *t, particle_t **to_send, const int *send_counts, particle_t *recv, int *recv_count, struct profiler *prof );
+
+static void mpi_exchange( struct transport *t, particle_t **to_send, const int *send_counts, particle_t *recv, int *recv_count, struct profiler *prof ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	if(mt->rma_neighbors){
+		rma_exchange(t, to_send, send_counts, recv, recv_count, prof);
+		return;
+	}
+	int n_proc = t->n_proc;
+	long round = ++mt->round;
+	int tag = SEND_PARTICLES + (int) (round & 1);
+	if(mt->outboxes){
+		post_outbox(t, to_send, send_counts, round, prof);
+	}
+
+	int sends = 0;
+	for(int i = 0; i < n_proc; i++){
+		if(send_counts[i] > 0 && (!node_peer(mt, t->rank, i) || mt->by_message[i])){
+			MPI_Issend(to_send[i], send_counts[i] * sizeof(particle_t), MPI_BYTE, i, tag, t->comm, &mt->particle_requests[sends++]);
+			profile_sent(prof, send_counts[i] * sizeof(particle_t), 1);
+		}
+	}
+
+	memset(mt->to_receive, 0, n_proc * sizeof(int));
+	int staged = 0, sent = 0, done = 0;
+	MPI_Request barrier = MPI_REQUEST_NULL;
+	while(!done){
+		int arrived;
+		MPI_Status status;
+		MPI_Iprobe(MPI_ANY_SOURCE, tag, t->comm, &arrived, &status);
+		if(arrived){
+			int bytes;
+			MPI_Get_count(&status, MPI_BYTE, &bytes);
+			int count = bytes / sizeof(particle_t);
+			if(staged + count > mt->stage_space){
+				mt->stage_space = MAX(2 * mt->stage_space, staged + count);
+				mt->stage = (particle_t *) realloc(mt->stage, mt->stage_space * sizeof(particle_t));
+			}
+			MPI_Recv(&mt->stage[staged], bytes, MPI_BYTE, status.MPI_SOURCE, tag, t->comm, MPI_STATUS_IGNORE);
+			mt->to_receive[status.MPI_SOURCE] = count;
+			mt->staged_at[status.MPI_SOURCE] = staged;
+			staged += count;
+		}
+		if(barrier == MPI_REQUEST_NULL){
+			// a send is complete once its receive has started
+			while(sent < sends){
+				int complete;
+				MPI_Test(&mt->particle_requests[sent], &complete, MPI_STATUS_IGNORE);
+				if(!complete){
+					break;
+				}
+				sent++;
+			}
+			if(sent == sends){
+				MPI_Ibarrier(t->comm, &barrier);
+				profile_mark(prof, PHASE_EXCHANGE);
+			}
+		}else{
+			MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+		}
+	}
+	profile_mark(prof, PHASE_BARRIER);
+
+	// batches land in rank order whichever way they travelled
+	for(int i = 0; i < n_proc; i++){
+		if(node_peer(mt, t->rank, i)){
+			char *box = mt->outboxes[mt->node_index[i]];
+			wait_round(box_posted(box), round);
+			int count = box_counts(mt, box)[mt->node_rank];
+			if(count > 0){
+				memcpy(&recv[*recv_count], &box_agents(mt, box)[box_offsets(mt, box)[mt->node_rank]], count * sizeof(particle_t));
+				*recv_count += count;
+			}
+			box_taken(box, mt->node_rank)->store(round, std::memory_order_release);
+		}
+		if(mt->to_receive[i] > 0){
+			memcpy(&recv[*recv_count], &mt->stage[mt->staged_at[i]], mt->to_receive[i] * sizeof(particle_t));
+			*recv_count += mt->to_receive[i];
+		}
+	}
+	profile_mark(prof, PHASE_EXCHANGE);
+}
+
+//
+//  one-sided exchange: our window holds a count per neighbour, then a slot
+//  of rma_capacity agents per neighbour
+//
+static inline long rma_header_bytes( int neighbors ){
+	return ((long) neighbors * sizeof(int) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+static void rma_exchange( struct transport *t, particle_t **to_send, const int *send_counts, particle_t *recv, int *recv_count, struct profiler *prof ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	int capacity = mt->rma_capacity;
+	// a window only takes batches from its neighbours
+	for(int i = 0, j = 0; i < t->n_proc; i++){
+		bool neighbor = j < mt->rma_count && mt->rma_neighbors[j] == i;
+		j += neighbor;
+		if(send_counts[i] > 0 && !neighbor && i != t->rank){
+			fprintf(stderr, "%s rank %d has %d agents for rank %d, which is not a neighbour\n", MPI_PREPEND, t->rank, send_counts[i], i);
+			MPI_Abort(t->comm, 1);
+		}
+	}
+
+	// open the epoch; either way no neighbour writes before we have read
+	// the last round out of our window
+	if(mt->rma_pscw){
+		MPI_Win_post(mt->rma_group, 0, mt->rma_win);
+		MPI_Win_start(mt->rma_group, 0, mt->rma_win);
+	}else{
+		MPI_Win_fence(0, mt->rma_win);
+	}
+	for(int j = 0; j < mt->rma_count; j++){
+		int to = mt->rma_neighbors[j];
+		mt->rma_sent[j] = send_counts[to];
+		MPI_Put(&mt->rma_sent[j], 1, MPI_INT, to, (MPI_Aint) mt->rma_slot[j] * sizeof(int), 1, MPI_INT, mt->rma_win);
+		int fits = MIN(send_counts[to], capacity);
+		if(fits > 0){
+			MPI_Aint at = mt->rma_agents_at[j] + (MPI_Aint) mt->rma_slot[j] * capacity * sizeof(particle_t);
+			MPI_Put(to_send[to], fits * sizeof(particle_t), MPI_BYTE, to, at, fits * sizeof(particle_t), MPI_BYTE, mt->rma_win);
+			profile_sent(prof, fits * sizeof(particle_t), 1);
+		}
+	}
+	if(mt->rma_pscw){
+		MPI_Win_complete(mt->rma_win);
+		MPI_Win_wait(mt->rma_win);
+	}else{
+		MPI_Win_fence(0, mt->rma_win);
+	}
+	profile_mark(prof, PHASE_EXCHANGE);
+
+	// what didn't fit, then every neighbour's batch in rank order
+	int sends = 0;
+	for(int j = 0; j < mt->rma_count; j++){
+		int to = mt->rma_neighbors[j];
+		if(mt->rma_sent[j] > capacity){
+			int rest = mt->rma_sent[j] - capacity;
+			MPI_Isend(to_send[to] + capacity, rest * sizeof(particle_t), MPI_BYTE, to, RMA_OVERFLOW, t->comm, &mt->particle_requests[sends++]);
+			profile_sent(prof, rest * sizeof(particle_t), 1);
+		}
+	}
+	int *counts = (int *) mt->rma_base;
+	particle_t *slots = (particle_t *) (mt->rma_base + rma_header_bytes(mt->rma_count));
+	for(int j = 0; j < mt->rma_count; j++){
+		int fits = MIN(counts[j], capacity);
+		memcpy(&recv[*recv_count], &slots[(long) j * capacity], fits * sizeof(particle_t));
+		*recv_count += fits;
+		if(counts[j] > capacity){
+			int rest = counts[j] - capacity;
+			MPI_Recv(&recv[*recv_count], rest * sizeof(particle_t), MPI_BYTE, mt->rma_neighbors[j], RMA_OVERFLOW, t->comm, MPI_STATUS_IGNORE);
+			*recv_count += rest;
+		}
+	}
+	MPI_Waitall(sends, mt->particle_requests, MPI_STATUSES_IGNORE);
+	profile_mark(prof, PHASE_BARRIER);
+}
+
+static void mpi_finalize( struct transport *t ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	free(mt->sizes);
+	free(mt->offsets);
+	free(mt->to_receive);
+	free(mt->staged_at);
+	free(mt->particle_requests);
+	free(mt->stage);
+	MPI_Comm_free(&mt->frame_comm);
+	if(mt->rma_neighbors){
+		MPI_Win_free(&mt->rma_win);
+		MPI_Group_free(&mt->rma_group);
+		free(mt->rma_neighbors);
+		free(mt->rma_slot);
+		free(mt->rma_agents_at);
+		free(mt->rma_sent);
+	}
+	if(mt->node_comm != MPI_COMM_NULL){
+		for(int w = 0; w < mt->windows_count; w++){
+			MPI_Win_free(&mt->windows[w]);
+		}
+		free(mt->windows);
+		free(mt->outboxes);
+		free(mt->by_message);
+		free(mt->node_ranks);
+		free(mt->node_index);
+		if(mt->leader_comm != MPI_COMM_NULL){
+			MPI_Comm_free(&mt->leader_comm);
+		}
+		MPI_Comm_free(&mt->node_comm);
+	}
+	free(mt);
+	t->impl = NULL;
+	// transports over a part of the ranks leave MPI to the one over all of them
+	if(t->comm == MPI_COMM_WORLD){
+		MPI_Finalize();
+	}
+}
+
+static const struct transport_ops mpi_ops = {
+	mpi_barrier,
+	mpi_bcast,
+	mpi_reduce,
+	mpi_gather,
+	mpi_gatherv,
+	mpi_exchange,
+	mpi_frame_start,
+	mpi_frame_done,
+	mpi_finalize
+};
+
+void transport_mpi_init( struct transport *t, MPI_Comm comm ){
+	memset(t, 0, sizeof(struct transport));
+	MPI_Comm_rank(comm, &t->rank);
+	MPI_Comm_size(comm, &t->n_proc);
+	t->shared_memory = false;
+	t->comm = comm;
+	t->ops = &mpi_ops;
+
+	struct mpi_transport *mt = (struct mpi_transport *) malloc(sizeof(struct mpi_transport));
+	mt->sizes = (int *) malloc(t->n_proc * sizeof(int));
+	mt->offsets = (int *) malloc(t->n_proc * sizeof(int));
+	mt->to_receive = (int *) malloc(t->n_proc * sizeof(int));
+	mt->staged_at = (int *) malloc(t->n_proc * sizeof(int));
+	mt->particle_requests = (MPI_Request *) malloc(t->n_proc * sizeof(MPI_Request));
+	mt->stage = NULL;
+	mt->stage_space = 0;
+	MPI_Comm_dup(comm, &mt->frame_comm);
+	mt->unposted = NULL;
+	mt->node_comm = MPI_COMM_NULL;
+	mt->leader_comm = MPI_COMM_NULL;
+	mt->outboxes = NULL;
+	mt->round = 0;
+	mt->rma_neighbors = NULL;
+	t->impl = mt;
+}
+
+// ranks of this node, found on first use
+static struct mpi_transport *node_setup( struct transport *t ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	if(mt->node_comm != MPI_COMM_NULL){
+		return mt;
+	}
+	MPI_Comm_split_type(t->comm, MPI_COMM_TYPE_SHARED, t->rank, MPI_INFO_NULL, &mt->node_comm);
+	MPI_Comm_rank(mt->node_comm, &mt->node_rank);
+	MPI_Comm_size(mt->node_comm, &mt->node_size);
+	// node leaders, ordered by rank so rank 0 leads them
+	MPI_Comm_split(t->comm, mt->node_rank == 0 ? 0 : MPI_UNDEFINED, t->rank, &mt->leader_comm);
+
+	mt->node_ranks = (int *) malloc(mt->node_size * sizeof(int));
+	MPI_Allgather(&t->rank, 1, MPI_INT, mt->node_ranks, 1, MPI_INT, mt->node_comm);
+	mt->node_index = (int *) malloc(t->n_proc * sizeof(int));
+	for(int i = 0; i < t->n_proc; i++){
+		mt->node_index[i] = -1;
+	}
+	for(int j = 0; j < mt->node_size; j++){
+		mt->node_index[mt->node_ranks[j]] = j;
+	}
+	mt->windows = NULL;
+	mt->windows_count = 0;
+	mt->by_message = (bool *) calloc(t->n_proc, sizeof(bool));
+	return mt;
+}
+
+// each node rank's bytes of a new window, returning where every one starts
+static void node_window( struct mpi_transport *mt, long bytes, char **bases ){
+	char *mine;
+	mt->windows = (MPI_Win *) realloc(mt->windows, (mt->windows_count + 1) * sizeof(MPI_Win));
+	MPI_Win *win = &mt->windows[mt->windows_count++];
+	MPI_Win_allocate_shared(bytes, 1, MPI_INFO_NULL, mt->node_comm, &mine, win);
+	for(int j = 0; j < mt->node_size; j++){
+		MPI_Aint size;
+		int disp_unit;
+		MPI_Win_shared_query(*win, j, &size, &disp_unit, &bases[j]);
+	}
+}
+
+void *transport_node_alloc( struct transport *t, long bytes, bool *leader ){
+	struct mpi_transport *mt = node_setup(t);
+	char *bases[mt->node_size];
+	node_window(mt, mt->node_rank == 0 ? bytes : 0, bases);
+	*leader = mt->node_rank == 0;
+	return bases[0];
+}
+
+void transport_node_sync( struct transport *t ){
+	struct mpi_transport *mt = node_setup(t);
+	MPI_Barrier(mt->node_comm);
+}
+
+void transport_node_bcast( struct transport *t, void *block, long bytes ){
+	struct mpi_transport *mt = node_setup(t);
+	if(mt->leader_comm != MPI_COMM_NULL){
+		for(long done = 0; done < bytes; done += NODE_BCAST_CHUNK){
+			MPI_Bcast((char *) block + done, (int) MIN(bytes - done, (long) NODE_BCAST_CHUNK), MPI_BYTE, 0, mt->leader_comm);
+		}
+	}
+	MPI_Barrier(mt->node_comm);
+}
+
+void transport_node_exchange( struct transport *t, int capacity ){
+	struct mpi_transport *mt = node_setup(t);
+	mt->capacity = capacity;
+	mt->outboxes = (char **) malloc(mt->node_size * sizeof(char *));
+	node_window(mt, box_header_bytes(mt) + (long) capacity * sizeof(particle_t), mt->outboxes);
+	char *mine = mt->outboxes[mt->node_rank];
+	new (box_posted(mine)) std::atomic<long>(0);
+	for(int j = 0; j < mt->node_size; j++){
+		new (box_taken(mine, j)) std::atomic<long>(0);
+	}
+	MPI_Barrier(mt->node_comm);
+}
+
+int transport_node_size( struct transport *t ){
+	return node_setup(t)->node_size;
+}
+
+void transport_node_of( struct transport *t, int *node_of ){
+	struct mpi_transport *mt = node_setup(t);
+	MPI_Allgather(&mt->node_ranks[0], 1, MPI_INT, node_of, 1, MPI_INT, t->comm);
+}
+
+void transport_rma_exchange( struct transport *t, const int *neighbors, int count, int capacity, bool pscw ){
+	struct mpi_transport *mt = (struct mpi_transport *) t->impl;
+	mt->rma_count = count;
+	mt->rma_capacity = capacity;
+	mt->rma_pscw = pscw;
+	mt->rma_neighbors = (int *) malloc((count + 1) * sizeof(int));
+	mt->rma_slot = (int *) malloc((count + 1) * sizeof(int));
+	mt->rma_agents_at = (int *) malloc((count + 1) * sizeof(int));
+	mt->rma_sent = (int *) malloc((count + 1) * sizeof(int));
+	memcpy(mt->rma_neighbors, neighbors, count * sizeof(int));
+	for(int j = 1; j < count; j++){
+		for(int k = j; k > 0 && mt->rma_neighbors[k - 1] > mt->rma_neighbors[k]; k--){
+			int swap = mt->rma_neighbors[k];
+			mt->rma_neighbors[k] = mt->rma_neighbors[k - 1];
+			mt->rma_neighbors[k - 1] = swap;
+		}
+	}
+
+	long header = rma_header_bytes(count);
+	MPI_Win_allocate(header + (long) count * capacity * sizeof(particle_t), 1, MPI_INFO_NULL, t->comm, &mt->rma_base, &mt->rma_win);
+	memset(mt->rma_base, 0, header);
+
+	// tell each neighbour which of its slots we are and where its own
+	// window's agents start
+	int *mine = (int *) malloc(2 * (count + 1) * sizeof(int));
+	int *theirs = (int *) malloc(2 * (count + 1) * sizeof(int));
+	MPI_Request *requests = (MPI_Request *) malloc(2 * (count + 1) * sizeof(MPI_Request));
+	for(int j = 0; j < count; j++){
+		mine[2 * j] = j;
+		mine[2 * j + 1] = (int) header;
+		MPI_Irecv(&theirs[2 * j], 2, MPI_INT, mt->rma_neighbors[j], RMA_OVERFLOW, t->comm, &requests[2 * j]);
+		MPI_Isend(&mine[2 * j], 2, MPI_INT, mt->rma_neighbors[j], RMA_OVERFLOW, t->comm, &requests[2 * j + 1]);
+	}
+	MPI_Waitall(2 * count, requests, MPI_STATUSES_IGNORE);
+	for(int j = 0; j < count; j++){
+		mt->rma_slot[j] = theirs[2 * j];
+		mt->rma_agents_at[j] = theirs[2 * j + 1];
+	}
+	free(mine);
+	free(theirs);
+	free(requests);
+
+	MPI_Group everyone;
+	MPI_Comm_group(t->comm, &everyone);
+	MPI_Group_incl(everyone, count, mt->rma_neighbors, &mt->rma_group);
+	MPI_Group_free(&everyone);
+	MPI_Barrier(t->comm);
+}
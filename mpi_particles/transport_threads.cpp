@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "common.h"
+#include "profiler.h"
+#include "transport.h"
+
+//
+//  ranks are threads of this process
+//
+//  Collectives publish a pointer per rank and meet at a spinning barrier;
+//  the agent exchange goes through one single-producer single-consumer
+//  mailbox per pair of ranks. Nothing is serialized: a receiver copies
+//  straight out of the sender's buffer into its own agents.
+//
+
+// spins before yielding the core to another rank
+#define SPINS_BEFORE_YIELD 128
+
+struct mailbox{
+	const particle_t *items;
+	int count;
+	// exchange round of the last post, and of the last pickup
+	std::atomic<long> posted;
+	std::atomic<long> taken;
+};
+
+struct thread_world{
+	int n_proc;
+	// sense-reversing barrier
+	std::atomic<int> arrived;
+	std::atomic<int> sense;
+	// what each rank offers to the current collective
+	const void **slots;
+	// mailboxes[from * n_proc + to]
+	struct mailbox *mailboxes;
+};
+
+struct thread_rank{
+	struct thread_world *world;
+	int sense;
+	long round;
+	// reduction result before it is written to recv
+	char *scratch;
+	int scratch_bytes;
+};
+
+static inline void spin_pause( int *spins ){
+	if(++(*spins) >= SPINS_BEFORE_YIELD){
+		std::this_thread::yield();
+		*spins = 0;
+	}
+}
+
+static void threads_barrier( struct transport *t ){
+	struct thread_rank *tr = (struct thread_rank *) t->impl;
+	struct thread_world *world = tr->world;
+	tr->sense = !tr->sense;
+	if(world->arrived.fetch_add(1, std::memory_order_acq_rel) == world->n_proc - 1){
+		world->arrived.store(0, std::memory_order_relaxed);
+		world->sense.store(tr->sense, std::memory_order_release);
+	}else{
+		int spins = 0;
+		while(world->sense.load(std::memory_order_acquire) != tr->sense){
+			spin_pause(&spins);
+		}
+	}
+}
+
+static void threads_bcast( struct transport *t, void *buf, int bytes, int root ){
+	struct thread_world *world = ((struct thread_rank *) t->impl)->world;
+	if(t->rank == root){
+		world->slots[root] = buf;
+	}
+	threads_barrier(t);
+	if(t->rank != root){
+		memcpy(buf, world->slots[root], bytes);
+	}
+	threads_barrier(t);
+}
+
+static int type_size( int type ){
+	return type == TRANSPORT_INT ? sizeof(int) : (type == TRANSPORT_LONG ? sizeof(long) : sizeof(double));
+}
+
+#define COMBINE(T) { \
+	T *a = (T *) into; \
+	const T *b = (const T *) from; \
+	for(int i = 0; i < count; i++){ \
+		a[i] = op == TRANSPORT_SUM ? a[i] + b[i] : (op == TRANSPORT_MIN ? MIN(a[i], b[i]) : MAX(a[i], b[i])); \
+	} \
+}
+
+static void combine( void *into, const void *from, int count, int type, int op ){
+	if(type == TRANSPORT_INT){
+		COMBINE(int)
+	}else if(type == TRANSPORT_LONG){
+		COMBINE(long)
+	}else{
+		COMBINE(double)
+	}
+}
+
+static void threads_reduce( struct transport *t, const void *send, void *recv, int count, int type, int op, int root ){
+	struct thread_rank *tr = (struct thread_rank *) t->impl;
+	struct thread_world *world = tr->world;
+	int bytes = count * type_size(type);
+	bool gets_result = root == TRANSPORT_ALL || t->rank == root;
+
+	world->slots[t->rank] = send;
+	threads_barrier(t);
+	if(gets_result){
+		if(tr->scratch_bytes < bytes){
+			tr->scratch = (char *) realloc(tr->scratch, bytes);
+			tr->scratch_bytes = bytes;
+		}
+		memcpy(tr->scratch, world->slots[0], bytes);
+		for(int r = 1; r < t->n_proc; r++){
+			combine(tr->scratch, world->slots[r], count, type, op);
+		}
+	}
+	// everyone has read every send buffer before any recv is written
+	threads_barrier(t);
+	if(gets_result){
+		memcpy(recv, tr->scratch, bytes);
+	}
+}
+
+static void threads_gather( struct transport *t, const void *send, int bytes, void *recv, int root ){
+	struct thread_world *world = ((struct thread_rank *) t->impl)->world;
+	world->slots[t->rank] = send;
+	threads_barrier(t);
+	if(t->rank == root){
+		for(int r = 0; r < t->n_proc; r++){
+			if(world->slots[r] != (char *) recv + r * bytes){
+				memcpy((char *) recv + r * bytes, world->slots[r], bytes);
+			}
+		}
+	}
+	threads_barrier(t);
+}
+
+static void threads_gatherv( struct transport *t, const void *send, int count, int elem_size, void *recv, const int *counts, const int *offsets, int root ){
+	struct thread_world *world = ((struct thread_rank *) t->impl)->world;
+	world->slots[t->rank] = send;
+	threads_barrier(t);
+	if(t->rank == root){
+		for(int r = 0; r < t->n_proc; r++){
+			char *into = (char *) recv + (size_t) offsets[r] * elem_size;
+			if(counts[r] > 0 && world->slots[r] != into){
+				memcpy(into, world->slots[r], (size_t) counts[r] * elem_size);
+			}
+		}
+	}
+	threads_barrier(t);
+}
+
+static void threads_exchange( struct transport *t, particle_t **to_send, const int *send_counts, particle_t *recv, int *recv_count, struct profiler *prof ){
+	struct thread_rank *tr = (struct thread_rank *) t->impl;
+	struct thread_world *world = tr->world;
+	int n_proc = t->n_proc;
+	long round = ++tr->round;
+	int spins;
+
+	// post a (possibly empty) batch to every other rank
+	for(int to = 0; to < n_proc; to++){
+		if(to == t->rank){
+			continue;
+		}
+		struct mailbox *out = &world->mailboxes[t->rank * n_proc + to];
+		out->items = to_send[to];
+		out->count = send_counts[to];
+		out->posted.store(round, std::memory_order_release);
+		if(send_counts[to] > 0){
+			profile_sent(prof, send_counts[to] * sizeof(particle_t), 1);
+		}
+	}
+
+	// copy each batch straight from the sender, then let it reuse the buffer
+	for(int from = 0; from < n_proc; from++){
+		if(from == t->rank){
+			continue;
+		}
+		struct mailbox *in = &world->mailboxes[from * n_proc + t->rank];
+		spins = 0;
+		while(in->posted.load(std::memory_order_acquire) != round){
+			spin_pause(&spins);
+		}
+		if(in->count > 0){
+			memcpy(&recv[*recv_count], in->items, in->count * sizeof(particle_t));
+			*recv_count += in->count;
+		}
+		in->taken.store(round, std::memory_order_release);
+	}
+	profile_mark(prof, PHASE_EXCHANGE);
+
+	// our buffers are free once every receiver has picked up
+	for(int to = 0; to < n_proc; to++){
+		if(to == t->rank){
+			continue;
+		}
+		struct mailbox *out = &world->mailboxes[t->rank * n_proc + to];
+		spins = 0;
+		while(out->taken.load(std::memory_order_acquire) != round){
+			spin_pause(&spins);
+		}
+	}
+	profile_mark(prof, PHASE_BARRIER);
+}
+
+// frames are copied as they start; there is nothing to overlap with
+static void threads_frame_start( struct transport *t, struct transport_frame *frame, const void *send, int count, int elem_size, void *recv, int root ){
+	frame->send = send;
+	frame->count = count;
+	frame->elem_size = elem_size;
+	frame->recv = recv;
+	frame->root = root;
+	threads_gather(t, &frame->count, sizeof(int), frame->counts, root);
+	if(t->rank == root){
+		frame->total = 0;
+		for(int r = 0; r < t->n_proc; r++){
+			frame->offsets[r] = frame->total;
+			frame->total += frame->counts[r];
+		}
+	}
+	threads_gatherv(t, send, count, elem_size, recv, frame->counts, frame->offsets, root);
+}
+
+static bool threads_frame_done( struct transport *t, struct transport_frame *frame, bool wait ){
+	return true;
+}
+
+static void threads_finalize( struct transport *t ){
+	struct thread_rank *tr = (struct thread_rank *) t->impl;
+	free(tr->scratch);
+	tr->scratch = NULL;
+	tr->scratch_bytes = 0;
+}
+
+static const struct transport_ops threads_ops = {
+	threads_barrier,
+	threads_bcast,
+	threads_reduce,
+	threads_gather,
+	threads_gatherv,
+	threads_exchange,
+	threads_frame_start,
+	threads_frame_done,
+	threads_finalize
+};
+
+struct thread_start{
+	struct transport *t;
+	int (*body)( struct transport *t, void *arg );
+	void *arg;
+	int result;
+};
+
+static void thread_main( struct thread_start *start ){
+	start->result = start->body(start->t, start->arg);
+}
+
+int transport_threads_run( int n_proc, int (*body)( struct transport *t, void *arg ), void *arg ){
+	struct thread_world *world = new thread_world;
+	world->n_proc = n_proc;
+	world->arrived.store(0);
+	world->sense.store(0);
+	world->slots = (const void **) calloc(n_proc, sizeof(void *));
+	world->mailboxes = new mailbox[n_proc * n_proc];
+	for(int i = 0; i < n_proc * n_proc; i++){
+		world->mailboxes[i].items = NULL;
+		world->mailboxes[i].count = 0;
+		world->mailboxes[i].posted.store(0);
+		world->mailboxes[i].taken.store(0);
+	}
+
+	struct transport *ranks = (struct transport *) calloc(n_proc, sizeof(struct transport));
+	struct thread_rank *impls = (struct thread_rank *) calloc(n_proc, sizeof(struct thread_rank));
+	struct thread_start *starts = (struct thread_start *) calloc(n_proc, sizeof(struct thread_start));
+	for(int r = 0; r < n_proc; r++){
+		impls[r].world = world;
+		ranks[r].rank = r;
+		ranks[r].n_proc = n_proc;
+		ranks[r].shared_memory = true;
+		ranks[r].ops = &threads_ops;
+		ranks[r].comm = MPI_COMM_NULL;
+		ranks[r].impl = &impls[r];
+		starts[r].t = &ranks[r];
+		starts[r].body = body;
+		starts[r].arg = arg;
+	}
+
+	// rank 0 runs on the calling thread
+	std::thread *workers = new std::thread[n_proc];
+	for(int r = 1; r < n_proc; r++){
+		workers[r] = std::thread(thread_main, &starts[r]);
+	}
+	thread_main(&starts[0]);
+	int result = starts[0].result;
+	for(int r = 1; r < n_proc; r++){
+		workers[r].join();
+		result = result ? result : starts[r].result;
+	}
+
+	delete [] workers;
+	free(starts);
+	free(impls);
+	free(ranks);
+	delete [] world->mailboxes;
+	free(world->slots);
+	delete world;
+	return result;
+}